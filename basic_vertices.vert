@@ -15,12 +15,35 @@ out VS_OUT {
 // Replaced with shared_uniforms.glsl in our code.
 //INCLUDE_SHARED_UNIFORMS
 
+// Used to convert compact vertices back to their original ranges. For meshes
+// with float vertices, the offsets are 0 and the scales are 1. See
+// vertex_quantization.h.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+uniform vec2 uv_offset;
+uniform vec2 uv_scale;
+// If true, normal_in.xy holds an octahedral-encoded normal.
+uniform bool octahedral_normals;
+
+// Needed for the depth pre-pass in depth_only.vert to produce identical depths.
+invariant gl_Position;
+
+vec3 DecodeNormal(vec3 n) {
+  if (!octahedral_normals) return n;
+  vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+  float t = max(-v.z, 0.0);
+  v.x += (v.x >= 0.0) ? -t : t;
+  v.y += (v.y >= 0.0) ? -t : t;
+  return normalize(v);
+}
+
 void main() {
+  vec3 position = position_offset + position_scale * position_in;
   gl_Position = shared_uniforms.projection * shared_uniforms.view *
-    model_transform_in * vec4(position_in, 1.0);
-  vs_out.texture_coord = texture_coord_in;
-  vs_out.normal = normal_in * normal_transform_in;
+    model_transform_in * vec4(position, 1.0);
+  vs_out.texture_coord = uv_offset + uv_scale * texture_coord_in;
+  vs_out.normal = DecodeNormal(normal_in) * normal_transform_in;
   // Fragment position, for lighting computations.
-  vs_out.frag_position = vec3(model_transform_in * vec4(position_in, 1.0));
+  vs_out.frag_position = vec3(model_transform_in * vec4(position, 1.0));
 }
 
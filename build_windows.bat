@@ -1,14 +1,24 @@
 gcc -Wall -Werror -O3 -o opengl_tutorial opengl_tutorial.c ^
   parse_obj.c ^
+  memory_arena.c ^
   model.c ^
+  mesh_cache.c ^
+  mesh_optimizer.c ^
+  mesh_normals.c ^
+  mesh_weld.c ^
+  mesh_simplify.c ^
+  mesh_clusters.c ^
+  vertex_quantization.c ^
   shader_program.c ^
   utilities.c ^
   scapegoat_tree.c ^
+  thread_pool.c ^
   glad\src\glad.c ^
   -I cglm\include ^
   -I glad\include ^
   -I C:\bin\glfw-3.3.3\include ^
   -L C:\bin\glfw-3.3.3\lib-static-ucrt ^
   -lglfw3dll ^
-  -lm
+  -lm ^
+  -lpthread
 
@@ -0,0 +1,5 @@
+#version 330 core
+
+// Only writes depth; color writes are turned off during the depth pre-pass.
+void main() {
+}
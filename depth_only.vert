@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (location = 0) in vec3 position_in;
+layout (location = 3) in mat4 model_transform_in;
+
+// Replaced with shared_uniforms.glsl in our code.
+//INCLUDE_SHARED_UNIFORMS
+
+// The same dequantization uniforms as basic_vertices.vert.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+// The shading pass uses GL_EQUAL depth testing against the depth written
+// here, so this must compute gl_Position exactly like basic_vertices.vert.
+invariant gl_Position;
+
+void main() {
+  vec3 position = position_offset + position_scale * position_in;
+  gl_Position = shared_uniforms.projection * shared_uniforms.view *
+    model_transform_in * vec4(position, 1.0);
+}
@@ -0,0 +1,211 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_arena.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#define MEMORY_ARENA_HUGE_PAGES
+#endif
+
+// The default minimum block size, if the arena doesn't set one.
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+// The size of a transparent huge page on x86-64 and most ARM64 systems.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+struct MemoryArenaBlock_s {
+  // The block allocated before this one, or NULL.
+  MemoryArenaBlock *previous;
+  // The next free byte in the block, and the end of the block.
+  char *next;
+  char *end;
+  // The size of the whole block, including this header, which is at its
+  // start.
+  size_t size;
+  // Nonzero if the block was mapped with mmap rather than malloc'd.
+  int mapped;
+};
+
+// Rounds size up to a multiple of ARENA_SMALL_ALIGNMENT. Returns 0 if this
+// would overflow.
+static size_t AlignSize(size_t size) {
+  if (size > (SIZE_MAX - ARENA_SMALL_ALIGNMENT)) return 0;
+  return (size + ARENA_SMALL_ALIGNMENT - 1) &
+    ~((size_t) ARENA_SMALL_ALIGNMENT - 1);
+}
+
+// Returns the alignment of an allocation of the given size.
+static size_t AllocationAlignment(size_t size) {
+  if (size < ARENA_ALIGNMENT) return ARENA_SMALL_ALIGNMENT;
+  return ARENA_ALIGNMENT;
+}
+
+#ifdef MEMORY_ARENA_HUGE_PAGES
+// Maps size bytes, which must be a multiple of HUGE_PAGE_SIZE, aligned to
+// HUGE_PAGE_SIZE so that the kernel can use huge pages for all of it, and
+// asks for huge pages. Returns NULL on error.
+static void* MapHugePages(size_t size) {
+  char *mapping = NULL, *aligned = NULL;
+  size_t padding;
+  if (size > (SIZE_MAX - HUGE_PAGE_SIZE)) return NULL;
+  // mmap only aligns to the normal page size, so map an extra huge page and
+  // trim the unaligned parts off each end.
+  mapping = (char *) mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ |
+    PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) return NULL;
+  aligned = (char *) ((((uintptr_t) mapping) + HUGE_PAGE_SIZE - 1) &
+    ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+  padding = aligned - mapping;
+  if (padding > 0) munmap(mapping, padding);
+  if (padding < HUGE_PAGE_SIZE) {
+    munmap(aligned + size, HUGE_PAGE_SIZE - padding);
+  }
+  // This only fails if huge pages aren't supported, in which case the
+  // mapping still works with normal pages.
+  madvise(aligned, size, MADV_HUGEPAGE);
+  return aligned;
+}
+#endif
+
+// Allocates a new block with room for at least size bytes of allocations,
+// and makes it a's current block. Returns 0 on error.
+static int AddBlock(MemoryArena *a, size_t size) {
+  MemoryArenaBlock *block = NULL;
+  size_t header_size = (sizeof(MemoryArenaBlock) + ARENA_ALIGNMENT - 1) &
+    ~((size_t) ARENA_ALIGNMENT - 1);
+  size_t block_size = a->minimum_block_size;
+  int mapped = 0;
+  if (block_size == 0) block_size = DEFAULT_BLOCK_SIZE;
+  if (block_size < a->reserved_bytes) block_size = a->reserved_bytes;
+  if (size > (SIZE_MAX - header_size)) {
+    printf("Arena allocation of %lu bytes is too big.\n",
+      (unsigned long) size);
+    return 0;
+  }
+  if (block_size < (size + header_size)) block_size = size + header_size;
+#ifdef MEMORY_ARENA_HUGE_PAGES
+  if (a->use_huge_pages && (block_size >= HUGE_PAGE_SIZE) &&
+    (block_size <= (SIZE_MAX - HUGE_PAGE_SIZE))) {
+    block_size = (block_size + HUGE_PAGE_SIZE - 1) &
+      ~((size_t) HUGE_PAGE_SIZE - 1);
+    block = (MemoryArenaBlock *) MapHugePages(block_size);
+    if (block) mapped = 1;
+  }
+#endif
+  // malloc only aligns to 16 bytes, so leave room to align the first
+  // allocation.
+  if (!block) {
+    if (block_size > (SIZE_MAX - ARENA_ALIGNMENT)) return 0;
+    block_size += ARENA_ALIGNMENT;
+    block = (MemoryArenaBlock *) malloc(block_size);
+  }
+  if (!block) {
+    printf("Failed allocating a %lu-byte arena block.\n",
+      (unsigned long) block_size);
+    return 0;
+  }
+  block->previous = a->current;
+  block->next = (char *) ((((uintptr_t) block) + header_size +
+    ARENA_ALIGNMENT - 1) & ~((uintptr_t) ARENA_ALIGNMENT - 1));
+  block->end = ((char *) block) + block_size;
+  block->size = block_size;
+  block->mapped = mapped;
+  a->current = block;
+  a->last_allocation = NULL;
+  a->reserved_bytes += block_size;
+  a->block_count++;
+  return 1;
+}
+
+// Returns the number of bytes left in a's current block.
+static size_t SpaceLeft(const MemoryArena *a) {
+  if (!a->current) return 0;
+  return a->current->end - a->current->next;
+}
+
+int ReserveArena(MemoryArena *a, size_t size) {
+  size = AlignSize(size);
+  if (size == 0) return 1;
+  if (SpaceLeft(a) >= size) return 1;
+  return AddBlock(a, size);
+}
+
+void* ArenaAllocate(MemoryArena *a, size_t size) {
+  char *to_return = NULL;
+  size_t alignment = AllocationAlignment(size), padding = 0;
+  // Zero-byte allocations still get their own address.
+  size = AlignSize(size ? size : 1);
+  if (size == 0) {
+    printf("Arena allocation is too big.\n");
+    return NULL;
+  }
+  if (a->current) {
+    padding = (-((uintptr_t) a->current->next)) & (alignment - 1);
+  }
+  if ((SpaceLeft(a) < padding) || ((SpaceLeft(a) - padding) < size)) {
+    // New blocks always start on an ARENA_ALIGNMENT boundary.
+    if (!AddBlock(a, size)) return NULL;
+    padding = 0;
+  }
+  to_return = a->current->next + padding;
+  a->current->next = to_return + size;
+  a->last_allocation = to_return;
+  a->used_bytes += padding + size;
+  return to_return;
+}
+
+void* ArenaAllocateZeroed(MemoryArena *a, size_t size) {
+  void *to_return = ArenaAllocate(a, size);
+  if (to_return) memset(to_return, 0, size);
+  return to_return;
+}
+
+void* ArenaResize(MemoryArena *a, void *old, size_t old_size,
+    size_t new_size) {
+  char *to_return = NULL;
+  size_t aligned_old = AlignSize(old_size ? old_size : 1);
+  size_t aligned_new = AlignSize(new_size ? new_size : 1);
+  size_t alignment = AllocationAlignment(new_size);
+  if (!old) return ArenaAllocate(a, new_size);
+  if (aligned_new == 0) {
+    printf("Arena allocation is too big.\n");
+    return NULL;
+  }
+  if (aligned_new <= aligned_old) return old;
+  // Grow the most recent allocation in place if there's room.
+  if ((old == a->last_allocation) &&
+    ((((uintptr_t) old) & (alignment - 1)) == 0) &&
+    ((aligned_new - aligned_old) <= SpaceLeft(a))) {
+    a->current->next += aligned_new - aligned_old;
+    a->used_bytes += aligned_new - aligned_old;
+    return old;
+  }
+  to_return = (char *) ArenaAllocate(a, new_size);
+  if (!to_return) return NULL;
+  memcpy(to_return, old, old_size);
+  return to_return;
+}
+
+void DestroyArena(MemoryArena *a) {
+  MemoryArenaBlock *block = a->current, *previous = NULL;
+  while (block) {
+    previous = block->previous;
+#ifdef MEMORY_ARENA_HUGE_PAGES
+    if (block->mapped) {
+      munmap(block, block->size);
+      block = previous;
+      continue;
+    }
+#endif
+    free(block);
+    block = previous;
+  }
+  a->current = NULL;
+  a->last_allocation = NULL;
+  a->used_bytes = 0;
+  a->reserved_bytes = 0;
+  a->block_count = 0;
+}
@@ -0,0 +1,82 @@
+// Defines a simple arena, or "bump," allocator. Allocations are carved out of
+// large blocks in order, and are never freed individually; instead, every
+// allocation is released at once when the arena is destroyed. This makes
+// allocating lots of temporary buffers, or lots of small objects like tree
+// nodes, about as cheap as incrementing a pointer.
+#ifndef OPENGL_TUTORIAL_MEMORY_ARENA_H
+#define OPENGL_TUTORIAL_MEMORY_ARENA_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+
+// Allocations of at least this many bytes start on a multiple of it, which
+// keeps big buffers on their own cache lines.
+#define ARENA_ALIGNMENT (64)
+
+// Smaller allocations, such as tree nodes, are only aligned to this many
+// bytes, like malloc, so they can be packed together.
+#define ARENA_SMALL_ALIGNMENT (16)
+
+// A block of memory that allocations are carved out of. Used internally.
+typedef struct MemoryArenaBlock_s MemoryArenaBlock;
+
+// Holds the state of an arena. A zero-initialized struct is an empty arena
+// with the default settings. The settings may be changed before the first
+// allocation.
+typedef struct {
+  // The smallest block to allocate. If this is 0, a default of 1 MB is used.
+  // Later blocks are at least as big as all the previous blocks together, so
+  // the number of blocks stays small even if this is too small.
+  size_t minimum_block_size;
+  // If nonzero, ask the OS to back blocks of 2 MB or more with transparent
+  // huge pages, which cuts down on page faults and TLB misses when touching
+  // large buffers. Ignored on systems that don't support it.
+  int use_huge_pages;
+  // The remaining fields are used internally and should not be modified.
+  // The newest block, which is where allocations currently come from. Older
+  // blocks are reachable from it.
+  MemoryArenaBlock *current;
+  // The start of the most recent allocation, which can be grown in place.
+  char *last_allocation;
+  // The number of bytes handed out, including padding for alignment, and the
+  // number of bytes in all blocks. Since nothing is freed until the arena is
+  // destroyed, these are also the arena's peak usage.
+  size_t used_bytes;
+  size_t reserved_bytes;
+  size_t block_count;
+} MemoryArena;
+
+// Makes sure the next allocations, totaling up to size bytes, can be made
+// without allocating another block. Use this when the total size of a set of
+// allocations is known ahead of time. The total should include up to
+// ARENA_ALIGNMENT bytes of padding for each allocation. Returns 0 on error.
+int ReserveArena(MemoryArena *a, size_t size);
+
+// Returns a pointer to size bytes of uninitialized memory, which stays valid
+// until the arena is destroyed. See ARENA_ALIGNMENT for its alignment. Never
+// returns NULL for a size of 0. Returns NULL on error.
+void* ArenaAllocate(MemoryArena *a, size_t size);
+
+// The same as ArenaAllocate, but fills the memory with zeros.
+void* ArenaAllocateZeroed(MemoryArena *a, size_t size);
+
+// Grows an allocation from ArenaAllocate from old_size to new_size bytes,
+// like realloc. This only happens in place if it was the most recent
+// allocation, its block has room, and it's aligned as ArenaAllocate would
+// align new_size bytes. Otherwise, its content is copied to a new
+// allocation, and the old space stays unused until the arena is destroyed.
+// If old is NULL, this is the same as ArenaAllocate. Returns NULL on error,
+// in which case the old allocation is unchanged.
+void* ArenaResize(MemoryArena *a, void *old, size_t old_size,
+    size_t new_size);
+
+// Frees every block held by the arena, invalidating every pointer it
+// returned. The arena is left empty, keeping its settings, and may be used
+// again.
+void DestroyArena(MemoryArena *a);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MEMORY_ARENA_H
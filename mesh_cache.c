@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "parse_obj.h"
+#include "utilities.h"
+#include "mesh_cache.h"
+
+// Must be increased whenever the cache file layout or the parser's output
+// changes, so that old cache files get rebuilt.
+#define OBJ_CACHE_VERSION (9)
+
+// The header at the start of every cache file. It's followed by vertex_count
+// ObjectFileVertex structs, then sub_mesh_count ObjectFileSubMesh structs,
+// then index_count 32-bit indices. The header is 128 bytes, and the vertices
+// and sub-meshes are multiples of 8 bytes, so every array is aligned within
+// the mapped file. The sub-meshes go before the indices, since an odd number
+// of indices would leave them misaligned.
+typedef struct {
+  // Always "OBJCACHE", with no null terminator.
+  char magic[8];
+  uint32_t version;
+  // sizeof(ObjectFileVertex), as a sanity check.
+  uint32_t vertex_size;
+  // The size, modification time (see GetFileSizeAndTime), and content hash of
+  // the .obj file.
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t source_hash;
+  uint64_t vertex_count;
+  uint64_t index_count;
+  ObjectFileBounds bounds;
+  uint64_t sub_mesh_count;
+  uint8_t reserved[24];
+} ObjCacheHeader;
+
+// Returns a hash of the given data. This only needs to detect changes to the
+// source file, so it reads 8 bytes at a time, and doesn't need to be
+// cryptographically secure.
+static uint64_t HashContent(const char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ull ^ size;
+  uint64_t w;
+  size_t i;
+  for (i = 0; (i + 8) <= size; i += 8) {
+    memcpy(&w, data + i, sizeof(w));
+    h ^= w * 0x9e3779b97f4a7c15ull;
+    h = ((h << 31) | (h >> 33)) * 0xbf58476d1ce4e5b9ull;
+  }
+  w = 0;
+  memcpy(&w, data + i, size - i);
+  h ^= w * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 29;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 32;
+  return h;
+}
+
+// Sets *size and *mtime to the size and modification time of the file at
+// path. The time is in nanoseconds where the platform provides them, since
+// an edit that doesn't change the file's size can easily happen within the
+// same second as the previous one. Returns 0 if the file can't be accessed,
+// without printing anything.
+static int GetFileSizeAndTime(const char *path, uint64_t *size,
+    int64_t *mtime) {
+#ifdef _WIN32
+  struct __stat64 info;
+  if (_stat64(path, &info) != 0) return 0;
+#else
+  struct stat info;
+  if (stat(path, &info) != 0) return 0;
+#endif
+  *size = (uint64_t) info.st_size;
+  *mtime = ((int64_t) info.st_mtime) * 1000000000;
+#if defined(__APPLE__)
+  *mtime += info.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+  *mtime += info.st_mtim.tv_nsec;
+#endif
+  return 1;
+}
+
+// Returns the expected size of a cache file with the given header.
+static uint64_t ExpectedCacheSize(const ObjCacheHeader *h) {
+  return sizeof(*h) + h->vertex_count * sizeof(ObjectFileVertex) +
+    h->sub_mesh_count * sizeof(ObjectFileSubMesh) + h->index_count *
+    sizeof(uint32_t);
+}
+
+// Reads and checks the header of the cache file at path. Returns 0 if the file
+// doesn't exist, or isn't a valid cache file for this version of the parser.
+static int ReadCacheHeader(const char *path, ObjCacheHeader *h) {
+  FILE *f = NULL;
+  uint64_t file_size;
+  int64_t mtime;
+  if (!GetFileSizeAndTime(path, &file_size, &mtime)) return 0;
+  f = fopen(path, "rb");
+  if (!f) return 0;
+  if (fread(h, sizeof(*h), 1, f) != 1) {
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  if (memcmp(h->magic, "OBJCACHE", sizeof(h->magic)) != 0) return 0;
+  if (h->version != OBJ_CACHE_VERSION) return 0;
+  if (h->vertex_size != sizeof(ObjectFileVertex)) return 0;
+  if ((h->vertex_count > UINT32_MAX) || (h->sub_mesh_count > UINT32_MAX)) {
+    return 0;
+  }
+  if (ExpectedCacheSize(h) != file_size) return 0;
+  return 1;
+}
+
+// Overwrites the header of an existing cache file. Returns 0 on error.
+static int UpdateCacheHeader(const char *path, const ObjCacheHeader *h) {
+  FILE *f = fopen(path, "r+b");
+  if (!f) return 0;
+  if (fwrite(h, sizeof(*h), 1, f) != 1) {
+    fclose(f);
+    return 0;
+  }
+  return fclose(f) == 0;
+}
+
+// Writes a new cache file containing the parsed object. Writes to a temporary
+// file first and then renames it, so a partially written cache is never left
+// in place. Returns 0 on error.
+static int WriteCacheFile(const char *path, ObjCacheHeader *h,
+    const ObjectFileInfo *o) {
+  FILE *f = NULL;
+  char *tmp_path = NULL;
+  int ok = 1;
+  tmp_path = (char *) malloc(strlen(path) + 5);
+  if (!tmp_path) return 0;
+  sprintf(tmp_path, "%s.tmp", path);
+  f = fopen(tmp_path, "wb");
+  if (!f) {
+    free(tmp_path);
+    return 0;
+  }
+  h->vertex_count = o->vertex_count;
+  h->index_count = o->index_count;
+  h->bounds = o->bounds;
+  h->sub_mesh_count = o->sub_mesh_count;
+  if (fwrite(h, sizeof(*h), 1, f) != 1) ok = 0;
+  if (ok && (o->vertex_count > 0) && (fwrite(o->vertices,
+    sizeof(ObjectFileVertex), o->vertex_count, f) != o->vertex_count)) {
+    ok = 0;
+  }
+  if (ok && (o->sub_mesh_count > 0) && (fwrite(o->sub_meshes,
+    sizeof(ObjectFileSubMesh), o->sub_mesh_count, f) != o->sub_mesh_count)) {
+    ok = 0;
+  }
+  if (ok && (o->index_count > 0) && (fwrite(o->indices, sizeof(uint32_t),
+    o->index_count, f) != o->index_count)) {
+    ok = 0;
+  }
+  if (fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+  // Unlike on POSIX systems, rename fails on Windows if the target exists.
+  if (ok) remove(path);
+#endif
+  if (ok && (rename(tmp_path, path) != 0)) ok = 0;
+  if (!ok) remove(tmp_path);
+  free(tmp_path);
+  return ok;
+}
+
+// Maps the cache file and points out's fields at its content. Returns 0 on
+// error.
+static int UseCacheFile(const char *path, const ObjCacheHeader *h,
+    CachedObjectFile *out) {
+  const char *mapping = NULL;
+  size_t mapping_size = 0;
+  mapping = MapFile(path, &mapping_size);
+  if (!mapping) return 0;
+  // Make sure the file didn't change since we read the header.
+  if ((mapping_size != ExpectedCacheSize(h)) ||
+    (memcmp(mapping, h, sizeof(*h)) != 0)) {
+    UnmapFile(mapping, mapping_size);
+    return 0;
+  }
+  out->mapping = mapping;
+  out->mapping_size = mapping_size;
+  out->vertices = (const ObjectFileVertex *) (mapping + sizeof(*h));
+  out->vertex_count = (uint32_t) h->vertex_count;
+  out->sub_meshes = (const ObjectFileSubMesh *) (mapping + sizeof(*h) +
+    h->vertex_count * sizeof(ObjectFileVertex));
+  out->sub_mesh_count = (uint32_t) h->sub_mesh_count;
+  out->indices = (const uint32_t *) (((const char *) out->sub_meshes) +
+    h->sub_mesh_count * sizeof(ObjectFileSubMesh));
+  out->index_count = h->index_count;
+  out->bounds = h->bounds;
+  return 1;
+}
+
+int LoadCachedObjFile(const char *obj_path, CachedObjectFile *out) {
+  ObjParseOptions options;
+  ObjCacheHeader header;
+  char *cache_path = NULL;
+  const char *content = NULL;
+  size_t content_size = 0;
+  uint64_t source_size;
+  int64_t source_mtime;
+  int cache_valid = 0;
+  memset(out, 0, sizeof(*out));
+  if (!GetFileSizeAndTime(obj_path, &source_size, &source_mtime)) {
+    printf("Failed getting the size of %s\n", obj_path);
+    return 0;
+  }
+  cache_path = (char *) malloc(strlen(obj_path) + 2);
+  if (!cache_path) {
+    printf("Failed allocating cache file path.\n");
+    return 0;
+  }
+  sprintf(cache_path, "%sc", obj_path);
+
+  if (ReadCacheHeader(cache_path, &header) &&
+    (header.source_size == source_size)) {
+    if (header.source_mtime == source_mtime) {
+      cache_valid = 1;
+    } else {
+      // The file may have been touched or copied without being changed, so
+      // check the content before throwing the cache away.
+      content = MapFile(obj_path, &content_size);
+      if (!content) goto error_cleanup;
+      if (HashContent(content, content_size) == header.source_hash) {
+        cache_valid = 1;
+        header.source_mtime = source_mtime;
+        if (!UpdateCacheHeader(cache_path, &header)) {
+          printf("Warning: failed updating cache file %s\n", cache_path);
+        }
+      }
+      UnmapFile(content, content_size);
+      content = NULL;
+    }
+  }
+  if (cache_valid && UseCacheFile(cache_path, &header, out)) {
+    free(cache_path);
+    return 1;
+  }
+
+  // The cache is missing or stale, so parse the file and rebuild it. Parse
+  // the file in place, rather than copying it to a null-terminated buffer.
+  content = MapFile(obj_path, &content_size);
+  if (!content) {
+    printf("Failed reading object file from %s\n", obj_path);
+    goto error_cleanup;
+  }
+  // Since the result is cached, it's worth optimizing the mesh here.
+  memset(&options, 0, sizeof(options));
+  options.optimize_vertex_cache = 1;
+  options.optimize_vertex_fetch = 1;
+  // Files without normals would otherwise be lit as if they were black.
+  options.generate_normals = 1;
+  // Only merge exact copies, since the scale of the model isn't known.
+  // This still drops any zero-area or repeated triangles.
+  options.weld_vertices = 1;
+  out->parsed = ParseObjFileWithOptions(content, content_size, &options);
+  if (!out->parsed) {
+    printf("Failed parsing object file %s\n", obj_path);
+    goto error_cleanup;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "OBJCACHE", sizeof(header.magic));
+  header.version = OBJ_CACHE_VERSION;
+  header.vertex_size = sizeof(ObjectFileVertex);
+  header.source_size = source_size;
+  header.source_mtime = source_mtime;
+  header.source_hash = HashContent(content, content_size);
+  UnmapFile(content, content_size);
+  content = NULL;
+  if (!WriteCacheFile(cache_path, &header, out->parsed)) {
+    printf("Warning: failed writing cache file %s\n", cache_path);
+  }
+  out->vertices = out->parsed->vertices;
+  out->vertex_count = out->parsed->vertex_count;
+  out->indices = out->parsed->indices;
+  out->index_count = out->parsed->index_count;
+  out->bounds = out->parsed->bounds;
+  out->sub_meshes = out->parsed->sub_meshes;
+  out->sub_mesh_count = out->parsed->sub_mesh_count;
+  free(cache_path);
+  return 1;
+
+error_cleanup:
+  UnmapFile(content, content_size);
+  free(cache_path);
+  FreeCachedObjFile(out);
+  return 0;
+}
+
+void FreeCachedObjFile(CachedObjectFile *c) {
+  UnmapFile(c->mapping, c->mapping_size);
+  if (c->parsed) FreeObjectFileInfo(c->parsed);
+  memset(c, 0, sizeof(*c));
+}
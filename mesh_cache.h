@@ -0,0 +1,55 @@
+// Defines a binary cache for parsed .obj files. The first time a .obj file is
+// loaded, its parsed vertices, indices, and sub-meshes are written to a cache
+// file next to it (the .obj path with a "c" appended, e.g. "cube.objc"). Later
+// loads map the cache file and use its contents directly, without parsing
+// anything.
+//
+// The cache header records the source file's size, modification time, and a
+// hash of its content. If the size or time don't match, the source file is
+// hashed again; a cache with a matching hash is still used, but otherwise the
+// .obj file is re-parsed and the cache is rebuilt. Cache files use the
+// machine's native byte order and are not meant to be portable.
+#ifndef OPENGL_TUTORIAL_MESH_CACHE_H
+#define OPENGL_TUTORIAL_MESH_CACHE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include "parse_obj.h"
+
+// Holds the vertices, indices, and sub-meshes of a .obj file loaded by
+// LoadCachedObjFile. These point either into the mapped cache file or into
+// the parsed file, and are only valid until FreeCachedObjFile is called.
+typedef struct {
+  const ObjectFileVertex *vertices;
+  uint32_t vertex_count;
+  const uint32_t *indices;
+  uint64_t index_count;
+  ObjectFileBounds bounds;
+  // The objects and groups in the file. See ObjectFileInfo.
+  const ObjectFileSubMesh *sub_meshes;
+  uint32_t sub_mesh_count;
+  // The remaining fields are used internally and should not be modified.
+  // If the cache was used, this is the mapped cache file.
+  const char *mapping;
+  size_t mapping_size;
+  // If the cache couldn't be used, this is the parsed .obj file.
+  ObjectFileInfo *parsed;
+} CachedObjectFile;
+
+// Loads the .obj file at the given path into out, using or rebuilding its
+// cache file as necessary. When the file is parsed, its triangles and
+// vertices are also reordered for the vertex cache and vertex fetches.
+// Failing to write the cache isn't an error, since the parsed file can still
+// be used. Returns 0 on error. If this succeeds, the caller must pass out to
+// FreeCachedObjFile when it's no longer needed.
+int LoadCachedObjFile(const char *obj_path, CachedObjectFile *out);
+
+// Releases the resources held by a CachedObjectFile, and zeroes it.
+void FreeCachedObjFile(CachedObjectFile *c);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_CACHE_H
@@ -0,0 +1,401 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse_obj.h"
+#include "mesh_clusters.h"
+
+// The most candidate triangles considered when growing a cluster. Triangles
+// beyond this are only considered once earlier candidates have been used.
+#define MAX_CLUSTER_CANDIDATES (512)
+
+// Holds the state used while building clusters.
+typedef struct {
+  const ObjectFileVertex *vertices;
+  const uint32_t *indices;
+  uint32_t triangle_count;
+  // The triangles using each vertex are at adjacency[adjacency_offsets[v]]
+  // through adjacency[adjacency_offsets[v + 1] - 1].
+  uint32_t *adjacency_offsets;
+  uint32_t *adjacency;
+  // Nonzero for each triangle that has been added to a cluster.
+  uint8_t *assigned;
+  // The number of triangles using each vertex that haven't been added to a
+  // cluster yet.
+  uint32_t *live_triangles;
+  // For each vertex and triangle, one more than the number of the last
+  // cluster it was added to, or considered as a candidate for.
+  uint32_t *vertex_cluster;
+  uint32_t *candidate_cluster;
+  // The neighboring triangles that could be added to the current cluster.
+  uint32_t candidates[MAX_CLUSTER_CANDIDATES];
+  uint32_t candidate_count;
+  // The sum of the centroids of the triangles in the current cluster.
+  double centroid_sum[3];
+  uint32_t cluster_triangles;
+  uint32_t cluster_vertices;
+} ClusterState;
+
+// Frees the buffers held by s.
+static void CleanupClusterState(ClusterState *s) {
+  free(s->adjacency_offsets);
+  free(s->adjacency);
+  free(s->assigned);
+  free(s->live_triangles);
+  free(s->vertex_cluster);
+  free(s->candidate_cluster);
+  memset(s, 0, sizeof(*s));
+}
+
+// Allocates s's buffers and builds the vertex-triangle adjacency. Returns 0
+// on error.
+static int InitializeClusterState(ClusterState *s,
+    const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint32_t index_count) {
+  uint32_t i, v;
+  memset(s, 0, sizeof(*s));
+  s->vertices = vertices;
+  s->indices = indices;
+  s->triangle_count = index_count / 3;
+  s->adjacency_offsets = (uint32_t *) calloc(((size_t) vertex_count) + 1,
+    sizeof(uint32_t));
+  s->adjacency = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  s->assigned = (uint8_t *) calloc(s->triangle_count, 1);
+  s->live_triangles = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s->vertex_cluster = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s->candidate_cluster = (uint32_t *) calloc(s->triangle_count,
+    sizeof(uint32_t));
+  if (!s->adjacency_offsets || ((s->triangle_count > 0) && (!s->adjacency ||
+    !s->assigned || !s->candidate_cluster)) || ((vertex_count > 0) &&
+    (!s->live_triangles || !s->vertex_cluster))) {
+    printf("Failed allocating cluster builder buffers.\n");
+    CleanupClusterState(s);
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    s->adjacency_offsets[indices[i] + 1]++;
+    s->live_triangles[indices[i]]++;
+  }
+  for (v = 0; v < vertex_count; v++) {
+    s->adjacency_offsets[v + 1] += s->adjacency_offsets[v];
+  }
+  // Filling in the list advances each offset to the start of the next
+  // vertex's triangles, so they're shifted back afterwards.
+  for (i = 0; i < index_count; i++) {
+    v = indices[i];
+    s->adjacency[s->adjacency_offsets[v]] = i / 3;
+    s->adjacency_offsets[v]++;
+  }
+  for (v = vertex_count; v > 0; v--) {
+    s->adjacency_offsets[v] = s->adjacency_offsets[v - 1];
+  }
+  s->adjacency_offsets[0] = 0;
+  return 1;
+}
+
+// Returns the number of vertices the given triangle would add to the cluster
+// with the given number.
+static uint32_t NewClusterVertices(ClusterState *s, uint32_t triangle,
+    uint32_t cluster) {
+  const uint32_t *t = s->indices + triangle * 3;
+  uint32_t count = 0;
+  if (s->vertex_cluster[t[0]] != (cluster + 1)) count++;
+  if ((s->vertex_cluster[t[1]] != (cluster + 1)) && (t[1] != t[0])) count++;
+  if ((s->vertex_cluster[t[2]] != (cluster + 1)) && (t[2] != t[0]) &&
+    (t[2] != t[1])) {
+    count++;
+  }
+  return count;
+}
+
+// Returns the squared distance from the given triangle's centroid to the
+// average centroid of the current cluster's triangles.
+static double DistanceToCluster(ClusterState *s, uint32_t triangle) {
+  const uint32_t *t = s->indices + triangle * 3;
+  double d, total = 0.0;
+  int i;
+  for (i = 0; i < 3; i++) {
+    d = (s->vertices[t[0]].location[i] + s->vertices[t[1]].location[i] +
+      s->vertices[t[2]].location[i]) / 3.0;
+    d -= s->centroid_sum[i] / s->cluster_triangles;
+    total += d * d;
+  }
+  return total;
+}
+
+// Adds the given triangle to the cluster with the given number, appending
+// its indices to out, and adds its unassigned neighbors to the candidates.
+static void AddClusterTriangle(ClusterState *s, uint32_t triangle,
+    uint32_t cluster, uint32_t *out) {
+  const uint32_t *t = s->indices + triangle * 3;
+  uint32_t i, j, v, neighbor;
+  s->cluster_vertices += NewClusterVertices(s, triangle, cluster);
+  s->assigned[triangle] = 1;
+  for (i = 0; i < 3; i++) {
+    out[i] = t[i];
+    s->vertex_cluster[t[i]] = cluster + 1;
+    s->live_triangles[t[i]]--;
+    for (j = 0; j < 3; j++) {
+      s->centroid_sum[j] += s->vertices[t[i]].location[j] / 3.0;
+    }
+  }
+  s->cluster_triangles++;
+  for (i = 0; i < 3; i++) {
+    v = t[i];
+    for (j = s->adjacency_offsets[v]; j < s->adjacency_offsets[v + 1]; j++) {
+      neighbor = s->adjacency[j];
+      if (s->assigned[neighbor]) continue;
+      if (s->candidate_cluster[neighbor] == (cluster + 1)) continue;
+      if (s->candidate_count >= MAX_CLUSTER_CANDIDATES) return;
+      s->candidate_cluster[neighbor] = cluster + 1;
+      s->candidates[s->candidate_count] = neighbor;
+      s->candidate_count++;
+    }
+  }
+}
+
+// Removes assigned triangles from the candidates, and returns the candidate
+// that adds the fewest new vertices, breaking ties by distance to the
+// cluster's centroid and then by index. Returns UINT32_MAX if no candidate
+// fits in the cluster.
+static uint32_t BestCandidate(ClusterState *s, uint32_t cluster) {
+  const uint32_t *v = NULL;
+  uint32_t i, count = 0, t, new_vertices, live, best = UINT32_MAX;
+  uint32_t best_new_vertices = 0, best_live = 0;
+  double distance, best_distance = 0.0;
+  for (i = 0; i < s->candidate_count; i++) {
+    t = s->candidates[i];
+    if (s->assigned[t]) continue;
+    s->candidates[count] = t;
+    count++;
+    new_vertices = NewClusterVertices(s, t, cluster);
+    if ((s->cluster_vertices + new_vertices) > MAX_CLUSTER_VERTICES) continue;
+    v = s->indices + t * 3;
+    live = s->live_triangles[v[0]] + s->live_triangles[v[1]] +
+      s->live_triangles[v[2]];
+    distance = DistanceToCluster(s, t);
+    if (best != UINT32_MAX) {
+      if (new_vertices > best_new_vertices) continue;
+      if (new_vertices == best_new_vertices) {
+        if (live > best_live) continue;
+        if (live == best_live) {
+          if (distance > best_distance) continue;
+          if ((distance == best_distance) && (t > best)) continue;
+        }
+      }
+    }
+    best = t;
+    best_new_vertices = new_vertices;
+    best_live = live;
+    best_distance = distance;
+  }
+  s->candidate_count = count;
+  return best;
+}
+
+// Returns the triangle to start the next cluster with. This is the leftover
+// candidate from the previous cluster with the fewest unassigned neighbors,
+// so clusters tend to fill in the mesh from its edges rather than leaving
+// small islands behind. If there are no leftover candidates, returns the
+// first unassigned triangle.
+static uint32_t NextSeed(ClusterState *s, uint32_t *next_unassigned) {
+  const uint32_t *t = NULL;
+  uint32_t i, candidate, score, best = UINT32_MAX, best_score = 0;
+  for (i = 0; i < s->candidate_count; i++) {
+    candidate = s->candidates[i];
+    if (s->assigned[candidate]) continue;
+    t = s->indices + candidate * 3;
+    score = s->live_triangles[t[0]] + s->live_triangles[t[1]] +
+      s->live_triangles[t[2]];
+    if ((best != UINT32_MAX) && ((score > best_score) || ((score ==
+      best_score) && (candidate > best)))) {
+      continue;
+    }
+    best = candidate;
+    best_score = score;
+  }
+  if (best != UINT32_MAX) return best;
+  while (s->assigned[*next_unassigned]) *next_unassigned += 1;
+  return *next_unassigned;
+}
+
+// Computes the bounding sphere and normal cone of the cluster's triangles,
+// which must already be in the given list of indices.
+static void ComputeClusterBounds(const ObjectFileVertex *vertices,
+    const uint32_t *indices, MeshCluster *c) {
+  const uint32_t *t = indices + c->first_index;
+  const float *p[3];
+  float min[3], max[3], d, distance, radius = 0.0f;
+  double axis[3], normals[MAX_CLUSTER_TRIANGLES][3], ab[3], ac[3], length;
+  double min_dot = 1.0, dot;
+  uint32_t i, triangle_count = c->index_count / 3, normal_count = 0;
+  int j;
+  for (j = 0; j < 3; j++) {
+    min[j] = vertices[t[0]].location[j];
+    max[j] = min[j];
+  }
+  for (i = 1; i < c->index_count; i++) {
+    for (j = 0; j < 3; j++) {
+      d = vertices[t[i]].location[j];
+      if (d < min[j]) min[j] = d;
+      if (d > max[j]) max[j] = d;
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    c->center[j] = (min[j] + max[j]) * 0.5f;
+  }
+  for (i = 0; i < c->index_count; i++) {
+    distance = 0.0f;
+    for (j = 0; j < 3; j++) {
+      d = vertices[t[i]].location[j] - c->center[j];
+      distance += d * d;
+    }
+    if (distance > radius) radius = distance;
+  }
+  c->radius = sqrtf(radius);
+
+  // The cone's axis is the average of the triangles' unit normals.
+  axis[0] = 0.0;
+  axis[1] = 0.0;
+  axis[2] = 0.0;
+  for (i = 0; i < triangle_count; i++) {
+    for (j = 0; j < 3; j++) {
+      p[j] = vertices[t[i * 3 + j]].location;
+    }
+    for (j = 0; j < 3; j++) {
+      ab[j] = p[1][j] - p[0][j];
+      ac[j] = p[2][j] - p[0][j];
+    }
+    normals[normal_count][0] = ab[1] * ac[2] - ab[2] * ac[1];
+    normals[normal_count][1] = ab[2] * ac[0] - ab[0] * ac[2];
+    normals[normal_count][2] = ab[0] * ac[1] - ab[1] * ac[0];
+    length = sqrt(normals[normal_count][0] * normals[normal_count][0] +
+      normals[normal_count][1] * normals[normal_count][1] +
+      normals[normal_count][2] * normals[normal_count][2]);
+    // Degenerate triangles are never drawn, so they don't matter.
+    if (length <= 0.0) continue;
+    for (j = 0; j < 3; j++) {
+      normals[normal_count][j] /= length;
+      axis[j] += normals[normal_count][j];
+    }
+    normal_count++;
+  }
+  length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  c->cone_cutoff = 1.0f;
+  c->cone_axis[0] = 0.0f;
+  c->cone_axis[1] = 0.0f;
+  c->cone_axis[2] = 0.0f;
+  if (length <= 1.0e-6) return;
+  for (j = 0; j < 3; j++) {
+    axis[j] /= length;
+    c->cone_axis[j] = axis[j];
+  }
+  for (i = 0; i < normal_count; i++) {
+    dot = normals[i][0] * axis[0] + normals[i][1] * axis[1] + normals[i][2] *
+      axis[2];
+    if (dot < min_dot) min_dot = dot;
+  }
+  // If any normal is at least 90 degrees from the axis, the cluster can't be
+  // entirely back-facing unless the camera is inside the cone, which the
+  // test in ClusterVisible doesn't handle.
+  if (min_dot <= 0.0) return;
+  c->cone_cutoff = sqrt(1.0 - min_dot * min_dot);
+}
+
+int BuildClusters(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    uint32_t *indices, uint32_t index_count, MeshCluster **clusters,
+    uint32_t *cluster_count) {
+  ClusterState s;
+  MeshCluster *list = NULL, *new_list = NULL, *c = NULL;
+  uint32_t *out = NULL;
+  uint32_t i, capacity, count = 0, next_seed = 0, emitted = 0, triangle;
+  *clusters = NULL;
+  *cluster_count = 0;
+  if ((index_count % 3) != 0) {
+    printf("The index count must be a multiple of 3.\n");
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (indices[i] >= vertex_count) {
+      printf("Invalid vertex index: %u\n", (unsigned) indices[i]);
+      return 0;
+    }
+  }
+  if (!InitializeClusterState(&s, vertices, vertex_count, indices,
+    index_count)) {
+    return 0;
+  }
+  // Most clusters end up close to the triangle limit, so this rarely needs
+  // to grow.
+  capacity = (index_count / 3) / (MAX_CLUSTER_TRIANGLES / 2) + 1;
+  list = (MeshCluster *) malloc(capacity * sizeof(MeshCluster));
+  out = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  if (!list || (!out && (index_count > 0))) {
+    printf("Failed allocating cluster list.\n");
+    goto error_cleanup;
+  }
+  while (emitted < s.triangle_count) {
+    triangle = NextSeed(&s, &next_seed);
+    if (count >= capacity) {
+      capacity *= 2;
+      new_list = (MeshCluster *) realloc(list, capacity *
+        sizeof(MeshCluster));
+      if (!new_list) {
+        printf("Failed growing cluster list.\n");
+        goto error_cleanup;
+      }
+      list = new_list;
+    }
+    c = list + count;
+    c->first_index = emitted * 3;
+    s.candidate_count = 0;
+    s.cluster_triangles = 0;
+    s.cluster_vertices = 0;
+    memset(s.centroid_sum, 0, sizeof(s.centroid_sum));
+    while (triangle != UINT32_MAX) {
+      AddClusterTriangle(&s, triangle, count, out + emitted * 3);
+      emitted++;
+      if (s.cluster_triangles >= MAX_CLUSTER_TRIANGLES) break;
+      triangle = BestCandidate(&s, count);
+    }
+    c->index_count = emitted * 3 - c->first_index;
+    count++;
+  }
+  if (index_count > 0) memcpy(indices, out, index_count * sizeof(uint32_t));
+  for (i = 0; i < count; i++) {
+    ComputeClusterBounds(vertices, indices, list + i);
+  }
+  free(out);
+  CleanupClusterState(&s);
+  *clusters = list;
+  *cluster_count = count;
+  return 1;
+
+error_cleanup:
+  free(out);
+  free(list);
+  CleanupClusterState(&s);
+  return 0;
+}
+
+int ClusterVisible(const MeshCluster *c, const float planes[6][4],
+    const float *camera_position) {
+  float to_center[3], distance;
+  int i;
+  for (i = 0; i < 6; i++) {
+    distance = planes[i][0] * c->center[0] + planes[i][1] * c->center[1] +
+      planes[i][2] * c->center[2] + planes[i][3];
+    if (distance < -c->radius) return 0;
+  }
+  if (!camera_position || (c->cone_cutoff >= 1.0f)) return 1;
+  for (i = 0; i < 3; i++) {
+    to_center[i] = c->center[i] - camera_position[i];
+  }
+  distance = sqrtf(to_center[0] * to_center[0] + to_center[1] * to_center[1] +
+    to_center[2] * to_center[2]);
+  // Every triangle faces away from the camera if the direction to every
+  // point in the bounding sphere is within 90 degrees of every normal.
+  return (to_center[0] * c->cone_axis[0] + to_center[1] * c->cone_axis[1] +
+    to_center[2] * c->cone_axis[2]) < (c->cone_cutoff * distance + c->radius);
+}
@@ -0,0 +1,58 @@
+// Defines functions for partitioning a mesh's triangles into small clusters
+// (sometimes called meshlets) with good spatial locality, along with the
+// bounds needed to cull a whole cluster on the CPU: a bounding sphere, and a
+// cone containing every triangle's normal. Clusters that are entirely outside
+// the view frustum, or where every triangle faces away from the camera, can
+// be skipped without changing what ends up on screen.
+#ifndef OPENGL_TUTORIAL_MESH_CLUSTERS_H
+#define OPENGL_TUTORIAL_MESH_CLUSTERS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "parse_obj.h"
+
+// The limits on the size of a single cluster.
+#define MAX_CLUSTER_TRIANGLES (128)
+#define MAX_CLUSTER_VERTICES (64)
+
+// Describes one cluster of triangles in an index buffer.
+typedef struct {
+  // The range of indices making up the cluster's triangles.
+  uint32_t first_index;
+  uint32_t index_count;
+  // A sphere containing every vertex in the cluster.
+  float center[3];
+  float radius;
+  // The normalized axis of a cone containing every triangle's normal, and
+  // the sine of the angle between the axis and the cone's edge. A cutoff of
+  // 1 means the normals are too spread out for backface culling to work.
+  float cone_axis[3];
+  float cone_cutoff;
+} MeshCluster;
+
+// Reorders the triangles in the given list of indices so that each cluster's
+// triangles are contiguous, growing each cluster from a seed triangle by
+// repeatedly adding the neighboring triangle that needs the fewest new
+// vertices. Doesn't change the vertices making up each triangle. Sets
+// *clusters to a new array of *cluster_count clusters, in the order they
+// appear in the indices, which the caller must free. Each index must be less
+// than vertex_count. The output only depends on the input. Returns 0 on
+// error, in which case the indices are unchanged.
+int BuildClusters(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    uint32_t *indices, uint32_t index_count, MeshCluster **clusters,
+    uint32_t *cluster_count);
+
+// Returns 0 if the given cluster is definitely invisible: either outside one
+// of the six frustum planes, or facing entirely away from the camera. Each
+// plane is given as (a, b, c, d), with points inside the frustum satisfying
+// ax + by + cz + d >= 0 for every plane. The planes and camera position must
+// be in the mesh's object space. If camera_position is NULL, only the frustum
+// is checked.
+int ClusterVisible(const MeshCluster *c, const float planes[6][4],
+    const float *camera_position);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_CLUSTERS_H
@@ -0,0 +1,491 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse_obj.h"
+#include "thread_pool.h"
+#include "mesh_normals.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define MESH_NORMALS_X86
+#endif
+
+// Small meshes aren't worth starting threads for, so each thread gets at
+// least this many triangles.
+#define MIN_TRIANGLES_PER_THREAD (16384)
+
+// Holds the values computed for each triangle before they're summed up at
+// each vertex.
+typedef struct {
+  // The triangle's unit normal, or its unit tangent when generating tangents.
+  // This is all zeros if the triangle is degenerate.
+  float direction[3];
+  // The triangle's angle, in radians, at each of its three corners.
+  float angles[3];
+  // The triangle's unit bitangent. Only used when generating tangents.
+  float bitangent[3];
+} TriangleFrame;
+
+// Holds the state shared by the threads generating normals or tangents.
+typedef struct {
+  const ObjectFileVertex *vertices;
+  uint32_t vertex_count;
+  const uint32_t *indices;
+  uint32_t triangle_count;
+  // The group of each vertex, or NULL if each vertex is its own group.
+  const uint32_t *vertex_groups;
+  uint32_t group_count;
+  TriangleFrame *frames;
+  // The corners in group g, numbered 3 * triangle + corner, are at
+  // corners[group_starts[g]] through corners[group_starts[g + 1] - 1], in
+  // increasing order.
+  uint32_t *group_starts;
+  uint32_t *corners;
+  // Holds 3 floats per group: the group's normal.
+  float *group_normals;
+  // The vertices to write normals to, when generating normals.
+  ObjectFileVertex *output_vertices;
+  // The 4 floats per vertex to write, when generating tangents.
+  float *tangents;
+} NormalState;
+
+// Frees the buffers held by s.
+static void CleanupNormalState(NormalState *s) {
+  free(s->frames);
+  free(s->group_starts);
+  free(s->corners);
+  free(s->group_normals);
+  s->frames = NULL;
+  s->group_starts = NULL;
+  s->corners = NULL;
+  s->group_normals = NULL;
+}
+
+// Sets start and end to the range of the count items handled by the thread.
+static void GetThreadSlice(int thread_index, int thread_count, uint32_t count,
+    uint32_t *start, uint32_t *end) {
+  *start = (uint32_t) ((((uint64_t) count) * thread_index) / thread_count);
+  *end = (uint32_t) ((((uint64_t) count) * (thread_index + 1)) /
+    thread_count);
+}
+
+// Returns the number of threads to use for the given number of triangles.
+static int LimitThreadCount(int thread_count, uint32_t triangle_count) {
+  uint32_t max_threads = triangle_count / MIN_TRIANGLES_PER_THREAD;
+  if (((uint32_t) thread_count) > max_threads) {
+    thread_count = (int) max_threads;
+  }
+  if (thread_count < 1) thread_count = 1;
+  return thread_count;
+}
+
+// Returns the group containing vertex v.
+static uint32_t GetGroup(const NormalState *s, uint32_t v) {
+  if (!s->vertex_groups) return v;
+  return s->vertex_groups[v];
+}
+
+// Returns the dot product of two 3-component vectors.
+static float Dot3(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Sets out to the cross product of a and b. out must not overlap a or b.
+static void Cross3(const float *a, const float *b, float *out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Scales v to unit length and returns its original length. If v has no
+// usable length, sets it to all zeros and returns 0.
+static float Normalize3(float *v) {
+  float length = sqrtf(Dot3(v, v));
+  if (!(length > 0.0f) || isinf(length)) {
+    memset(v, 0, 3 * sizeof(float));
+    return 0.0f;
+  }
+  v[0] /= length;
+  v[1] /= length;
+  v[2] /= length;
+  return length;
+}
+
+// Sets out to an arbitrary unit vector perpendicular to n. If n is all zeros,
+// out will be the X axis.
+static void PerpendicularVector(const float *n, float *out) {
+  float axis[3] = {0.0f, 0.0f, 0.0f};
+  float x = fabsf(n[0]), y = fabsf(n[1]), z = fabsf(n[2]);
+  // Crossing with the axis n is least aligned with is the most accurate.
+  if ((x <= y) && (x <= z)) {
+    axis[0] = 1.0f;
+  } else if (y <= z) {
+    axis[1] = 1.0f;
+  } else {
+    axis[2] = 1.0f;
+  }
+  Cross3(n, axis, out);
+  if (Normalize3(out) == 0.0f) {
+    out[0] = 1.0f;
+    out[1] = 0.0f;
+    out[2] = 0.0f;
+  }
+}
+
+#ifdef MESH_NORMALS_X86
+// Loads a vertex's location, with the fourth lane set to 0. Each vertex
+// starts with its location, so this is a single unaligned load.
+static __m128 LoadLocation(const ObjectFileVertex *v) {
+  const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  return _mm_and_ps(_mm_loadu_ps(v->data), mask);
+}
+
+// Returns the cross product of the first three lanes of a and b. The fourth
+// lane is 0 if it was 0 in both a and b.
+static __m128 CrossSSE(__m128 a, __m128 b) {
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Returns the sum of all four lanes of a * b.
+static float DotSSE(__m128 a, __m128 b) {
+  __m128 p = _mm_mul_ps(a, b);
+  __m128 s = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+  s = _mm_add_ss(s, _mm_movehl_ps(s, s));
+  return _mm_cvtss_f32(s);
+}
+#endif
+
+// Computes the vectors along triangle t's edges from its first vertex to its
+// second and third, and the triangle's normal, scaled by twice its area. Also
+// computes the squared lengths of the edges from the first to the second
+// vertex, the first to the third, and the second to the third, along with the
+// dot products at the first and second corners, which are enough to find the
+// triangle's angles.
+static void TriangleGeometry(const NormalState *s, uint32_t t, float *e01,
+    float *e02, float *normal, float *squared_lengths, float *dots) {
+  const ObjectFileVertex *v = s->vertices;
+  const uint32_t *indices = s->indices + 3 * t;
+#ifdef MESH_NORMALS_X86
+  float tmp[4];
+  __m128 p0 = LoadLocation(v + indices[0]);
+  __m128 p1 = LoadLocation(v + indices[1]);
+  __m128 p2 = LoadLocation(v + indices[2]);
+  __m128 a = _mm_sub_ps(p1, p0), b = _mm_sub_ps(p2, p0);
+  __m128 c = _mm_sub_ps(p2, p1);
+  _mm_storeu_ps(tmp, a);
+  memcpy(e01, tmp, 3 * sizeof(float));
+  _mm_storeu_ps(tmp, b);
+  memcpy(e02, tmp, 3 * sizeof(float));
+  _mm_storeu_ps(tmp, CrossSSE(a, b));
+  memcpy(normal, tmp, 3 * sizeof(float));
+  squared_lengths[0] = DotSSE(a, a);
+  squared_lengths[1] = DotSSE(b, b);
+  squared_lengths[2] = DotSSE(c, c);
+  dots[0] = DotSSE(a, b);
+  dots[1] = -DotSSE(a, c);
+#else
+  const float *p0 = v[indices[0]].location;
+  const float *p1 = v[indices[1]].location;
+  const float *p2 = v[indices[2]].location;
+  float e12[3], e10[3];
+  int i;
+  for (i = 0; i < 3; i++) {
+    e01[i] = p1[i] - p0[i];
+    e02[i] = p2[i] - p0[i];
+    e12[i] = p2[i] - p1[i];
+    e10[i] = -e01[i];
+  }
+  Cross3(e01, e02, normal);
+  squared_lengths[0] = Dot3(e01, e01);
+  squared_lengths[1] = Dot3(e02, e02);
+  squared_lengths[2] = Dot3(e12, e12);
+  dots[0] = Dot3(e01, e02);
+  dots[1] = Dot3(e10, e12);
+#endif
+}
+
+// Returns the angle whose cosine is the given dot product divided by the
+// product of the two lengths.
+static float AngleFromDot(float dot, float length_a, float length_b) {
+  float c = dot / (length_a * length_b);
+  if (c > 1.0f) c = 1.0f;
+  if (c < -1.0f) c = -1.0f;
+  return acosf(c);
+}
+
+// Fills in the angles at each of a non-degenerate triangle's corners, using
+// the values from TriangleGeometry.
+static void CornerAngles(const float *squared_lengths, const float *dots,
+    float *angles) {
+  float l01 = sqrtf(squared_lengths[0]);
+  float l02 = sqrtf(squared_lengths[1]);
+  float l12 = sqrtf(squared_lengths[2]);
+  angles[0] = AngleFromDot(dots[0], l01, l02);
+  angles[1] = AngleFromDot(dots[1], l01, l12);
+  // The angles of a triangle always add up to pi, which saves an acosf.
+  angles[2] = ((float) M_PI) - angles[0] - angles[1];
+  if (angles[2] < 0.0f) angles[2] = 0.0f;
+}
+
+// Computes the unit normal and corner angles of the thread's triangles.
+static void TriangleNormalsThread(int thread_index, int thread_count,
+    void *data) {
+  NormalState *s = (NormalState *) data;
+  TriangleFrame *f = NULL;
+  float e01[3], e02[3], squared_lengths[3], dots[2];
+  uint32_t t, start, end;
+  GetThreadSlice(thread_index, thread_count, s->triangle_count, &start, &end);
+  for (t = start; t < end; t++) {
+    f = s->frames + t;
+    memset(f, 0, sizeof(*f));
+    TriangleGeometry(s, t, e01, e02, f->direction, squared_lengths, dots);
+    if (Normalize3(f->direction) == 0.0f) continue;
+    CornerAngles(squared_lengths, dots, f->angles);
+  }
+}
+
+// Computes the unit tangent and bitangent, in the directions of increasing U
+// and V coordinates, and corner angles of the thread's triangles.
+static void TriangleTangentsThread(int thread_index, int thread_count,
+    void *data) {
+  NormalState *s = (NormalState *) data;
+  TriangleFrame *f = NULL;
+  const float *uv0, *uv1, *uv2;
+  float e01[3], e02[3], normal[3], squared_lengths[3], dots[2];
+  float du1, dv1, du2, dv2, r;
+  uint32_t t, start, end;
+  int i;
+  GetThreadSlice(thread_index, thread_count, s->triangle_count, &start, &end);
+  for (t = start; t < end; t++) {
+    f = s->frames + t;
+    memset(f, 0, sizeof(*f));
+    TriangleGeometry(s, t, e01, e02, normal, squared_lengths, dots);
+    if (Normalize3(normal) == 0.0f) continue;
+    uv0 = s->vertices[s->indices[3 * t]].uv;
+    uv1 = s->vertices[s->indices[3 * t + 1]].uv;
+    uv2 = s->vertices[s->indices[3 * t + 2]].uv;
+    du1 = uv1[0] - uv0[0];
+    dv1 = uv1[1] - uv0[1];
+    du2 = uv2[0] - uv0[0];
+    dv2 = uv2[1] - uv0[1];
+    r = du1 * dv2 - du2 * dv1;
+    // Triangles without distinct UV coordinates don't have a tangent.
+    if (!(fabsf(r) > 0.0f)) continue;
+    r = 1.0f / r;
+    for (i = 0; i < 3; i++) {
+      f->direction[i] = (e01[i] * dv2 - e02[i] * dv1) * r;
+      f->bitangent[i] = (e02[i] * du1 - e01[i] * du2) * r;
+    }
+    // Normalizing here keeps stretched UV mappings from outweighing the
+    // angles.
+    Normalize3(f->direction);
+    Normalize3(f->bitangent);
+    CornerAngles(squared_lengths, dots, f->angles);
+  }
+}
+
+// Sorts the corners of every triangle by their vertex's group, filling in
+// s->group_starts and s->corners. Because this is a counting sort, each
+// group's corners stay in increasing order. Returns 0 on error.
+static int GroupCorners(NormalState *s) {
+  uint32_t i, group, index_count = s->triangle_count * 3;
+  s->group_starts = (uint32_t *) calloc(((size_t) s->group_count) + 1,
+    sizeof(uint32_t));
+  s->corners = (uint32_t *) malloc((((size_t) index_count) + 1) *
+    sizeof(uint32_t));
+  if (!s->group_starts || !s->corners) {
+    printf("Failed allocating corner groups.\n");
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (s->indices[i] >= s->vertex_count) {
+      printf("Index %u is out of range of the %u vertices.\n",
+        (unsigned) s->indices[i], (unsigned) s->vertex_count);
+      return 0;
+    }
+    group = GetGroup(s, s->indices[i]);
+    if (group >= s->group_count) {
+      printf("Vertex group %u is out of range.\n", (unsigned) group);
+      return 0;
+    }
+    s->group_starts[group + 1]++;
+  }
+  for (i = 0; i < s->group_count; i++) {
+    s->group_starts[i + 1] += s->group_starts[i];
+  }
+  // Use each group's start as the position to write its next corner, which
+  // leaves it at the start of the next group once every corner is written.
+  for (i = 0; i < index_count; i++) {
+    group = GetGroup(s, s->indices[i]);
+    s->corners[s->group_starts[group]] = i;
+    s->group_starts[group]++;
+  }
+  memmove(s->group_starts + 1, s->group_starts, s->group_count *
+    sizeof(uint32_t));
+  s->group_starts[0] = 0;
+  return 1;
+}
+
+// Sets sum to the angle-weighted sum of the given frame vector for every
+// corner in group g, in increasing order. If bitangent_sum isn't NULL, it's
+// set to the sum of the bitangents, too.
+static void SumGroup(const NormalState *s, uint32_t g, float *sum,
+    float *bitangent_sum) {
+  const TriangleFrame *f = NULL;
+  uint32_t i, corner;
+  float w;
+  int j;
+  memset(sum, 0, 3 * sizeof(float));
+  if (bitangent_sum) memset(bitangent_sum, 0, 3 * sizeof(float));
+  for (i = s->group_starts[g]; i < s->group_starts[g + 1]; i++) {
+    corner = s->corners[i];
+    f = s->frames + (corner / 3);
+    w = f->angles[corner % 3];
+    for (j = 0; j < 3; j++) sum[j] += f->direction[j] * w;
+    if (!bitangent_sum) continue;
+    for (j = 0; j < 3; j++) bitangent_sum[j] += f->bitangent[j] * w;
+  }
+}
+
+// Computes the normal of each of the thread's groups.
+static void SumGroupNormalsThread(int thread_index, int thread_count,
+    void *data) {
+  NormalState *s = (NormalState *) data;
+  float *normal = NULL;
+  uint32_t g, start, end;
+  GetThreadSlice(thread_index, thread_count, s->group_count, &start, &end);
+  for (g = start; g < end; g++) {
+    normal = s->group_normals + 3 * g;
+    SumGroup(s, g, normal, NULL);
+    Normalize3(normal);
+  }
+}
+
+// Copies each of the thread's vertices' group normal to the vertex.
+static void CopyGroupNormalsThread(int thread_index, int thread_count,
+    void *data) {
+  NormalState *s = (NormalState *) data;
+  uint32_t v, start, end;
+  GetThreadSlice(thread_index, thread_count, s->vertex_count, &start, &end);
+  for (v = start; v < end; v++) {
+    memcpy(s->output_vertices[v].normal, s->group_normals + 3 *
+      GetGroup(s, v), 3 * sizeof(float));
+  }
+}
+
+// Computes the tangent of each of the thread's vertices, made perpendicular
+// to the vertex's normal.
+static void SumTangentsThread(int thread_index, int thread_count,
+    void *data) {
+  NormalState *s = (NormalState *) data;
+  const float *n = NULL;
+  float tangent[3], bitangent[3], side[3], d;
+  float *out = NULL;
+  uint32_t v, start, end;
+  int i;
+  GetThreadSlice(thread_index, thread_count, s->vertex_count, &start, &end);
+  for (v = start; v < end; v++) {
+    n = s->vertices[v].normal;
+    out = s->tangents + 4 * v;
+    SumGroup(s, v, tangent, bitangent);
+    d = Dot3(n, tangent);
+    for (i = 0; i < 3; i++) tangent[i] -= n[i] * d;
+    if (Normalize3(tangent) == 0.0f) PerpendicularVector(n, tangent);
+    memcpy(out, tangent, sizeof(tangent));
+    Cross3(n, tangent, side);
+    out[3] = (Dot3(side, bitangent) < 0.0f) ? -1.0f : 1.0f;
+  }
+}
+
+// Returns 0 if index_count isn't a valid number of indices to generate normals
+// or tangents for.
+static int CheckIndexCount(uint64_t index_count) {
+  if ((index_count % 3) != 0) {
+    printf("The number of indices must be a multiple of 3.\n");
+    return 0;
+  }
+  if (index_count > UINT32_MAX) {
+    printf("Can't generate normals or tangents for %llu indices.\n",
+      (unsigned long long) index_count);
+    return 0;
+  }
+  return 1;
+}
+
+int GenerateSmoothNormals(ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint64_t index_count,
+    const uint32_t *vertex_groups, uint32_t group_count, int thread_count) {
+  NormalState s;
+  uint32_t i;
+  if (!CheckIndexCount(index_count)) return 0;
+  memset(&s, 0, sizeof(s));
+  s.vertices = vertices;
+  s.output_vertices = vertices;
+  s.vertex_count = vertex_count;
+  s.indices = indices;
+  s.triangle_count = (uint32_t) (index_count / 3);
+  s.vertex_groups = vertex_groups;
+  s.group_count = vertex_groups ? group_count : vertex_count;
+  if (vertex_groups) {
+    for (i = 0; i < vertex_count; i++) {
+      if (vertex_groups[i] < group_count) continue;
+      printf("Vertex group %u is out of range.\n",
+        (unsigned) vertex_groups[i]);
+      return 0;
+    }
+  }
+  thread_count = LimitThreadCount(thread_count, s.triangle_count);
+  s.frames = (TriangleFrame *) malloc((((size_t) s.triangle_count) + 1) *
+    sizeof(TriangleFrame));
+  s.group_normals = (float *) malloc((((size_t) s.group_count) + 1) * 3 *
+    sizeof(float));
+  if (!s.frames || !s.group_normals) {
+    printf("Failed allocating buffers for generating normals.\n");
+    goto fail;
+  }
+  if (!GroupCorners(&s)) goto fail;
+  RunInParallel(thread_count, TriangleNormalsThread, &s);
+  RunInParallel(thread_count, SumGroupNormalsThread, &s);
+  RunInParallel(thread_count, CopyGroupNormalsThread, &s);
+  CleanupNormalState(&s);
+  return 1;
+
+fail:
+  CleanupNormalState(&s);
+  return 0;
+}
+
+int GenerateTangents(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint64_t index_count, float *tangents,
+    int thread_count) {
+  NormalState s;
+  if (!CheckIndexCount(index_count)) return 0;
+  memset(&s, 0, sizeof(s));
+  s.vertices = vertices;
+  s.vertex_count = vertex_count;
+  s.indices = indices;
+  s.triangle_count = (uint32_t) (index_count / 3);
+  s.group_count = vertex_count;
+  s.tangents = tangents;
+  thread_count = LimitThreadCount(thread_count, s.triangle_count);
+  s.frames = (TriangleFrame *) malloc((((size_t) s.triangle_count) + 1) *
+    sizeof(TriangleFrame));
+  if (!s.frames) {
+    printf("Failed allocating buffers for generating tangents.\n");
+    goto fail;
+  }
+  if (!GroupCorners(&s)) goto fail;
+  RunInParallel(thread_count, TriangleTangentsThread, &s);
+  RunInParallel(thread_count, SumTangentsThread, &s);
+  CleanupNormalState(&s);
+  return 1;
+
+fail:
+  CleanupNormalState(&s);
+  return 0;
+}
@@ -0,0 +1,42 @@
+// Defines functions for generating smooth vertex normals and tangents for
+// meshes that don't come with them. Each triangle's contribution to a vertex
+// is weighted by the triangle's angle at that vertex, so the results don't
+// depend on how a surface happens to be triangulated. The work is split
+// across threads, but each vertex always sums its triangles in the same
+// order, so the results are identical for any number of threads.
+#ifndef OPENGL_TUTORIAL_MESH_NORMALS_H
+#define OPENGL_TUTORIAL_MESH_NORMALS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "parse_obj.h"
+
+// Sets each vertex's normal to the normalized, angle-weighted sum of the
+// normals of the triangles using it. Vertices in the same group share a
+// normal; vertex_groups gives each vertex's group, which must be less than
+// group_count. This is normally the location's index in the file, so that
+// copies of a vertex along a UV seam don't end up with different normals. If
+// vertex_groups is NULL, each vertex is its own group. Vertices not used by
+// any triangles with a nonzero area get a zero normal. Each index must be less
+// than vertex_count, and there must be at most UINT32_MAX indices, since
+// corners are numbered with 32 bits. Returns 0 on error.
+int GenerateSmoothNormals(ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint64_t index_count,
+    const uint32_t *vertex_groups, uint32_t group_count, int thread_count);
+
+// Fills in 4 floats per vertex in tangents: a unit tangent, pointing in the
+// direction of increasing U coordinates and perpendicular to the vertex's
+// normal, followed by 1 or -1, the sign of the bitangent, which is
+// sign * cross(normal, tangent). The vertices' normals must already be set.
+// Vertices without usable UV coordinates get an arbitrary tangent that's
+// still perpendicular to the normal. The same limit on the number of indices
+// as GenerateSmoothNormals applies. Returns 0 on error.
+int GenerateTangents(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint64_t index_count, float *tangents,
+    int thread_count);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_NORMALS_H
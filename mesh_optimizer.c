@@ -0,0 +1,622 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_optimizer.h"
+
+// Marks a vertex that isn't in the simulated cache, or the lack of a vertex.
+#define NO_VERTEX (0xffffffff)
+
+// The largest number of vertices a range of 16-bit indices can refer to.
+#define MAX_16BIT_RANGE_VERTICES (65536)
+
+// The number of vertices a range of 16-bit indices must use before it's ended
+// early to avoid copying its vertices. Smaller ranges are allowed to grow,
+// copying their vertices, rather than making too many draw calls.
+#define MIN_EARLY_RANGE_VERTICES (16384)
+
+// The parameters of the memory cache simulated by SimulateVertexFetch: 32 KB
+// in 64-byte lines.
+#define FETCH_CACHE_LINE_SIZE (64)
+#define FETCH_CACHE_LINES (512)
+
+// Holds the state used while running the Tipsify algorithm.
+typedef struct {
+  const uint32_t *indices;
+  uint32_t vertex_count;
+  uint32_t cache_size;
+  // The triangles using each vertex are at adjacency[adjacency_offsets[v]]
+  // through adjacency[adjacency_offsets[v + 1] - 1].
+  uint32_t *adjacency_offsets;
+  uint32_t *adjacency;
+  // The number of triangles using each vertex that haven't been emitted yet.
+  uint32_t *live_triangles;
+  // The time each vertex was last added to the simulated cache.
+  uint32_t *cache_times;
+  // The current time, which counts vertices added to the cache. Starts at
+  // cache_size + 1 so every vertex starts out of the cache.
+  uint32_t time;
+  // Nonzero for each triangle that has already been emitted.
+  uint8_t *emitted;
+  // A stack of recently used vertices, for finding a new fanning vertex when
+  // we hit a dead end.
+  uint32_t *dead_end_stack;
+  uint32_t dead_end_count;
+  // The vertices of the triangles emitted for the current fanning vertex.
+  uint32_t *candidates;
+  uint32_t candidate_count;
+  // Where to continue the linear search for a vertex with live triangles.
+  uint32_t next_unvisited;
+} TipsifyState;
+
+// Frees the buffers held by s.
+static void CleanupTipsifyState(TipsifyState *s) {
+  free(s->adjacency_offsets);
+  free(s->adjacency);
+  free(s->live_triangles);
+  free(s->cache_times);
+  free(s->emitted);
+  free(s->dead_end_stack);
+  free(s->candidates);
+  memset(s, 0, sizeof(*s));
+}
+
+// Allocates s's buffers and builds the vertex-triangle adjacency. Returns 0
+// on error.
+static int InitializeTipsifyState(TipsifyState *s, const uint32_t *indices,
+    uint32_t index_count, uint32_t vertex_count, uint32_t cache_size) {
+  uint32_t i, v, triangle_count = index_count / 3;
+  memset(s, 0, sizeof(*s));
+  s->indices = indices;
+  s->vertex_count = vertex_count;
+  s->cache_size = cache_size;
+  s->time = cache_size + 1;
+  s->adjacency_offsets = (uint32_t *) calloc(((size_t) vertex_count) + 1,
+    sizeof(uint32_t));
+  s->adjacency = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  s->live_triangles = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s->cache_times = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s->emitted = (uint8_t *) calloc(triangle_count, 1);
+  s->dead_end_stack = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  s->candidates = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  if (!s->adjacency_offsets || !s->adjacency || !s->live_triangles ||
+    !s->cache_times || !s->emitted || !s->dead_end_stack || !s->candidates) {
+    printf("Failed allocating vertex cache optimizer buffers.\n");
+    CleanupTipsifyState(s);
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    s->live_triangles[indices[i]]++;
+  }
+  // Each vertex's offset starts as the number of triangle references before
+  // it. Filling in the adjacency list advances each offset to the start of
+  // the next vertex's triangles, so they're shifted back afterwards.
+  for (v = 0; v < vertex_count; v++) {
+    s->adjacency_offsets[v + 1] = s->adjacency_offsets[v] +
+      s->live_triangles[v];
+  }
+  for (i = 0; i < index_count; i++) {
+    v = indices[i];
+    s->adjacency[s->adjacency_offsets[v]] = i / 3;
+    s->adjacency_offsets[v]++;
+  }
+  for (v = vertex_count; v > 0; v--) {
+    s->adjacency_offsets[v] = s->adjacency_offsets[v - 1];
+  }
+  s->adjacency_offsets[0] = 0;
+  return 1;
+}
+
+// Returns the next fanning vertex after a dead end: the most recently used
+// vertex that still has live triangles, or else the next such vertex in
+// index order. Returns NO_VERTEX once every triangle has been emitted.
+static uint32_t SkipDeadEnd(TipsifyState *s) {
+  uint32_t v;
+  while (s->dead_end_count > 0) {
+    s->dead_end_count--;
+    v = s->dead_end_stack[s->dead_end_count];
+    if (s->live_triangles[v] > 0) return v;
+  }
+  while (s->next_unvisited < s->vertex_count) {
+    v = s->next_unvisited;
+    s->next_unvisited++;
+    if (s->live_triangles[v] > 0) return v;
+  }
+  return NO_VERTEX;
+}
+
+// Chooses the next fanning vertex from the current candidates. Prefers the
+// vertex that's been in the cache longest, as long as fanning around it will
+// (probably) finish before it's evicted.
+static uint32_t GetNextVertex(TipsifyState *s) {
+  uint32_t i, v, best = NO_VERTEX;
+  int64_t age, priority, best_priority = -1;
+  for (i = 0; i < s->candidate_count; i++) {
+    v = s->candidates[i];
+    if (s->live_triangles[v] == 0) continue;
+    // Each remaining triangle adds at most two new vertices to the cache.
+    age = s->time - s->cache_times[v];
+    priority = 0;
+    if ((age + 2 * ((int64_t) s->live_triangles[v])) <= s->cache_size) {
+      priority = age;
+    }
+    if (priority > best_priority) {
+      best_priority = priority;
+      best = v;
+    }
+  }
+  if (best == NO_VERTEX) best = SkipDeadEnd(s);
+  return best;
+}
+
+int OptimizeVertexCache(uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, uint32_t cache_size) {
+  TipsifyState s;
+  uint32_t *output = NULL;
+  uint32_t i, j, t, v, fanning_vertex, output_count = 0;
+  if ((index_count % 3) != 0) {
+    printf("The index count for cache optimization must be a multiple of "
+      "3.\n");
+    return 0;
+  }
+  if (cache_size == 0) cache_size = DEFAULT_VERTEX_CACHE_SIZE;
+  // Make sure the timestamps can't overflow.
+  if (index_count > (UINT32_MAX - cache_size - 1)) {
+    printf("Too many indices for cache optimization.\n");
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (indices[i] >= vertex_count) {
+      printf("Index %u is out of range for %u vertices.\n",
+        (unsigned) indices[i], (unsigned) vertex_count);
+      return 0;
+    }
+  }
+  if (index_count == 0) return 1;
+  if (!InitializeTipsifyState(&s, indices, index_count, vertex_count,
+    cache_size)) {
+    return 0;
+  }
+  output = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  if (!output) {
+    printf("Failed allocating optimized index buffer.\n");
+    CleanupTipsifyState(&s);
+    return 0;
+  }
+
+  fanning_vertex = SkipDeadEnd(&s);
+  while (fanning_vertex != NO_VERTEX) {
+    s.candidate_count = 0;
+    // Emit all of the remaining triangles around the fanning vertex.
+    for (i = s.adjacency_offsets[fanning_vertex];
+      i < s.adjacency_offsets[fanning_vertex + 1]; i++) {
+      t = s.adjacency[i];
+      if (s.emitted[t]) continue;
+      s.emitted[t] = 1;
+      for (j = 0; j < 3; j++) {
+        v = indices[t * 3 + j];
+        output[output_count++] = v;
+        s.dead_end_stack[s.dead_end_count++] = v;
+        s.candidates[s.candidate_count++] = v;
+        s.live_triangles[v]--;
+        if ((s.time - s.cache_times[v]) > cache_size) {
+          s.cache_times[v] = s.time;
+          s.time++;
+        }
+      }
+    }
+    fanning_vertex = GetNextVertex(&s);
+  }
+
+  if (output_count != index_count) {
+    // Sanity check for an internal error.
+    printf("Cache optimization emitted %u of %u indices.\n",
+      (unsigned) output_count, (unsigned) index_count);
+    free(output);
+    CleanupTipsifyState(&s);
+    return 0;
+  }
+  memcpy(indices, output, index_count * sizeof(uint32_t));
+  free(output);
+  CleanupTipsifyState(&s);
+  return 1;
+}
+
+int SimulateVertexCache(const uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, uint32_t cache_size, VertexCacheStats *stats) {
+  // Holds the value of the miss counter when each vertex was last added to
+  // the cache. In a FIFO cache, a vertex is evicted after cache_size more
+  // misses, so this is enough to tell whether it's still cached.
+  uint64_t *inserted_at = NULL;
+  uint64_t misses = 0;
+  uint32_t i, v;
+  memset(stats, 0, sizeof(*stats));
+  stats->cache_size = cache_size;
+  if (cache_size == 0) {
+    printf("The simulated vertex cache size must be positive.\n");
+    return 0;
+  }
+  inserted_at = (uint64_t *) malloc(((size_t) vertex_count) *
+    sizeof(uint64_t));
+  if (!inserted_at && (vertex_count > 0)) {
+    printf("Failed allocating vertex cache simulator buffer.\n");
+    return 0;
+  }
+  for (i = 0; i < vertex_count; i++) {
+    inserted_at[i] = UINT64_MAX;
+  }
+  for (i = 0; i < index_count; i++) {
+    v = indices[i];
+    if (v >= vertex_count) {
+      printf("Index %u is out of range for %u vertices.\n", (unsigned) v,
+        (unsigned) vertex_count);
+      free(inserted_at);
+      return 0;
+    }
+    if ((inserted_at[v] != UINT64_MAX) &&
+      ((misses - inserted_at[v]) < cache_size)) {
+      continue;
+    }
+    inserted_at[v] = misses;
+    misses++;
+  }
+  free(inserted_at);
+  stats->cache_misses = misses;
+  if (index_count > 0) {
+    stats->acmr = ((double) misses) / ((double) (index_count / 3));
+  }
+  if (vertex_count > 0) {
+    stats->atvr = ((double) misses) / ((double) vertex_count);
+  }
+  return 1;
+}
+
+int OptimizeVertexFetch(void *vertices, uint32_t vertex_count,
+    size_t vertex_size, uint32_t *indices, uint64_t index_count) {
+  uint32_t *remap = NULL;
+  uint8_t *reordered = NULL;
+  uint32_t v, next_index = 0;
+  uint64_t i;
+  for (i = 0; i < index_count; i++) {
+    if (indices[i] >= vertex_count) {
+      printf("Index %u is out of range for %u vertices.\n",
+        (unsigned) indices[i], (unsigned) vertex_count);
+      return 0;
+    }
+  }
+  if (vertex_count == 0) return 1;
+  remap = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+  reordered = (uint8_t *) malloc(vertex_count * vertex_size);
+  if (!remap || !reordered) {
+    printf("Failed allocating vertex fetch optimizer buffers.\n");
+    free(remap);
+    free(reordered);
+    return 0;
+  }
+  memset(remap, 0xff, vertex_count * sizeof(uint32_t));
+  for (i = 0; i < index_count; i++) {
+    v = indices[i];
+    if (remap[v] == NO_VERTEX) {
+      remap[v] = next_index;
+      next_index++;
+    }
+    indices[i] = remap[v];
+  }
+  for (v = 0; v < vertex_count; v++) {
+    if (remap[v] == NO_VERTEX) {
+      remap[v] = next_index;
+      next_index++;
+    }
+    memcpy(reordered + remap[v] * vertex_size, ((uint8_t *) vertices) +
+      v * vertex_size, vertex_size);
+  }
+  memcpy(vertices, reordered, vertex_count * vertex_size);
+  free(remap);
+  free(reordered);
+  return 1;
+}
+
+int SimulateVertexFetch(const uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, size_t vertex_size, VertexFetchStats *stats) {
+  // Like in SimulateVertexCache, these hold the number of vertices or lines
+  // fetched when each vertex or line was last added to its FIFO cache.
+  uint64_t *vertex_inserted_at = NULL;
+  uint64_t *line_inserted_at = NULL;
+  uint64_t start, end, line, line_count, lines_fetched = 0;
+  uint64_t vertices_fetched = 0;
+  double stride_sum = 0.0;
+  uint32_t i, v, previous = 0;
+  int to_return = 0;
+  memset(stats, 0, sizeof(*stats));
+  if (vertex_size == 0) {
+    printf("The vertex size for fetch simulation must be positive.\n");
+    return 0;
+  }
+  line_count = ((((uint64_t) vertex_count) * vertex_size) /
+    FETCH_CACHE_LINE_SIZE) + 1;
+  vertex_inserted_at = (uint64_t *) malloc((((size_t) vertex_count) + 1) *
+    sizeof(uint64_t));
+  line_inserted_at = (uint64_t *) malloc(line_count * sizeof(uint64_t));
+  if (!vertex_inserted_at || !line_inserted_at) {
+    printf("Failed allocating vertex fetch simulator buffers.\n");
+    goto cleanup;
+  }
+  memset(vertex_inserted_at, 0xff, (((size_t) vertex_count) + 1) *
+    sizeof(uint64_t));
+  memset(line_inserted_at, 0xff, line_count * sizeof(uint64_t));
+  for (i = 0; i < index_count; i++) {
+    v = indices[i];
+    if (v >= vertex_count) {
+      printf("Index %u is out of range for %u vertices.\n", (unsigned) v,
+        (unsigned) vertex_count);
+      goto cleanup;
+    }
+    // The GPU only fetches vertices that miss the post-transform cache.
+    if ((vertex_inserted_at[v] != UINT64_MAX) && ((vertices_fetched -
+      vertex_inserted_at[v]) < DEFAULT_VERTEX_CACHE_SIZE)) {
+      continue;
+    }
+    vertex_inserted_at[v] = vertices_fetched;
+    if (vertices_fetched > 0) {
+      stride_sum += (v > previous) ? (v - previous) : (previous - v);
+    }
+    vertices_fetched++;
+    previous = v;
+    // A vertex may straddle two cache lines.
+    start = (((uint64_t) v) * vertex_size) / FETCH_CACHE_LINE_SIZE;
+    end = ((((uint64_t) v) + 1) * vertex_size - 1) / FETCH_CACHE_LINE_SIZE;
+    for (line = start; line <= end; line++) {
+      if ((line_inserted_at[line] != UINT64_MAX) &&
+        ((lines_fetched - line_inserted_at[line]) < FETCH_CACHE_LINES)) {
+        continue;
+      }
+      line_inserted_at[line] = lines_fetched;
+      lines_fetched++;
+    }
+  }
+  if (vertices_fetched > 1) {
+    stats->average_stride = (stride_sum * vertex_size) /
+      (vertices_fetched - 1);
+  }
+  if (vertex_count > 0) {
+    stats->overfetch = ((double) (lines_fetched * FETCH_CACHE_LINE_SIZE)) /
+      (((double) vertex_count) * vertex_size);
+  }
+  to_return = 1;
+
+cleanup:
+  free(vertex_inserted_at);
+  free(line_inserted_at);
+  return to_return;
+}
+
+// Marks a range in SplitInto16BitRanges whose vertices are too far apart to
+// be reached from a single base vertex, so it needs its own copies of them.
+#define COPIED_RANGE (0xffffffff)
+
+// Starts a new range at the given index, growing out's range array if
+// necessary. Returns 0 on error.
+static int StartShortIndexRange(ShortIndexMesh *out, uint32_t *capacity,
+    uint32_t first_index) {
+  IndexRange *new_ranges = NULL;
+  IndexRange *r = NULL;
+  if (out->range_count >= *capacity) {
+    *capacity *= 2;
+    new_ranges = (IndexRange *) realloc(out->ranges, *capacity *
+      sizeof(IndexRange));
+    if (!new_ranges) {
+      printf("Failed growing the list of index ranges.\n");
+      return 0;
+    }
+    out->ranges = new_ranges;
+  }
+  r = out->ranges + out->range_count;
+  r->first_index = first_index;
+  r->index_count = 0;
+  r->base_vertex = 0;
+  out->range_count++;
+  return 1;
+}
+
+// Finishes the last range in out, which uses range_vertices distinct vertices
+// between min_vertex and max_vertex. If they're all within 16 bits of
+// min_vertex, that becomes the range's base vertex. Otherwise, the range is
+// marked as copied, and its vertices are added to *added_vertices.
+static void FinishShortIndexRange(ShortIndexMesh *out,
+    uint32_t range_vertices, uint32_t min_vertex, uint32_t max_vertex,
+    uint64_t *added_vertices) {
+  IndexRange *r = out->ranges + out->range_count - 1;
+  if (r->index_count == 0) return;
+  if ((max_vertex - min_vertex) < MAX_16BIT_RANGE_VERTICES) {
+    r->base_vertex = min_vertex;
+    return;
+  }
+  r->base_vertex = COPIED_RANGE;
+  *added_vertices += range_vertices;
+}
+
+// Splits the triangles into ranges for SplitInto16BitRanges, adding triangles
+// to each range until it would use more than 65536 distinct vertices, and
+// finishes each range using FinishShortIndexRange. A range whose vertices are
+// all within 16 bits of each other is also ended early if the next triangle
+// would spread them further apart, as long as it's not too small. Vertices
+// renumbered by OptimizeVertexFetch are used roughly in order, so this keeps
+// most ranges from needing copies. used_in_range must have room for
+// vertex_count entries. Returns 0 on error.
+static int FindShortIndexRanges(const uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, uint32_t *used_in_range, uint32_t *range_capacity,
+    ShortIndexMesh *out, uint64_t *added_vertices) {
+  uint32_t i, j, v, new_vertices, current_range = 0, range_vertices = 0;
+  uint32_t min_vertex = NO_VERTEX, max_vertex = 0, new_min, new_max;
+  int end_range;
+  for (i = 0; i < vertex_count; i++) {
+    used_in_range[i] = NO_VERTEX;
+  }
+  if (!StartShortIndexRange(out, range_capacity, 0)) return 0;
+  for (i = 0; i < index_count; i += 3) {
+    // Count the vertices this triangle would add to the current range, taking
+    // care not to count a vertex twice in degenerate triangles.
+    new_vertices = 0;
+    new_min = min_vertex;
+    new_max = max_vertex;
+    for (j = 0; j < 3; j++) {
+      v = indices[i + j];
+      if (v < new_min) new_min = v;
+      if (v > new_max) new_max = v;
+      if (used_in_range[v] == current_range) continue;
+      if ((j > 0) && (v == indices[i])) continue;
+      if ((j > 1) && (v == indices[i + 1])) continue;
+      new_vertices++;
+    }
+    end_range = (range_vertices + new_vertices) > MAX_16BIT_RANGE_VERTICES;
+    if ((range_vertices >= MIN_EARLY_RANGE_VERTICES) &&
+      ((max_vertex - min_vertex) < MAX_16BIT_RANGE_VERTICES) &&
+      ((new_max - new_min) >= MAX_16BIT_RANGE_VERTICES)) {
+      end_range = 1;
+    }
+    if (end_range) {
+      FinishShortIndexRange(out, range_vertices, min_vertex, max_vertex,
+        added_vertices);
+      current_range++;
+      range_vertices = 0;
+      min_vertex = NO_VERTEX;
+      max_vertex = 0;
+      if (!StartShortIndexRange(out, range_capacity, i)) return 0;
+    }
+    for (j = 0; j < 3; j++) {
+      v = indices[i + j];
+      if (v < min_vertex) min_vertex = v;
+      if (v > max_vertex) max_vertex = v;
+      if (used_in_range[v] == current_range) continue;
+      used_in_range[v] = current_range;
+      range_vertices++;
+    }
+    out->ranges[current_range].index_count += 3;
+  }
+  FinishShortIndexRange(out, range_vertices, min_vertex, max_vertex,
+    added_vertices);
+  return 1;
+}
+
+// Writes out's 16-bit indices, once its ranges have been found. Ranges marked
+// as copied get their own copies of the vertices they use, in the order
+// they're first used, appended to out's added_vertices, which must have room
+// for all of them. used_in_range and index_in_range must have room for
+// vertex_count entries, but are only used for copied ranges.
+static void WriteShortIndices(const uint8_t *vertices, uint32_t vertex_count,
+    size_t vertex_size, const uint32_t *indices, uint32_t *used_in_range,
+    uint16_t *index_in_range, ShortIndexMesh *out) {
+  uint8_t *added = (uint8_t *) out->added_vertices;
+  uint32_t i, r, v, end, range_vertices, copied = 0;
+  IndexRange *range = NULL;
+  if (out->added_vertex_count > 0) {
+    for (i = 0; i < vertex_count; i++) {
+      used_in_range[i] = NO_VERTEX;
+    }
+  }
+  for (r = 0; r < out->range_count; r++) {
+    range = out->ranges + r;
+    end = range->first_index + range->index_count;
+    if (range->base_vertex != COPIED_RANGE) {
+      for (i = range->first_index; i < end; i++) {
+        out->indices[i] = (uint16_t) (indices[i] - range->base_vertex);
+      }
+      continue;
+    }
+    range->base_vertex = vertex_count + copied;
+    range_vertices = 0;
+    for (i = range->first_index; i < end; i++) {
+      v = indices[i];
+      if (used_in_range[v] != r) {
+        used_in_range[v] = r;
+        index_in_range[v] = range_vertices;
+        range_vertices++;
+        memcpy(added + ((size_t) copied) * vertex_size, vertices +
+          ((size_t) v) * vertex_size, vertex_size);
+        copied++;
+      }
+      out->indices[i] = index_in_range[v];
+    }
+  }
+}
+
+int SplitInto16BitRanges(const void *vertices, uint32_t vertex_count,
+    size_t vertex_size, const uint32_t *indices, uint32_t index_count,
+    uint32_t max_added_vertices, ShortIndexMesh *out) {
+  // For each vertex, the number of the last range that used it, and its
+  // index within that range.
+  uint32_t *used_in_range = NULL;
+  uint16_t *index_in_range = NULL;
+  uint64_t added_vertices = 0;
+  uint32_t i, range_capacity = 4;
+  memset(out, 0, sizeof(*out));
+  if ((index_count % 3) != 0) {
+    printf("The index count must be a multiple of 3.\n");
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (indices[i] >= vertex_count) {
+      printf("Invalid vertex index: %u\n", (unsigned) indices[i]);
+      return 0;
+    }
+  }
+  out->ranges = (IndexRange *) malloc(range_capacity * sizeof(IndexRange));
+  if (!out->ranges) {
+    printf("Failed allocating the list of index ranges.\n");
+    return 0;
+  }
+  if (vertex_count <= MAX_16BIT_RANGE_VERTICES) {
+    // Every index already fits in 16 bits, so the indices only need to be
+    // narrowed.
+    if (!StartShortIndexRange(out, &range_capacity, 0)) goto error_cleanup;
+    out->ranges[0].index_count = index_count;
+  } else {
+    used_in_range = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+    if (!used_in_range) {
+      printf("Failed allocating buffer for 16-bit index ranges.\n");
+      goto error_cleanup;
+    }
+    if (!FindShortIndexRanges(indices, index_count, vertex_count,
+      used_in_range, &range_capacity, out, &added_vertices)) {
+      goto error_cleanup;
+    }
+  }
+  // Let the caller fall back to 32-bit indices before copying anything.
+  if ((added_vertices > max_added_vertices) ||
+    ((vertex_count + added_vertices) > UINT32_MAX)) {
+    free(used_in_range);
+    FreeShortIndexMesh(out);
+    return 1;
+  }
+  out->added_vertex_count = (uint32_t) added_vertices;
+  out->vertex_count = vertex_count + out->added_vertex_count;
+  out->index_count = index_count;
+  out->indices = (uint16_t *) malloc(index_count * sizeof(uint16_t));
+  if (added_vertices > 0) {
+    out->added_vertices = malloc(added_vertices * vertex_size);
+    index_in_range = (uint16_t *) malloc(vertex_count * sizeof(uint16_t));
+  }
+  if ((!out->indices && (index_count > 0)) || ((added_vertices > 0) &&
+    (!out->added_vertices || !index_in_range))) {
+    printf("Failed allocating buffers for 16-bit indices.\n");
+    goto error_cleanup;
+  }
+  WriteShortIndices((const uint8_t *) vertices, vertex_count, vertex_size,
+    indices, used_in_range, index_in_range, out);
+  free(used_in_range);
+  free(index_in_range);
+  return 1;
+
+error_cleanup:
+  free(used_in_range);
+  free(index_in_range);
+  FreeShortIndexMesh(out);
+  return 0;
+}
+
+void FreeShortIndexMesh(ShortIndexMesh *m) {
+  free(m->added_vertices);
+  free(m->indices);
+  free(m->ranges);
+  memset(m, 0, sizeof(*m));
+}
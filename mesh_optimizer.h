@@ -0,0 +1,121 @@
+// Defines functions for reordering a mesh's triangles and vertices to make
+// better use of the GPU's caches, along with simple simulators for measuring
+// how well a given index order uses the post-transform vertex cache and the
+// memory caches used to fetch vertices.
+#ifndef OPENGL_TUTORIAL_MESH_OPTIMIZER_H
+#define OPENGL_TUTORIAL_MESH_OPTIMIZER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+// The vertex cache size that OptimizeVertexCache targets by default. Real
+// GPUs vary, but most behave at least as well as a FIFO cache of this size.
+#define DEFAULT_VERTEX_CACHE_SIZE (16)
+
+// Holds the results of SimulateVertexCache.
+typedef struct {
+  // The size of the simulated FIFO cache.
+  uint32_t cache_size;
+  // The number of times a vertex wasn't in the cache and had to be
+  // transformed.
+  uint64_t cache_misses;
+  // The average cache miss ratio: misses per triangle. Ranges from 0.5 (at
+  // best, for a large regular mesh) to 3.0.
+  double acmr;
+  // The average transform to vertex ratio: misses per vertex. 1.0 is ideal.
+  double atvr;
+} VertexCacheStats;
+
+// Holds the results of SimulateVertexFetch.
+typedef struct {
+  // The average distance, in bytes, between the vertices referenced by
+  // consecutive indices.
+  double average_stride;
+  // The number of bytes read from memory by the simulated cache, divided by
+  // the total size of the vertices. 1.0 means every cache line containing a
+  // vertex was only read once.
+  double overfetch;
+} VertexFetchStats;
+
+// Describes a range of triangles in an index buffer that can be drawn using
+// 16-bit indices: indices first_index through first_index + index_count - 1,
+// each of which is relative to base_vertex.
+typedef struct {
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t base_vertex;
+} IndexRange;
+
+// Holds a mesh split up by SplitInto16BitRanges. It's drawn using the input
+// vertices, followed by added_vertices.
+typedef struct {
+  // The copies of the vertices used by any ranges that can't use the input
+  // vertices directly, one range after another. NULL if there are none.
+  void *added_vertices;
+  uint32_t added_vertex_count;
+  // The total number of vertices, including the added ones.
+  uint32_t vertex_count;
+  // The 16-bit indices, each relative to its range's base vertex.
+  uint16_t *indices;
+  uint32_t index_count;
+  IndexRange *ranges;
+  uint32_t range_count;
+} ShortIndexMesh;
+
+// Reorders the triangles in the given list of indices to improve locality in
+// a post-transform vertex cache of the given size, using the Tipsify
+// algorithm (Sander, Nehab, and Barczak, 2007). Doesn't change the vertices
+// themselves, or the vertices making up each triangle. Each index must be
+// less than vertex_count, and index_count must be a multiple of 3. The output
+// only depends on the input, so the same mesh is always reordered the same
+// way. Returns 0 on error, in which case the indices are unchanged.
+int OptimizeVertexCache(uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, uint32_t cache_size);
+
+// Runs the given list of triangle indices through a simulated FIFO vertex
+// cache of the given size, and fills in stats. Each index must be less than
+// vertex_count. Returns 0 on error.
+int SimulateVertexCache(const uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, uint32_t cache_size, VertexCacheStats *stats);
+
+// Renumbers the vertices in the order they're first referenced by the given
+// indices, moving the vertices and rewriting the indices to match. Vertices
+// that aren't referenced at all are moved to the end, in their original
+// order. This should be run after OptimizeVertexCache, so that vertices
+// used by consecutive triangles end up close together in memory. Each vertex
+// takes vertex_size bytes. Returns 0 on error, in which case neither array is
+// changed.
+int OptimizeVertexFetch(void *vertices, uint32_t vertex_count,
+    size_t vertex_size, uint32_t *indices, uint64_t index_count);
+
+// Fills in stats about the memory accesses needed to fetch the vertices
+// referenced by the given indices, in order, through a simulated 32 KB FIFO
+// cache of 64-byte lines. Each vertex takes vertex_size bytes.
+// Returns 0 on error.
+int SimulateVertexFetch(const uint32_t *indices, uint32_t index_count,
+    uint32_t vertex_count, size_t vertex_size, VertexFetchStats *stats);
+
+// Splits the triangles in the given list of indices, in order, into as few
+// ranges as possible that each use at most 65536 vertices, so that they can be
+// drawn with 16-bit indices and a base vertex. The input vertices aren't
+// copied: a range that only uses vertices within 65536 of each other, as
+// every range does if there are at most 65536 vertices, indexes them
+// directly. Any other range gets its own copy of the vertices it uses, in the
+// order they're first used, placed after the input vertices. Each vertex
+// takes vertex_size bytes. If more than max_added_vertices copies would be
+// needed, out is left zeroed, so the caller can keep 32-bit indices without
+// anything having been copied. Otherwise, fills in out, which must be passed
+// to FreeShortIndexMesh when no longer needed. Returns 0 on error.
+int SplitInto16BitRanges(const void *vertices, uint32_t vertex_count,
+    size_t vertex_size, const uint32_t *indices, uint32_t index_count,
+    uint32_t max_added_vertices, ShortIndexMesh *out);
+
+// Frees the arrays in the given ShortIndexMesh, and zeroes it.
+void FreeShortIndexMesh(ShortIndexMesh *m);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_OPTIMIZER_H
@@ -0,0 +1,268 @@
+// This defines a command-line tool that reports statistics about how well
+// .obj files will use the GPU's caches, without needing a GPU. For each file,
+// it prints the mesh's bounds, the ACMR and ATVR of a simulated FIFO vertex
+// cache, and the vertex fetch stride and overfetch, both in the order the
+// file was parsed and after running OptimizeVertexCache and
+// OptimizeVertexFetch, and how many draw calls the optimized mesh needs with
+// 16-bit indices, along with the LOD chain generated by mesh_simplify.c and
+// the clusters generated by mesh_clusters.c. It also reports the error
+// introduced by converting the vertices to the compact QuantizedVertex
+// format, and whether it's within the allowed tolerance.
+//
+// Usage: ./mesh_report <file.obj> [<file2.obj> ...]
+// A path of "-" reads a .obj file from stdin.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "parse_obj.h"
+#include "utilities.h"
+#include "vertex_quantization.h"
+
+// The simulated cache sizes to report.
+static const uint32_t cache_sizes[] = {16, 32};
+#define CACHE_SIZE_COUNT ((int) (sizeof(cache_sizes) / sizeof(cache_sizes[0])))
+
+// Returns the current time, in seconds.
+static double CurrentSeconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double) t.tv_sec) + (((double) t.tv_nsec) / 1e9);
+}
+
+// Prints the vertex cache stats for the given indices, at each of the cache
+// sizes, followed by the vertex fetch stats. Returns 0 on error.
+static int PrintCacheStats(const char *label, const uint32_t *indices,
+    uint32_t index_count, uint32_t vertex_count) {
+  VertexCacheStats stats;
+  VertexFetchStats fetch_stats;
+  int i;
+  printf("  %-14s", label);
+  for (i = 0; i < CACHE_SIZE_COUNT; i++) {
+    if (!SimulateVertexCache(indices, index_count, vertex_count,
+      cache_sizes[i], &stats)) {
+      return 0;
+    }
+    printf("  FIFO %2u: ACMR %.3f, ATVR %.3f", (unsigned) stats.cache_size,
+      stats.acmr, stats.atvr);
+  }
+  printf("\n");
+  if (!SimulateVertexFetch(indices, index_count, vertex_count,
+    sizeof(ObjectFileVertex), &fetch_stats)) {
+    return 0;
+  }
+  printf("  %-14s  Fetch: average stride %.1f bytes, overfetch %.3f\n", "",
+    fetch_stats.average_stride, fetch_stats.overfetch);
+  return 1;
+}
+
+// Prints how many draw calls the given mesh needs with 16-bit indices, and how
+// many vertices have to be duplicated to allow this. Returns 0 on error.
+static int PrintIndexRanges(const ObjectFileInfo *o, const uint32_t *indices) {
+  ShortIndexMesh split;
+  double added = 0.0;
+  if (!SplitInto16BitRanges(o->vertices, o->vertex_count,
+    sizeof(ObjectFileVertex), indices, o->index_count, UINT32_MAX,
+    &split)) {
+    return 0;
+  }
+  if (o->vertex_count > 0) {
+    added = ((double) split.vertex_count) / ((double) o->vertex_count) - 1.0;
+  }
+  printf("  16-bit indices: %u draw range(s), %u vertices (%+.2f%%)\n",
+    (unsigned) split.range_count, (unsigned) split.vertex_count,
+    added * 100.0);
+  FreeShortIndexMesh(&split);
+  return 1;
+}
+
+// Builds the chain of LODs that LoadMesh would generate for the given mesh,
+// and prints the size and error of each one. Returns 0 on error.
+static int PrintLODChain(const ObjectFileInfo *o, const uint32_t *indices) {
+  MeshLOD lods[MAX_LOD_COUNT];
+  uint32_t *chain = NULL, chain_size = 0;
+  double start, elapsed;
+  int i, lod_count = 0;
+  start = CurrentSeconds();
+  if (!BuildLODChain(o->vertices, o->vertex_count, indices, o->index_count,
+    &chain, &chain_size, lods, &lod_count)) {
+    return 0;
+  }
+  elapsed = CurrentSeconds() - start;
+  free(chain);
+  for (i = 0; i < lod_count; i++) {
+    printf("  LOD %d: %u triangles, error %g\n", i,
+      (unsigned) (lods[i].index_count / 3), lods[i].error);
+  }
+  printf("  Generating LODs took %.3f ms\n", elapsed * 1000.0);
+  return 1;
+}
+
+// Splits the given triangles into clusters, and prints how large they are and
+// how many can be backface culled. Doesn't modify the indices. Returns 0 on
+// error.
+static int PrintClusters(const ObjectFileInfo *o, const uint32_t *indices) {
+  MeshCluster *clusters = NULL;
+  uint32_t *copy = NULL, cluster_count = 0, i, with_cones = 0;
+  double start, elapsed;
+  copy = (uint32_t *) malloc(o->index_count * sizeof(uint32_t));
+  if (!copy && (o->index_count > 0)) {
+    printf("Failed allocating cluster index copy.\n");
+    return 0;
+  }
+  if (o->index_count > 0) {
+    memcpy(copy, indices, o->index_count * sizeof(uint32_t));
+  }
+  start = CurrentSeconds();
+  if (!BuildClusters(o->vertices, o->vertex_count, copy, o->index_count,
+    &clusters, &cluster_count)) {
+    free(copy);
+    return 0;
+  }
+  elapsed = CurrentSeconds() - start;
+  for (i = 0; i < cluster_count; i++) {
+    if (clusters[i].cone_cutoff < 1.0f) with_cones++;
+  }
+  printf("  Clusters: %u, averaging %.1f triangles, %u with normal cones\n",
+    (unsigned) cluster_count, cluster_count ? ((double) o->index_count) /
+    (3.0 * cluster_count) : 0.0, (unsigned) with_cones);
+  printf("  Building clusters took %.3f ms\n", elapsed * 1000.0);
+  free(clusters);
+  free(copy);
+  return 1;
+}
+
+// Quantizes the given vertices, and prints the resulting error. Returns 0 on
+// error. Returns 1 even if the error is too large.
+static int PrintQuantizationError(const ObjectFileVertex *vertices,
+    uint32_t vertex_count) {
+  QuantizedVertex *quantized = NULL;
+  QuantizationParams params;
+  QuantizationError error;
+  quantized = (QuantizedVertex *) malloc(vertex_count *
+    sizeof(QuantizedVertex));
+  if (!quantized && (vertex_count > 0)) {
+    printf("Failed allocating quantized vertex buffer.\n");
+    return 0;
+  }
+  if (!QuantizeVertices(vertices, vertex_count, quantized, &params)) {
+    free(quantized);
+    return 0;
+  }
+  MeasureQuantizationError(vertices, quantized, vertex_count, &params,
+    &error);
+  free(quantized);
+  printf("  Compact vertices (%d bytes, vs. %d): %s\n",
+    (int) sizeof(QuantizedVertex), (int) sizeof(ObjectFileVertex),
+    CheckQuantizationError(&error) ? "within tolerance" :
+    "EXCEEDS TOLERANCE");
+  printf("    Position error: %g (%g of bounding box diagonal, max %g)\n",
+    error.max_position_error, error.max_relative_position_error,
+    MAX_RELATIVE_POSITION_ERROR);
+  printf("    Normal error: %g degrees (max %g)\n",
+    error.max_normal_error_degrees, MAX_NORMAL_ERROR_DEGREES);
+  printf("    UV error: %g (%g of UV range, max %g)\n", error.max_uv_error,
+    error.max_relative_uv_error, MAX_RELATIVE_UV_ERROR);
+  return 1;
+}
+
+// Loads the given .obj file and prints its report. Reads stdin if the path is
+// "-". Returns 0 on error.
+static int ReportFile(const char *path) {
+  ObjParseOptions options;
+  ObjectFileInfo *o = NULL;
+  const char *content = NULL;
+  uint32_t *optimized = NULL;
+  size_t size = 0;
+  double start, elapsed;
+  int to_return = 0;
+  if (strcmp(path, "-") == 0) {
+    memset(&options, 0, sizeof(options));
+    o = ParseObjStream(stdin, &options);
+  } else {
+    content = MapFile(path, &size);
+    if (!content) return 0;
+    o = ParseObjFileN(content, size);
+    UnmapFile(content, size);
+  }
+  if (!o) {
+    printf("Failed parsing %s\n", path);
+    return 0;
+  }
+  printf("%s: %u vertices, %llu triangles\n", path,
+    (unsigned) o->vertex_count, (unsigned long long) (o->index_count / 3));
+  printf("  Bounds: (%g, %g, %g) to (%g, %g, %g), sphere at (%g, %g, %g) "
+    "with radius %g\n", o->bounds.min[0], o->bounds.min[1], o->bounds.min[2],
+    o->bounds.max[0], o->bounds.max[1], o->bounds.max[2],
+    o->bounds.center[0], o->bounds.center[1], o->bounds.center[2],
+    o->bounds.radius);
+  printf("  Sub-meshes: %u\n", (unsigned) o->sub_mesh_count);
+  // The optimizers and simulators below take 32-bit index counts.
+  if (o->index_count > UINT32_MAX) {
+    printf("  Too many indices to analyze further.\n");
+    to_return = 1;
+    goto cleanup;
+  }
+  if (!PrintCacheStats("File order", o->indices, o->index_count,
+    o->vertex_count)) {
+    goto cleanup;
+  }
+  optimized = (uint32_t *) malloc(o->index_count * sizeof(uint32_t));
+  if (!optimized) {
+    printf("Failed allocating optimized index copy.\n");
+    goto cleanup;
+  }
+  memcpy(optimized, o->indices, o->index_count * sizeof(uint32_t));
+  start = CurrentSeconds();
+  if (!OptimizeVertexCache(optimized, o->index_count, o->vertex_count,
+    DEFAULT_VERTEX_CACHE_SIZE)) {
+    goto cleanup;
+  }
+  elapsed = CurrentSeconds() - start;
+  if (!PrintCacheStats("Cache order", optimized, o->index_count,
+    o->vertex_count)) {
+    goto cleanup;
+  }
+  printf("  Cache optimization took %.3f ms\n", elapsed * 1000.0);
+  // This reorders the vertices in o, but they aren't used after this.
+  start = CurrentSeconds();
+  if (!OptimizeVertexFetch(o->vertices, o->vertex_count,
+    sizeof(ObjectFileVertex), optimized, o->index_count)) {
+    goto cleanup;
+  }
+  elapsed = CurrentSeconds() - start;
+  if (!PrintCacheStats("+ fetch order", optimized, o->index_count,
+    o->vertex_count)) {
+    goto cleanup;
+  }
+  printf("  Fetch optimization took %.3f ms\n", elapsed * 1000.0);
+  if (!PrintIndexRanges(o, optimized)) goto cleanup;
+  if (!PrintLODChain(o, optimized)) goto cleanup;
+  if (!PrintClusters(o, optimized)) goto cleanup;
+  if (!PrintQuantizationError(o->vertices, o->vertex_count)) goto cleanup;
+  to_return = 1;
+
+cleanup:
+  free(optimized);
+  FreeObjectFileInfo(o);
+  return to_return;
+}
+
+int main(int argc, char **argv) {
+  int i, failed = 0;
+  if (argc < 2) {
+    printf("Usage: %s <file.obj> [<file2.obj> ...]\n", argv[0]);
+    return 1;
+  }
+  for (i = 1; i < argc; i++) {
+    if (!ReportFile(argv[i])) {
+      printf("Failed generating report for %s\n", argv[i]);
+      failed = 1;
+    }
+  }
+  return failed;
+}
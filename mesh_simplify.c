@@ -0,0 +1,698 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_optimizer.h"
+#include "parse_obj.h"
+#include "mesh_simplify.h"
+
+// How much more heavily to weight the planes that keep borders and seams in
+// place, compared to the planes of the triangles themselves.
+#define BORDER_WEIGHT (10.0)
+
+// The most copies of a single position (i.e. vertices with the same position
+// but different normals or UVs) that can be collapsed together.
+#define MAX_WEDGES (16)
+
+// Collapses that make any triangle's normal turn by more than this, measured
+// as the cosine of the angle between the old and new normals, are rejected.
+#define MIN_NORMAL_COSINE (0.1)
+
+// BuildLODChain stops once a LOD has fewer triangles than this, or removes
+// less than a quarter of the previous LOD's triangles.
+#define MIN_LOD_TRIANGLES (8)
+
+// Kinds of positions, determining which collapses are allowed.
+#define POSITION_MANIFOLD (0)
+#define POSITION_BORDER (1)
+#define POSITION_LOCKED (2)
+
+// A symmetric 4x4 matrix Q, such that the error at point v is
+// [v 1] * Q * [v 1]^T. The entries are xx, xy, xz, yy, yz, zz, x, y, z, and
+// the constant term, followed by the total weight of the planes summed into
+// it.
+typedef struct {
+  double q[10];
+  double weight;
+} Quadric;
+
+// A candidate edge collapse, moving every vertex at position "from" to
+// position "to".
+typedef struct {
+  float cost;
+  uint32_t from;
+  uint32_t to;
+} Collapse;
+
+// Used for sorting vertices by position.
+typedef struct {
+  uint32_t bits[3];
+  uint32_t vertex;
+} PositionKey;
+
+// Holds the state used while simplifying a mesh.
+typedef struct {
+  const ObjectFileVertex *vertices;
+  uint32_t vertex_count;
+  // The position each vertex belongs to, and the lowest-numbered vertex with
+  // each position.
+  uint32_t *position_of;
+  uint32_t *representative;
+  uint32_t position_count;
+  Quadric *quadrics;
+  // The current triangles, which shrink as edges are collapsed.
+  uint32_t *indices;
+  uint32_t index_count;
+  // The triangles using each position are at adjacency[adjacency_offsets[p]]
+  // through adjacency[adjacency_offsets[p + 1] - 1]. Rebuilt on every pass.
+  uint32_t *adjacency_offsets;
+  uint32_t *adjacency;
+  // One of the POSITION_* kinds for each position. Rebuilt on every pass.
+  uint8_t *kind;
+  // Nonzero for positions whose neighborhood was changed during this pass.
+  uint8_t *locked;
+  // Scratch space for counting and marking neighboring positions.
+  uint32_t *counts;
+  uint32_t *marks;
+  uint32_t mark;
+  // The vertex each vertex was collapsed onto, if any.
+  uint32_t *vertex_remap;
+  // The cheapest collapse found for each position during the current pass.
+  Collapse *collapses;
+} SimplifyState;
+
+// Frees the buffers held by s.
+static void CleanupSimplifyState(SimplifyState *s) {
+  free(s->position_of);
+  free(s->representative);
+  free(s->quadrics);
+  free(s->indices);
+  free(s->adjacency_offsets);
+  free(s->adjacency);
+  free(s->kind);
+  free(s->locked);
+  free(s->counts);
+  free(s->marks);
+  free(s->vertex_remap);
+  free(s->collapses);
+  memset(s, 0, sizeof(*s));
+}
+
+// Returns the bits of the given float, treating -0 the same as 0.
+static uint32_t FloatBits(float f) {
+  uint32_t bits;
+  if (f == 0.0f) return 0;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// Used to sort vertices by position, and then by index.
+static int ComparePositionKeys(const void *a, const void *b) {
+  const PositionKey *ka = (const PositionKey *) a;
+  const PositionKey *kb = (const PositionKey *) b;
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (ka->bits[i] != kb->bits[i]) return (ka->bits[i] < kb->bits[i]) ? -1 :
+      1;
+  }
+  if (ka->vertex == kb->vertex) return 0;
+  return (ka->vertex < kb->vertex) ? -1 : 1;
+}
+
+// Used to sort candidate collapses by cost. Ties are broken by position so
+// the order never depends on the sorting algorithm.
+static int CompareCollapses(const void *a, const void *b) {
+  const Collapse *ca = (const Collapse *) a;
+  const Collapse *cb = (const Collapse *) b;
+  if (ca->cost != cb->cost) return (ca->cost < cb->cost) ? -1 : 1;
+  if (ca->from != cb->from) return (ca->from < cb->from) ? -1 : 1;
+  if (ca->to == cb->to) return 0;
+  return (ca->to < cb->to) ? -1 : 1;
+}
+
+// Groups vertices with identical positions, filling in position_of and
+// representative. Returns 0 on error.
+static int FindPositions(SimplifyState *s) {
+  PositionKey *keys = NULL;
+  uint32_t i, p = 0;
+  int j;
+  keys = (PositionKey *) malloc(s->vertex_count * sizeof(PositionKey));
+  if (!keys && (s->vertex_count > 0)) {
+    printf("Failed allocating vertex position keys.\n");
+    return 0;
+  }
+  for (i = 0; i < s->vertex_count; i++) {
+    for (j = 0; j < 3; j++) {
+      keys[i].bits[j] = FloatBits(s->vertices[i].location[j]);
+    }
+    keys[i].vertex = i;
+  }
+  qsort(keys, s->vertex_count, sizeof(PositionKey), ComparePositionKeys);
+  for (i = 0; i < s->vertex_count; i++) {
+    if ((i > 0) && (memcmp(keys[i].bits, keys[i - 1].bits,
+      sizeof(keys[i].bits)) != 0)) {
+      p++;
+    }
+    s->position_of[keys[i].vertex] = p;
+    // Vertices with the same position are sorted by index, so the first one
+    // is the lowest-numbered.
+    if ((i == 0) || (p != s->position_of[keys[i - 1].vertex])) {
+      s->representative[p] = keys[i].vertex;
+    }
+  }
+  s->position_count = (s->vertex_count > 0) ? (p + 1) : 0;
+  free(keys);
+  return 1;
+}
+
+// Returns the location of the given position.
+static const float* PositionLocation(SimplifyState *s, uint32_t p) {
+  return s->vertices[s->representative[p]].location;
+}
+
+// Adds the plane with the given unit normal passing through the given point
+// to the quadric, with the given weight.
+static void AddPlane(Quadric *q, const double *n, const float *point,
+    double weight) {
+  double d = -(n[0] * point[0] + n[1] * point[1] + n[2] * point[2]);
+  q->q[0] += weight * n[0] * n[0];
+  q->q[1] += weight * n[0] * n[1];
+  q->q[2] += weight * n[0] * n[2];
+  q->q[3] += weight * n[1] * n[1];
+  q->q[4] += weight * n[1] * n[2];
+  q->q[5] += weight * n[2] * n[2];
+  q->q[6] += weight * n[0] * d;
+  q->q[7] += weight * n[1] * d;
+  q->q[8] += weight * n[2] * d;
+  q->q[9] += weight * d * d;
+  q->weight += weight;
+}
+
+// Adds b to a.
+static void AddQuadric(Quadric *a, const Quadric *b) {
+  int i;
+  for (i = 0; i < 10; i++) {
+    a->q[i] += b->q[i];
+  }
+  a->weight += b->weight;
+}
+
+// Returns the weighted mean squared distance from point v to the planes in q.
+static double QuadricError(const Quadric *q, const float *v) {
+  const double *m = q->q;
+  double x = v[0], y = v[1], z = v[2], e;
+  if (q->weight <= 0.0) return 0.0;
+  e = m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + m[3] * y * y +
+    2.0 * m[4] * y * z + m[5] * z * z + 2.0 * (m[6] * x + m[7] * y + m[8] *
+    z) + m[9];
+  e /= q->weight;
+  return (e > 0.0) ? e : 0.0;
+}
+
+// Sets out to b - a.
+static void Subtract(const float *a, const float *b, double *out) {
+  out[0] = b[0] - a[0];
+  out[1] = b[1] - a[1];
+  out[2] = b[2] - a[2];
+}
+
+// Sets out to a x b.
+static void Cross(const double *a, const double *b, double *out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static double Dot(const double *a, const double *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Sets n to the non-normalized normal of the triangle with the given corners.
+static void TriangleNormal(const float *a, const float *b, const float *c,
+    double *n) {
+  double ab[3], ac[3];
+  Subtract(a, b, ab);
+  Subtract(a, c, ac);
+  Cross(ab, ac, n);
+}
+
+// Rebuilds the position-triangle adjacency from the current triangles.
+static void BuildAdjacency(SimplifyState *s) {
+  uint32_t i, p;
+  memset(s->adjacency_offsets, 0, (s->position_count + 1) *
+    sizeof(uint32_t));
+  for (i = 0; i < s->index_count; i++) {
+    s->adjacency_offsets[s->position_of[s->indices[i]] + 1]++;
+  }
+  for (p = 0; p < s->position_count; p++) {
+    s->adjacency_offsets[p + 1] += s->adjacency_offsets[p];
+  }
+  // Like in the vertex cache optimizer, this advances each offset to the
+  // start of the next position's triangles, so they're shifted back after.
+  for (i = 0; i < s->index_count; i++) {
+    p = s->position_of[s->indices[i]];
+    s->adjacency[s->adjacency_offsets[p]] = i / 3;
+    s->adjacency_offsets[p]++;
+  }
+  for (p = s->position_count; p > 0; p--) {
+    s->adjacency_offsets[p] = s->adjacency_offsets[p - 1];
+  }
+  s->adjacency_offsets[0] = 0;
+}
+
+// Returns nonzero if any current triangle has the directed edge from vertex
+// a to vertex b.
+static int HasDirectedEdge(SimplifyState *s, uint32_t a, uint32_t b) {
+  uint32_t i, *t;
+  uint32_t p = s->position_of[a];
+  for (i = s->adjacency_offsets[p]; i < s->adjacency_offsets[p + 1]; i++) {
+    t = s->indices + s->adjacency[i] * 3;
+    if (((t[0] == a) && (t[1] == b)) || ((t[1] == a) && (t[2] == b)) ||
+      ((t[2] == a) && (t[0] == b))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Computes the quadric for each position from the current triangles. Edges
+// without a matching edge in the opposite direction are either borders or
+// seams, and get an extra plane perpendicular to the triangle to keep them
+// in place.
+static void ComputeQuadrics(SimplifyState *s) {
+  const float *corners[3];
+  double n[3], edge[3], perpendicular[3], length;
+  uint32_t i, a, b;
+  int j;
+  memset(s->quadrics, 0, s->position_count * sizeof(Quadric));
+  for (i = 0; i < s->index_count; i += 3) {
+    for (j = 0; j < 3; j++) {
+      corners[j] = s->vertices[s->indices[i + j]].location;
+    }
+    TriangleNormal(corners[0], corners[1], corners[2], n);
+    length = sqrt(Dot(n, n));
+    if (length <= 0.0) continue;
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    // The area of the triangle is half the length of its normal.
+    for (j = 0; j < 3; j++) {
+      AddPlane(s->quadrics + s->position_of[s->indices[i + j]], n,
+        corners[0], length * 0.5);
+    }
+    for (j = 0; j < 3; j++) {
+      a = s->indices[i + j];
+      b = s->indices[i + ((j + 1) % 3)];
+      if (HasDirectedEdge(s, b, a)) continue;
+      Subtract(corners[j], corners[(j + 1) % 3], edge);
+      Cross(edge, n, perpendicular);
+      length = sqrt(Dot(perpendicular, perpendicular));
+      if (length <= 0.0) continue;
+      perpendicular[0] /= length;
+      perpendicular[1] /= length;
+      perpendicular[2] /= length;
+      AddPlane(s->quadrics + s->position_of[a], perpendicular, corners[j],
+        Dot(edge, edge) * BORDER_WEIGHT);
+      AddPlane(s->quadrics + s->position_of[b], perpendicular, corners[j],
+        Dot(edge, edge) * BORDER_WEIGHT);
+    }
+  }
+}
+
+// Sets the kind of every position, based on how many triangles use each of
+// its edges. Positions with an edge shared by more than two triangles, or
+// where more than one border meets, are locked.
+static void ClassifyPositions(SimplifyState *s) {
+  uint32_t p, i, j, q, *t, border_edges;
+  uint8_t kind;
+  for (p = 0; p < s->position_count; p++) {
+    for (i = s->adjacency_offsets[p]; i < s->adjacency_offsets[p + 1]; i++) {
+      t = s->indices + s->adjacency[i] * 3;
+      for (j = 0; j < 3; j++) {
+        q = s->position_of[t[j]];
+        if (q != p) s->counts[q]++;
+      }
+    }
+    kind = POSITION_MANIFOLD;
+    border_edges = 0;
+    for (i = s->adjacency_offsets[p]; i < s->adjacency_offsets[p + 1]; i++) {
+      t = s->indices + s->adjacency[i] * 3;
+      for (j = 0; j < 3; j++) {
+        q = s->position_of[t[j]];
+        if ((q == p) || (s->counts[q] == 0)) continue;
+        if (s->counts[q] == 1) border_edges++;
+        if (s->counts[q] > 2) kind = POSITION_LOCKED;
+        // Only look at each neighbor once.
+        s->counts[q] = 0;
+      }
+    }
+    if ((kind == POSITION_MANIFOLD) && (border_edges != 0)) {
+      kind = (border_edges == 2) ? POSITION_BORDER : POSITION_LOCKED;
+    }
+    s->kind[p] = kind;
+  }
+}
+
+// Tries to collapse position from onto position to, checking that this
+// doesn't change the mesh's topology, tear a seam or border, or flip any
+// triangles. Returns the number of triangles removed by the collapse, or 0 if
+// it isn't allowed.
+static uint32_t TryCollapse(SimplifyState *s, uint32_t from, uint32_t to) {
+  uint32_t wedges[MAX_WEDGES], targets[MAX_WEDGES];
+  uint32_t wedge_count = 0, shared = 0, common = 0;
+  uint32_t i, j, k, w, target, q, *t;
+  const float *corners[3];
+  double before[3], after[3], lengths;
+  int has_to;
+  if (s->locked[from] || s->locked[to]) return 0;
+  // Mark the neighbors of the destination, then count the neighbors of the
+  // source that are also neighbors of the destination.
+  s->mark += 2;
+  for (i = s->adjacency_offsets[to]; i < s->adjacency_offsets[to + 1]; i++) {
+    t = s->indices + s->adjacency[i] * 3;
+    for (j = 0; j < 3; j++) {
+      s->marks[s->position_of[t[j]]] = s->mark;
+    }
+  }
+  for (i = s->adjacency_offsets[from]; i < s->adjacency_offsets[from + 1];
+    i++) {
+    t = s->indices + s->adjacency[i] * 3;
+    has_to = 0;
+    target = 0;
+    w = 0;
+    for (j = 0; j < 3; j++) {
+      q = s->position_of[t[j]];
+      if (q == to) {
+        has_to = 1;
+        target = t[j];
+      } else if (q == from) {
+        w = t[j];
+      } else if (s->marks[q] == s->mark) {
+        // Mark each common neighbor so it's only counted once.
+        s->marks[q] = s->mark + 1;
+        common++;
+      }
+    }
+    if (has_to) shared++;
+    // Find which vertex at the destination this copy of the source vertex
+    // will be moved to. Each copy must have exactly one.
+    for (k = 0; k < wedge_count; k++) {
+      if (wedges[k] == w) break;
+    }
+    if (k == wedge_count) {
+      if (wedge_count >= MAX_WEDGES) return 0;
+      wedges[k] = w;
+      targets[k] = UINT32_MAX;
+      wedge_count++;
+    }
+    if (!has_to) continue;
+    if ((targets[k] != UINT32_MAX) && (targets[k] != target)) return 0;
+    targets[k] = target;
+  }
+  if ((shared == 0) || (shared > 2) || (common != shared)) return 0;
+  if ((s->kind[from] == POSITION_BORDER) && (shared != 1)) return 0;
+  if ((s->kind[from] == POSITION_MANIFOLD) && (shared != 2)) return 0;
+  for (k = 0; k < wedge_count; k++) {
+    if (targets[k] == UINT32_MAX) return 0;
+  }
+
+  // Make sure none of the remaining triangles flip over.
+  for (i = s->adjacency_offsets[from]; i < s->adjacency_offsets[from + 1];
+    i++) {
+    t = s->indices + s->adjacency[i] * 3;
+    has_to = 0;
+    for (j = 0; j < 3; j++) {
+      corners[j] = s->vertices[t[j]].location;
+      if (s->position_of[t[j]] == to) has_to = 1;
+    }
+    if (has_to) continue;
+    TriangleNormal(corners[0], corners[1], corners[2], before);
+    for (j = 0; j < 3; j++) {
+      if (s->position_of[t[j]] == from) corners[j] = PositionLocation(s, to);
+    }
+    TriangleNormal(corners[0], corners[1], corners[2], after);
+    lengths = sqrt(Dot(before, before) * Dot(after, after));
+    if (Dot(before, after) <= (MIN_NORMAL_COSINE * lengths)) return 0;
+  }
+
+  for (k = 0; k < wedge_count; k++) {
+    s->vertex_remap[wedges[k]] = targets[k];
+  }
+  AddQuadric(s->quadrics + to, s->quadrics + from);
+  // Nothing around the source can be collapsed again until the triangles
+  // have been rewritten.
+  for (i = s->adjacency_offsets[from]; i < s->adjacency_offsets[from + 1];
+    i++) {
+    t = s->indices + s->adjacency[i] * 3;
+    for (j = 0; j < 3; j++) {
+      s->locked[s->position_of[t[j]]] = 1;
+    }
+  }
+  return shared;
+}
+
+// Applies vertex_remap to the triangles, and removes triangles that have
+// collapsed to a line or a point, keeping the rest in order.
+static void RewriteTriangles(SimplifyState *s) {
+  uint32_t i, j, count = 0, a, b, c;
+  for (i = 0; i < s->index_count; i += 3) {
+    a = s->vertex_remap[s->indices[i]];
+    b = s->vertex_remap[s->indices[i + 1]];
+    c = s->vertex_remap[s->indices[i + 2]];
+    if ((s->position_of[a] == s->position_of[b]) || (s->position_of[b] ==
+      s->position_of[c]) || (s->position_of[a] == s->position_of[c])) {
+      continue;
+    }
+    j = count;
+    s->indices[j] = a;
+    s->indices[j + 1] = b;
+    s->indices[j + 2] = c;
+    count += 3;
+  }
+  s->index_count = count;
+}
+
+// Considers collapsing position a onto position b, replacing a's current best
+// collapse if this one is cheaper.
+static void ConsiderCollapse(SimplifyState *s, uint32_t a, uint32_t b) {
+  Collapse *c = s->collapses + a;
+  float cost;
+  if (s->kind[a] == POSITION_LOCKED) return;
+  // Border positions can only move along the border.
+  if ((s->kind[a] == POSITION_BORDER) && (s->kind[b] == POSITION_MANIFOLD)) {
+    return;
+  }
+  cost = QuadricError(s->quadrics + a, PositionLocation(s, b));
+  if ((c->to != UINT32_MAX) && ((cost > c->cost) || ((cost == c->cost) &&
+    (b > c->to)))) {
+    return;
+  }
+  c->cost = cost;
+  c->to = b;
+}
+
+// Runs one pass of simplification: finds the cheapest collapse for each
+// position, then applies the cheapest ones that don't overlap, until enough
+// triangles have been removed. Updates *applied_cost to the largest cost of
+// any collapse applied. Returns the number of collapses applied.
+static uint32_t SimplifyPass(SimplifyState *s, uint32_t target_index_count,
+    double max_cost, double *applied_cost) {
+  uint32_t i, j, a, b, collapse_count = 0, applied = 0, removed = 0, needed;
+  Collapse *c = NULL;
+  BuildAdjacency(s);
+  ClassifyPositions(s);
+  for (i = 0; i < s->position_count; i++) {
+    s->collapses[i].from = i;
+    s->collapses[i].to = UINT32_MAX;
+  }
+  for (i = 0; i < s->index_count; i += 3) {
+    for (j = 0; j < 3; j++) {
+      a = s->position_of[s->indices[i + j]];
+      b = s->position_of[s->indices[i + ((j + 1) % 3)]];
+      ConsiderCollapse(s, a, b);
+      ConsiderCollapse(s, b, a);
+    }
+  }
+  for (i = 0; i < s->position_count; i++) {
+    if (s->collapses[i].to == UINT32_MAX) continue;
+    s->collapses[collapse_count] = s->collapses[i];
+    collapse_count++;
+  }
+  qsort(s->collapses, collapse_count, sizeof(Collapse), CompareCollapses);
+  memset(s->locked, 0, s->position_count);
+  needed = (s->index_count - target_index_count) / 3;
+  for (i = 0; i < collapse_count; i++) {
+    if (removed >= needed) break;
+    c = s->collapses + i;
+    if (c->cost > max_cost) break;
+    j = TryCollapse(s, c->from, c->to);
+    if (j == 0) continue;
+    removed += j;
+    applied++;
+    if (c->cost > *applied_cost) *applied_cost = c->cost;
+  }
+  RewriteTriangles(s);
+  return applied;
+}
+
+int SimplifyMesh(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint32_t index_count, uint32_t target_index_count,
+    float max_error, uint32_t *out, uint32_t *out_index_count,
+    float *out_error) {
+  SimplifyState s;
+  double max_cost, applied_cost = 0.0;
+  uint32_t i;
+  int to_return = 0;
+  memset(&s, 0, sizeof(s));
+  if ((index_count % 3) != 0) {
+    printf("The index count must be a multiple of 3.\n");
+    return 0;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (indices[i] >= vertex_count) {
+      printf("Invalid vertex index: %u\n", (unsigned) indices[i]);
+      return 0;
+    }
+  }
+  s.vertices = vertices;
+  s.vertex_count = vertex_count;
+  s.position_of = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+  s.representative = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+  s.quadrics = (Quadric *) malloc(vertex_count * sizeof(Quadric));
+  s.indices = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  s.adjacency_offsets = (uint32_t *) malloc((((size_t) vertex_count) + 1) *
+    sizeof(uint32_t));
+  s.adjacency = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  s.kind = (uint8_t *) malloc(vertex_count);
+  s.locked = (uint8_t *) malloc(vertex_count);
+  s.counts = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s.marks = (uint32_t *) calloc(vertex_count, sizeof(uint32_t));
+  s.vertex_remap = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+  s.collapses = (Collapse *) malloc(vertex_count * sizeof(Collapse));
+  if ((vertex_count > 0) && (!s.position_of || !s.representative ||
+    !s.quadrics || !s.adjacency_offsets || !s.kind || !s.locked ||
+    !s.counts || !s.marks || !s.vertex_remap || !s.collapses)) {
+    printf("Failed allocating mesh simplification buffers.\n");
+    goto cleanup;
+  }
+  if ((index_count > 0) && (!s.indices || !s.adjacency)) {
+    printf("Failed allocating mesh simplification buffers.\n");
+    goto cleanup;
+  }
+  if (!FindPositions(&s)) goto cleanup;
+  for (i = 0; i < vertex_count; i++) {
+    s.vertex_remap[i] = i;
+  }
+  memcpy(s.indices, indices, index_count * sizeof(uint32_t));
+  s.index_count = index_count;
+  // Drop triangles that are already degenerate, so every remaining triangle
+  // has three distinct positions.
+  RewriteTriangles(&s);
+  BuildAdjacency(&s);
+  ComputeQuadrics(&s);
+  max_cost = ((double) max_error) * ((double) max_error);
+  while (s.index_count > target_index_count) {
+    if (SimplifyPass(&s, target_index_count, max_cost, &applied_cost) == 0) {
+      break;
+    }
+  }
+  memcpy(out, s.indices, s.index_count * sizeof(uint32_t));
+  *out_index_count = s.index_count;
+  if (out_error) *out_error = sqrt(applied_cost);
+  to_return = 1;
+
+cleanup:
+  CleanupSimplifyState(&s);
+  return to_return;
+}
+
+int BuildLODChain(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint32_t index_count, uint32_t **out_indices,
+    uint32_t *out_index_count, MeshLOD *lods, int *lod_count) {
+  uint32_t *chain = NULL, *new_chain = NULL, *simplified = NULL;
+  uint64_t capacity;
+  uint32_t total, target, simplified_count;
+  MeshLOD *previous = NULL;
+  float error = 0.0f, lod_error;
+  *out_indices = NULL;
+  *out_index_count = 0;
+  *lod_count = 0;
+  // Each LOD is at most three quarters the size of the one before it, so this
+  // is enough for most meshes without needing to grow. The whole chain must
+  // still fit in 32 bits, since that's the size of each LOD's first_index.
+  capacity = ((uint64_t) index_count) * 2 + 3;
+  if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+  if (capacity > (SIZE_MAX / sizeof(uint32_t))) {
+    printf("Too many indices (%lu) to build LODs.\n",
+      (unsigned long) index_count);
+    return 0;
+  }
+  chain = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+  simplified = (uint32_t *) malloc(index_count * sizeof(uint32_t));
+  if (!chain || (!simplified && (index_count > 0))) {
+    printf("Failed allocating LOD index buffers.\n");
+    free(chain);
+    free(simplified);
+    return 0;
+  }
+  memcpy(chain, indices, index_count * sizeof(uint32_t));
+  total = index_count;
+  lods[0].first_index = 0;
+  lods[0].index_count = index_count;
+  lods[0].error = 0.0f;
+  *lod_count = 1;
+  while (*lod_count < MAX_LOD_COUNT) {
+    previous = lods + (*lod_count - 1);
+    target = (previous->index_count / 6) * 3;
+    if (target < (MIN_LOD_TRIANGLES * 3)) break;
+    if (!SimplifyMesh(vertices, vertex_count, chain + previous->first_index,
+      previous->index_count, target, FLT_MAX, simplified, &simplified_count,
+      &lod_error)) {
+      free(chain);
+      free(simplified);
+      return 0;
+    }
+    if (simplified_count > (previous->index_count - previous->index_count /
+      4)) {
+      break;
+    }
+    if (!OptimizeVertexCache(simplified, simplified_count, vertex_count,
+      DEFAULT_VERTEX_CACHE_SIZE)) {
+      free(chain);
+      free(simplified);
+      return 0;
+    }
+    if ((((uint64_t) total) + simplified_count) > UINT32_MAX) {
+      printf("The LOD chain needs more than 2^32 indices.\n");
+      free(chain);
+      free(simplified);
+      return 0;
+    }
+    if ((total + simplified_count) > capacity) {
+      capacity = total + simplified_count;
+      new_chain = (uint32_t *) realloc(chain, capacity * sizeof(uint32_t));
+      if (!new_chain) {
+        printf("Failed growing LOD index buffer.\n");
+        free(chain);
+        free(simplified);
+        return 0;
+      }
+      chain = new_chain;
+    }
+    memcpy(chain + total, simplified, simplified_count * sizeof(uint32_t));
+    // Each LOD is simplified from the previous one, so its distance from the
+    // original surface is at most the sum of the errors so far.
+    error += lod_error;
+    lods[*lod_count].first_index = total;
+    lods[*lod_count].index_count = simplified_count;
+    lods[*lod_count].error = error;
+    total += simplified_count;
+    *lod_count += 1;
+  }
+  free(simplified);
+  *out_indices = chain;
+  *out_index_count = total;
+  return 1;
+}
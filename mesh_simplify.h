@@ -0,0 +1,63 @@
+// Defines functions for simplifying triangle meshes using quadric error
+// metrics (Garland and Heckbert, 1997), and for building a chain of
+// progressively simpler levels of detail (LODs) from a mesh. Simplification
+// only removes triangles and rewrites indices; every LOD refers to the
+// original vertices, so all of them can share one vertex buffer.
+//
+// Vertices with the same position but different normals or UV coordinates
+// form seams. Seams and open borders are preserved: a vertex on a seam can
+// only be collapsed along the seam, with every copy of it collapsing onto the
+// matching copy of its neighbor, and border vertices can only be collapsed
+// along the border. Everything here is single-threaded and the results only
+// depend on the inputs.
+#ifndef OPENGL_TUTORIAL_MESH_SIMPLIFY_H
+#define OPENGL_TUTORIAL_MESH_SIMPLIFY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "parse_obj.h"
+
+// The largest number of LODs BuildLODChain will produce, including the
+// original mesh.
+#define MAX_LOD_COUNT (8)
+
+// Describes one level of detail in the index buffer built by BuildLODChain.
+typedef struct {
+  // The range of indices making up this LOD's triangles.
+  uint32_t first_index;
+  uint32_t index_count;
+  // An upper bound on how far, in the mesh's units, this LOD's surface may be
+  // from the original mesh's surface. This is 0 for the original mesh.
+  float error;
+} MeshLOD;
+
+// Simplifies the triangles given by indices, trying to reduce them to at most
+// target_index_count indices without moving the surface by more than
+// max_error, in the mesh's units. Writes the new indices to out, which must
+// have room for index_count entries, and sets *out_index_count to the number
+// written. The remaining triangles are in the same order as in the input. If
+// out_error isn't NULL, it's set to the estimated distance between the
+// simplified and original surfaces. Returns 0 on error.
+int SimplifyMesh(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint32_t index_count, uint32_t target_index_count,
+    float max_error, uint32_t *out, uint32_t *out_index_count,
+    float *out_error);
+
+// Builds a chain of up to MAX_LOD_COUNT LODs for the given mesh, each with
+// roughly half as many triangles as the one before it. LOD 0 is the original
+// list of indices. Stops early once a LOD can't be simplified much further.
+// Sets *out_indices to a new array holding the indices of every LOD, one
+// after another, which the caller must free, and *out_index_count to its
+// length. Fills in the first *lod_count entries of lods, which must have room
+// for MAX_LOD_COUNT entries. Each simplified LOD is also reordered for the
+// vertex cache. Returns 0 on error, including if the whole chain would need
+// more than 2^32 indices.
+int BuildLODChain(const ObjectFileVertex *vertices, uint32_t vertex_count,
+    const uint32_t *indices, uint32_t index_count, uint32_t **out_indices,
+    uint32_t *out_index_count, MeshLOD *lods, int *lod_count);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_SIMPLIFY_H
@@ -0,0 +1,325 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse_obj.h"
+#include "mesh_weld.h"
+
+// Marks the end of a bucket's list, or a vertex or triangle that hasn't been
+// assigned a new index.
+#define NO_ENTRY (0xffffffff)
+
+// A spatial hash holding the vertices kept while welding. Each bucket holds a
+// list of the kept vertices whose locations fall into the cells hashing to
+// it.
+typedef struct {
+  // The first kept vertex in each bucket's list.
+  uint32_t *buckets;
+  // The next kept vertex in the same bucket's list as each kept vertex.
+  uint32_t *next;
+  // The number of buckets, minus one. The number of buckets is a power of 2.
+  uint32_t mask;
+  // The reciprocal of the cell size. If this is 0, each distinct coordinate
+  // gets its own cell.
+  double inverse_cell_size;
+  // The number of neighboring cells to search in each direction.
+  int search_radius;
+  float epsilon;
+} WeldGrid;
+
+// Returns the number of slots to use in a hash table holding up to count
+// entries: a power of 2 at least twice count, so the table stays at most half
+// full.
+static uint32_t HashTableCapacity(uint32_t count) {
+  uint32_t capacity = 16;
+  while ((capacity < count) && (capacity < 0x80000000)) capacity *= 2;
+  if (capacity < 0x80000000) capacity *= 2;
+  return capacity;
+}
+
+// Allocates and initializes g for up to vertex_count kept vertices. Returns 0
+// on error.
+static int InitializeWeldGrid(WeldGrid *g, uint32_t vertex_count,
+    float epsilon) {
+  uint32_t capacity = HashTableCapacity(vertex_count);
+  memset(g, 0, sizeof(*g));
+  g->buckets = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+  g->next = (uint32_t *) malloc(vertex_count * sizeof(uint32_t));
+  if (!g->buckets || (!g->next && (vertex_count > 0))) {
+    printf("Failed allocating vertex welding grid.\n");
+    free(g->buckets);
+    free(g->next);
+    return 0;
+  }
+  memset(g->buckets, 0xff, capacity * sizeof(uint32_t));
+  g->mask = capacity - 1;
+  g->epsilon = epsilon;
+  // An epsilon too small to take the reciprocal of can only match exact
+  // copies anyway.
+  g->inverse_cell_size = 1.0 / ((double) epsilon);
+  g->search_radius = 1;
+  if ((epsilon <= 0.0f) || isinf(g->inverse_cell_size)) {
+    g->inverse_cell_size = 0.0;
+    g->search_radius = 0;
+  }
+  return 1;
+}
+
+// Frees the buffers held by g.
+static void CleanupWeldGrid(WeldGrid *g) {
+  free(g->buckets);
+  free(g->next);
+  g->buckets = NULL;
+  g->next = NULL;
+}
+
+// Returns the coordinate of the cell containing v along one axis.
+static int32_t CellCoordinate(const WeldGrid *g, float v) {
+  double c;
+  uint32_t bits;
+  if (g->inverse_cell_size == 0.0) {
+    // Make sure -0 and 0 end up in the same cell.
+    if (v == 0.0f) v = 0.0f;
+    memcpy(&bits, &v, sizeof(bits));
+    return (int32_t) bits;
+  }
+  c = floor(((double) v) * g->inverse_cell_size);
+  // Far-away cells may be shared, which is slow but still correct.
+  if (!(c > -2147483648.0)) return INT32_MIN;
+  if (c > 2147483647.0) return INT32_MAX;
+  return (int32_t) c;
+}
+
+// Returns the bucket holding the cell at the given coordinates.
+static uint32_t CellBucket(const WeldGrid *g, int32_t x, int32_t y,
+    int32_t z) {
+  uint64_t h = (((uint64_t) ((uint32_t) x)) << 32) | ((uint32_t) y);
+  h *= 0x9e3779b97f4a7c15ull;
+  h ^= ((uint32_t) z) * 0xc2b2ae3d27d4eb4full;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 32;
+  return ((uint32_t) h) & g->mask;
+}
+
+// Returns nonzero if each of the first n values in a is within epsilon of the
+// same value in b.
+static int WithinEpsilon(const float *a, const float *b, int n,
+    float epsilon) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (!(fabsf(a[i] - b[i]) <= epsilon)) return 0;
+  }
+  return 1;
+}
+
+// Searches g for kept vertices near v. Sets *full_match to the earliest one
+// whose location, normal, and UV coordinates all match v's, and
+// *location_match to the earliest one whose location matches v's. Either is
+// set to NO_ENTRY if there's no such vertex.
+static void FindWeldMatches(const WeldGrid *g, const ObjectFileVertex *kept,
+    const ObjectFileVertex *v, uint32_t *full_match,
+    uint32_t *location_match) {
+  const ObjectFileVertex *k = NULL;
+  int32_t cell[3];
+  uint32_t i;
+  int x, y, z, r = g->search_radius;
+  *full_match = NO_ENTRY;
+  *location_match = NO_ENTRY;
+  for (i = 0; i < 3; i++) cell[i] = CellCoordinate(g, v->location[i]);
+  for (x = -r; x <= r; x++) {
+    for (y = -r; y <= r; y++) {
+      for (z = -r; z <= r; z++) {
+        // The cell coordinates may wrap at the edges, which only costs some
+        // extra comparisons.
+        i = g->buckets[CellBucket(g, (int32_t) ((uint32_t) cell[0] + x),
+          (int32_t) ((uint32_t) cell[1] + y),
+          (int32_t) ((uint32_t) cell[2] + z))];
+        for (; i != NO_ENTRY; i = g->next[i]) {
+          k = kept + i;
+          if (!WithinEpsilon(k->location, v->location, 3, g->epsilon)) {
+            continue;
+          }
+          if (i < *location_match) *location_match = i;
+          // The normal and UV coordinates are the last 5 floats.
+          if ((i < *full_match) && WithinEpsilon(k->data + 3, v->data + 3, 5,
+            g->epsilon)) {
+            *full_match = i;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Adds kept vertex i to g.
+static void InsertIntoWeldGrid(WeldGrid *g, const ObjectFileVertex *kept,
+    uint32_t i) {
+  const float *l = kept[i].location;
+  uint32_t bucket = CellBucket(g, CellCoordinate(g, l[0]),
+    CellCoordinate(g, l[1]), CellCoordinate(g, l[2]));
+  g->next[i] = g->buckets[bucket];
+  g->buckets[bucket] = i;
+}
+
+int WeldVertices(ObjectFileVertex *vertices, uint32_t *vertex_count,
+    uint32_t *indices, uint64_t index_count, float epsilon,
+    uint32_t *vertex_groups) {
+  WeldGrid g;
+  uint32_t *new_index = NULL;
+  uint32_t i, full_match, location_match, count = *vertex_count, kept = 0;
+  uint64_t j;
+  if (!(epsilon >= 0.0f)) {
+    printf("Invalid vertex welding epsilon: %f\n", epsilon);
+    return 0;
+  }
+  new_index = (uint32_t *) malloc(count * sizeof(uint32_t));
+  if (!new_index && (count > 0)) {
+    printf("Failed allocating welded vertex indices.\n");
+    return 0;
+  }
+  if (!InitializeWeldGrid(&g, count, epsilon)) {
+    free(new_index);
+    return 0;
+  }
+  // Kept vertices are always moved to an index no later than their own, so
+  // this never overwrites a vertex that hasn't been visited yet.
+  for (i = 0; i < count; i++) {
+    FindWeldMatches(&g, vertices, vertices + i, &full_match, &location_match);
+    if (full_match != NO_ENTRY) {
+      new_index[i] = full_match;
+      continue;
+    }
+    vertices[kept] = vertices[i];
+    if (vertex_groups) vertex_groups[kept] = vertex_groups[i];
+    if (location_match != NO_ENTRY) {
+      memcpy(vertices[kept].location, vertices[location_match].location,
+        3 * sizeof(float));
+      if (vertex_groups) vertex_groups[kept] = vertex_groups[location_match];
+    }
+    InsertIntoWeldGrid(&g, vertices, kept);
+    new_index[i] = kept;
+    kept++;
+  }
+  for (j = 0; j < index_count; j++) {
+    indices[j] = new_index[indices[j]];
+  }
+  *vertex_count = kept;
+  CleanupWeldGrid(&g);
+  free(new_index);
+  return 1;
+}
+
+// Returns nonzero if the triangle with the given indices should be dropped
+// for being degenerate. See RemoveDegenerateTriangles.
+static int IsDegenerate(const ObjectFileVertex *vertices, const uint32_t *t,
+    float epsilon) {
+  const float *p0 = vertices[t[0]].location;
+  const float *p1 = vertices[t[1]].location;
+  const float *p2 = vertices[t[2]].location;
+  double e01[3], e02[3], e12[3], n[3], longest, d;
+  int i;
+  if ((t[0] == t[1]) || (t[0] == t[2]) || (t[1] == t[2])) return 1;
+  for (i = 0; i < 3; i++) {
+    e01[i] = ((double) p1[i]) - p0[i];
+    e02[i] = ((double) p2[i]) - p0[i];
+    e12[i] = ((double) p2[i]) - p1[i];
+  }
+  n[0] = e01[1] * e02[2] - e01[2] * e02[1];
+  n[1] = e01[2] * e02[0] - e01[0] * e02[2];
+  n[2] = e01[0] * e02[1] - e01[1] * e02[0];
+  longest = e01[0] * e01[0] + e01[1] * e01[1] + e01[2] * e01[2];
+  d = e02[0] * e02[0] + e02[1] * e02[1] + e02[2] * e02[2];
+  if (d > longest) longest = d;
+  d = e12[0] * e12[0] + e12[1] * e12[1] + e12[2] * e12[2];
+  if (d > longest) longest = d;
+  // The length of n is twice the area, which is the longest edge's length
+  // times the height over it.
+  return sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) <=
+    (epsilon * sqrt(longest));
+}
+
+// Copies triangle t to out, rotated so the smallest index comes first. This
+// keeps the winding, so two triangles are the same if their rotated indices
+// are.
+static void RotateTriangle(const uint32_t *t, uint32_t *out) {
+  int first = 0;
+  if (t[1] < t[first]) first = 1;
+  if (t[2] < t[first]) first = 2;
+  out[0] = t[first];
+  out[1] = t[(first + 1) % 3];
+  out[2] = t[(first + 2) % 3];
+}
+
+// Returns a hash of a rotated triangle's indices.
+static uint32_t HashTriangle(const uint32_t *t) {
+  uint64_t h = (((uint64_t) t[0]) << 32) | t[1];
+  h *= 0x9e3779b97f4a7c15ull;
+  h ^= t[2] * 0xc2b2ae3d27d4eb4full;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 32;
+  return (uint32_t) h;
+}
+
+int RemoveDegenerateTriangles(const ObjectFileVertex *vertices,
+    uint32_t *indices, uint32_t *index_count, float epsilon) {
+  uint32_t *slots = NULL;
+  uint32_t rotated[3], other[3];
+  uint32_t i, slot, mask, capacity, kept = 0;
+  uint32_t triangle_count = *index_count / 3;
+  capacity = HashTableCapacity(triangle_count);
+  mask = capacity - 1;
+  // Holds the index of each kept triangle, so duplicates can be found.
+  slots = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+  if (!slots) {
+    printf("Failed allocating duplicate triangle table.\n");
+    return 0;
+  }
+  memset(slots, 0xff, capacity * sizeof(uint32_t));
+  for (i = 0; i < triangle_count; i++) {
+    if (IsDegenerate(vertices, indices + 3 * i, epsilon)) continue;
+    RotateTriangle(indices + 3 * i, rotated);
+    slot = HashTriangle(rotated) & mask;
+    while (slots[slot] != NO_ENTRY) {
+      RotateTriangle(indices + 3 * slots[slot], other);
+      if (memcmp(rotated, other, sizeof(rotated)) == 0) break;
+      slot = (slot + 1) & mask;
+    }
+    if (slots[slot] != NO_ENTRY) continue;
+    slots[slot] = kept;
+    memmove(indices + 3 * kept, indices + 3 * i, 3 * sizeof(uint32_t));
+    kept++;
+  }
+  *index_count = kept * 3;
+  free(slots);
+  return 1;
+}
+
+int RemoveUnusedVertices(ObjectFileVertex *vertices, uint32_t *vertex_count,
+    uint32_t *indices, uint64_t index_count, uint32_t *vertex_groups) {
+  uint32_t *new_index = NULL;
+  uint32_t i, count = *vertex_count, kept = 0;
+  uint64_t j;
+  new_index = (uint32_t *) malloc(count * sizeof(uint32_t));
+  if (!new_index && (count > 0)) {
+    printf("Failed allocating vertex compaction indices.\n");
+    return 0;
+  }
+  if (count > 0) memset(new_index, 0xff, count * sizeof(uint32_t));
+  for (j = 0; j < index_count; j++) new_index[indices[j]] = 0;
+  for (i = 0; i < count; i++) {
+    if (new_index[i] == NO_ENTRY) continue;
+    new_index[i] = kept;
+    vertices[kept] = vertices[i];
+    if (vertex_groups) vertex_groups[kept] = vertex_groups[i];
+    kept++;
+  }
+  for (j = 0; j < index_count; j++) {
+    indices[j] = new_index[indices[j]];
+  }
+  *vertex_count = kept;
+  free(new_index);
+  return 1;
+}
@@ -0,0 +1,47 @@
+// Defines functions for cleaning up meshes exported with redundant data:
+// merging vertices that are only different due to rounding, and removing
+// triangles that can't contribute anything when drawn.
+#ifndef OPENGL_TUTORIAL_MESH_WELD_H
+#define OPENGL_TUTORIAL_MESH_WELD_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "parse_obj.h"
+
+// Merges vertices whose locations, normals, and UV coordinates are all within
+// epsilon of each other's on every axis, using a spatial hash with cells
+// epsilon wide. An epsilon of 0 only merges exact copies. Vertices are
+// visited in order, and each one is merged into the earliest matching vertex
+// kept so far. A vertex that doesn't match any kept vertex is kept, but if
+// its location is within epsilon of a kept vertex, it's snapped to that
+// location so no cracks open between them. The kept vertices are moved to the
+// start of the array, in their original order, *vertex_count is updated, and
+// the indices are rewritten to use them. If vertex_groups isn't NULL, it
+// holds a group for each vertex, as used by GenerateSmoothNormals, and is
+// compacted along with the vertices. Vertices snapped to another's location
+// take that vertex's group. Returns 0 on error.
+int WeldVertices(ObjectFileVertex *vertices, uint32_t *vertex_count,
+    uint32_t *indices, uint64_t index_count, float epsilon,
+    uint32_t *vertex_groups);
+
+// Removes degenerate and duplicate triangles from the given list of indices,
+// keeping the remaining triangles in order, and updates *index_count. A
+// triangle is degenerate if it uses the same vertex more than once, or if its
+// height over its longest edge is at most epsilon. A triangle is a duplicate
+// if an earlier triangle uses the same vertices with the same winding.
+// Returns 0 on error.
+int RemoveDegenerateTriangles(const ObjectFileVertex *vertices,
+    uint32_t *indices, uint32_t *index_count, float epsilon);
+
+// Removes vertices that aren't used by any index, keeping the remaining ones
+// in order, updates *vertex_count, and rewrites the indices to match. If
+// vertex_groups isn't NULL, it's compacted along with the vertices. Returns 0
+// on error.
+int RemoveUnusedVertices(ObjectFileVertex *vertices, uint32_t *vertex_count,
+    uint32_t *indices, uint64_t index_count, uint32_t *vertex_groups);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_MESH_WELD_H
@@ -1,9 +1,15 @@
+#include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
+#include "mesh_cache.h"
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
 #include "parse_obj.h"
 #define STBI_NO_PSD
 #define STBI_NO_TGA
@@ -14,6 +20,7 @@
 #include "stb_image.h"
 #include "shader_program.h"
 #include "utilities.h"
+#include "vertex_quantization.h"
 
 #include "model.h"
 
@@ -63,76 +70,526 @@ static GLuint LoadTexture(const char *filename) {
   return to_return;
 }
 
-Mesh* LoadMesh(const char *object_file_path, int texture_count, ...) {
-  va_list args;
-  ObjectFileInfo *object = NULL;
+// Returns the size of a single vertex in m's position-only vertex buffer.
+// Compact positions are padded to 4 unorm16 values to keep each one aligned.
+static size_t DepthVertexSize(Mesh *m) {
+  if (m->compact_vertices) return 4 * sizeof(uint16_t);
+  return 3 * sizeof(float);
+}
+
+// Allocates size bytes for the buffer bound to target, and maps all of it for
+// writing. The old contents are invalidated, so the driver doesn't need to
+// preserve them or wait for the GPU. Allocates at least a few bytes, since an
+// empty range can't be mapped. Returns NULL on error.
+static void* MapNewBuffer(GLenum target, size_t size) {
+  void *to_return = NULL;
+  if (size < 16) size = 16;
+  glBufferData(target, size, NULL, GL_STATIC_DRAW);
+  to_return = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT |
+    GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (!to_return) {
+    printf("Failed mapping a new %lu-byte buffer.\n", (unsigned long) size);
+    CheckGLErrors();
+  }
+  return to_return;
+}
+
+// Unmaps the buffer bound to target. Returns 0 if the buffer's contents were
+// lost while it was mapped, which can happen if the display mode changes.
+static int UnmapNewBuffer(GLenum target) {
+  if (glUnmapBuffer(target)) return 1;
+  printf("Mapped buffer contents were lost while uploading a mesh.\n");
+  return 0;
+}
+
+// Creates m's position-only vertex buffer, with room for the given number of
+// vertices in the format given by DepthVertexSize, and maps it. The buffer
+// is bound to GL_COPY_WRITE_BUFFER, so it can be mapped at the same time as
+// the main vertex buffer. Returns NULL on error.
+static void* MapDepthVertexBuffer(Mesh *m, uint32_t vertex_count) {
+  glGenBuffers(1, &(m->depth_vertex_buffer));
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m->depth_vertex_buffer);
+  return MapNewBuffer(GL_COPY_WRITE_BUFFER, ((size_t) vertex_count) *
+    DepthVertexSize(m));
+}
+
+// The number of vertices UploadCompactVertices quantizes at a time. This
+// keeps the staging buffer small enough to stay in the cache.
+#define QUANTIZATION_CHUNK_SIZE (4096)
+
+// Quantizes the vertices, followed by the added_count added_vertices, and
+// writes them to the currently bound GL_ARRAY_BUFFER, and to m's
+// position-only vertex buffer if the options ask for one. Mapped buffers may
+// be uncached, so they're never read from; the vertices are quantized into a
+// small staging buffer a chunk at a time, which is then copied over, so the
+// full mesh is never copied in system memory. The added vertices are copies
+// of other vertices, so they don't affect the quantization parameters. Fills
+// in m's quantization fields. Returns 0 on error.
+static int UploadCompactVertices(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, const ObjectFileVertex *added_vertices,
+    uint32_t added_count, const MeshLoadOptions *options, Mesh *m) {
+  QuantizedVertex *chunk = NULL, *mapped = NULL;
+  QuantizationError error, chunk_error;
+  const ObjectFileVertex *source = NULL;
+  uint16_t *depth_positions = NULL, *p = NULL;
+  uint32_t total_count = vertex_count + added_count;
+  uint32_t start, count, i;
+  int to_return = 0;
+  m->compact_vertices = 1;
+  ComputeQuantizationParams(vertices, vertex_count, &(m->quantization));
+  memset(&error, 0, sizeof(error));
+  chunk = (QuantizedVertex *) malloc(QUANTIZATION_CHUNK_SIZE *
+    sizeof(QuantizedVertex));
+  if (!chunk) {
+    printf("Failed allocating compact vertex staging buffer.\n");
+    return 0;
+  }
+  mapped = (QuantizedVertex *) MapNewBuffer(GL_ARRAY_BUFFER,
+    ((size_t) total_count) * sizeof(QuantizedVertex));
+  if (!mapped) goto cleanup;
+  if (options->build_depth_stream) {
+    depth_positions = (uint16_t *) MapDepthVertexBuffer(m, total_count);
+    if (!depth_positions) goto cleanup;
+  }
+  for (start = 0; start < total_count; start += count) {
+    // Chunks don't straddle the end of the input vertices, so each one comes
+    // from a single array.
+    if (start < vertex_count) {
+      source = vertices + start;
+      count = vertex_count - start;
+    } else {
+      source = added_vertices + (start - vertex_count);
+      count = total_count - start;
+    }
+    if (count > QUANTIZATION_CHUNK_SIZE) count = QUANTIZATION_CHUNK_SIZE;
+    QuantizeVerticesWithParams(source, count, &(m->quantization), chunk);
+    MeasureQuantizationError(source, chunk, count, &(m->quantization),
+      &chunk_error);
+    CombineQuantizationErrors(&error, &chunk_error);
+    memcpy(mapped + start, chunk, count * sizeof(QuantizedVertex));
+    if (!depth_positions) continue;
+    p = depth_positions + ((size_t) start) * 4;
+    for (i = 0; i < count; i++) {
+      memcpy(p + 4 * i, chunk[i].position, 3 * sizeof(uint16_t));
+      p[4 * i + 3] = 0;
+    }
+  }
+  if (!CheckQuantizationError(&error)) {
+    printf("Warning: compact vertices exceed the error tolerance. Max "
+      "position error: %g, normal error: %g degrees, UV error: %g\n",
+      error.max_relative_position_error, error.max_normal_error_degrees,
+      error.max_relative_uv_error);
+  }
+  to_return = 1;
+cleanup:
+  if (mapped && !UnmapNewBuffer(GL_ARRAY_BUFFER)) to_return = 0;
+  if (depth_positions && !UnmapNewBuffer(GL_COPY_WRITE_BUFFER)) {
+    to_return = 0;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  free(chunk);
+  return to_return;
+}
+
+// Uploads the vertices, followed by the added_count added_vertices made by
+// SplitIndices, to the currently bound GL_ARRAY_BUFFER and sets up the vertex
+// attributes for them, either as-is or in the compact QuantizedVertex format.
+// Fills in m's compact_vertices and quantization fields. If
+// build_depth_stream is set in the options, also creates and fills in m's
+// depth_vertex_buffer, holding only the positions in the same format. Data is
+// written straight into mapped buffers rather than staged in system memory,
+// except for uncompacted vertices, which are already in their final format.
+// Those are passed straight from the object, which may be the mapped cache
+// file, to glBufferData, or to glBufferSubData along with any added vertices,
+// without being copied. Returns 0 on error.
+static int SetupVertexAttributes(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, const ObjectFileVertex *added_vertices,
+    uint32_t added_count, const MeshLoadOptions *options, Mesh *m) {
+  const ObjectFileVertex *v = NULL;
+  size_t size = ((size_t) vertex_count) * sizeof(ObjectFileVertex);
+  float *positions = NULL;
+  uint32_t i;
+  if (!options->compact_vertices) {
+    if (added_count == 0) {
+      glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
+    } else {
+      glBufferData(GL_ARRAY_BUFFER, size + ((size_t) added_count) *
+        sizeof(ObjectFileVertex), NULL, GL_STATIC_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices);
+      glBufferSubData(GL_ARRAY_BUFFER, size, ((size_t) added_count) *
+        sizeof(ObjectFileVertex), added_vertices);
+    }
+    if (options->build_depth_stream) {
+      positions = (float *) MapDepthVertexBuffer(m, vertex_count +
+        added_count);
+      if (!positions) return 0;
+      for (i = 0; i < (vertex_count + added_count); i++) {
+        v = (i < vertex_count) ? (vertices + i) : (added_vertices + (i -
+          vertex_count));
+        memcpy(positions + ((size_t) i) * 3, v->location, 3 * sizeof(float));
+      }
+      if (!UnmapNewBuffer(GL_COPY_WRITE_BUFFER)) return 0;
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
+      (void *) offsetof(ObjectFileVertex, location));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
+      (void *) offsetof(ObjectFileVertex, normal));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
+      (void *) offsetof(ObjectFileVertex, uv));
+    return 1;
+  }
+
+  if (!UploadCompactVertices(vertices, vertex_count, added_vertices,
+    added_count, options, m)) {
+    return 0;
+  }
+  // The normalized attributes are converted to [0, 1] or [-1, 1] floats, and
+  // the vertex shader takes care of the rest.
+  glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+    sizeof(QuantizedVertex), (void *) offsetof(QuantizedVertex, position));
+  glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+    (void *) offsetof(QuantizedVertex, normal));
+  glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+    sizeof(QuantizedVertex), (void *) offsetof(QuantizedVertex, uv));
+  return 1;
+}
+
+// Splits the triangles into ranges that can use 16-bit indices. The vertices
+// themselves aren't copied; split only holds the few that some ranges need
+// duplicated, which go after them in the vertex buffer. Sets
+// *use_short_indices to 0 if so many would be duplicated that the extra
+// vertex data outweighs the savings from the smaller indices, in which case
+// the mesh should keep its 32-bit indices and split is left empty. This is
+// decided before any vertices are duplicated. Returns 0 on error.
+static int SplitIndices(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, const uint32_t *indices, uint32_t index_count,
+    ShortIndexMesh *split, int *use_short_indices) {
+  uint64_t saved_bytes = ((uint64_t) index_count) * (sizeof(GLuint) -
+    sizeof(uint16_t));
+  *use_short_indices = 0;
+  if (!SplitInto16BitRanges(vertices, vertex_count, sizeof(ObjectFileVertex),
+    indices, index_count, saved_bytes / sizeof(ObjectFileVertex), split)) {
+    printf("Failed splitting the mesh into 16-bit index ranges.\n");
+    return 0;
+  }
+  *use_short_indices = (split->ranges != NULL);
+  return 1;
+}
+
+// Uploads the indices to the currently bound GL_ELEMENT_ARRAY_BUFFER, and
+// fills in m's index_type and draw_ranges. Uses the 16-bit indices in split
+// if use_short_indices is nonzero, and the given 32-bit indices otherwise.
+// Returns 0 on error.
+static int SetupElementBuffer(const uint32_t *indices, uint32_t index_count,
+    ShortIndexMesh *split, int use_short_indices, Mesh *m) {
+  if (use_short_indices) {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, split->index_count *
+      sizeof(uint16_t), split->indices, GL_STATIC_DRAW);
+    m->index_type = GL_UNSIGNED_SHORT;
+    // The mesh takes ownership of the ranges.
+    m->draw_ranges = split->ranges;
+    m->draw_range_count = split->range_count;
+    split->ranges = NULL;
+    return 1;
+  }
+  m->draw_ranges = (IndexRange *) calloc(1, sizeof(IndexRange));
+  if (!m->draw_ranges) {
+    printf("Failed allocating index range.\n");
+    return 0;
+  }
+  m->draw_ranges->index_count = index_count;
+  m->draw_range_count = 1;
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLuint), indices,
+    GL_STATIC_DRAW);
+  m->index_type = GL_UNSIGNED_INT;
+  return 1;
+}
+
+// Copies the object's sub-mesh table to m. Returns 0 on error.
+static int SetupSubMeshes(const CachedObjectFile *object, Mesh *m) {
+  // A file without faces has no sub-meshes.
+  if (object->sub_mesh_count == 0) return 1;
+  m->sub_meshes = (ObjectFileSubMesh *) malloc(object->sub_mesh_count *
+    sizeof(ObjectFileSubMesh));
+  if (!m->sub_meshes) {
+    printf("Failed allocating sub-mesh list.\n");
+    return 0;
+  }
+  memcpy(m->sub_meshes, object->sub_meshes, object->sub_mesh_count *
+    sizeof(ObjectFileSubMesh));
+  m->sub_mesh_count = object->sub_mesh_count;
+  return 1;
+}
+
+// Appends clusters built from sub-mesh s's indices to m's clusters. The
+// clusters' first_index values start out relative to the start of s, and are
+// adjusted to index into the full buffer. Returns 0 on error.
+static int AppendSubMeshClusters(const ObjectFileSubMesh *s,
+    MeshCluster *clusters, uint32_t cluster_count, Mesh *m) {
+  MeshCluster *new_list = NULL;
+  uint32_t i;
+  if (cluster_count == 0) return 1;
+  new_list = (MeshCluster *) realloc(m->clusters, (m->cluster_count +
+    cluster_count) * sizeof(MeshCluster));
+  if (!new_list) {
+    printf("Failed allocating cluster list.\n");
+    return 0;
+  }
+  m->clusters = new_list;
+  for (i = 0; i < cluster_count; i++) {
+    clusters[i].first_index += s->first_index;
+  }
+  memcpy(m->clusters + m->cluster_count, clusters, cluster_count *
+    sizeof(MeshCluster));
+  m->cluster_count += cluster_count;
+  return 1;
+}
+
+// Splits the object's triangles into clusters, filling in m's clusters and
+// allocating its visible_spans and cluster_visible arrays. Each of m's
+// sub-meshes is split separately, so clusters never cross between them. Sets
+// *cluster_indices to a new copy of the object's indices, reordered so each
+// cluster is contiguous, which the caller must free. Returns 0 on error.
+static int SetupClusters(const CachedObjectFile *object, Mesh *m,
+    uint32_t **cluster_indices) {
+  ObjectFileSubMesh *s = NULL;
+  MeshCluster *clusters = NULL;
+  uint32_t *indices = NULL;
+  uint32_t i, cluster_count;
+  *cluster_indices = NULL;
+  indices = (uint32_t *) malloc(object->index_count * sizeof(uint32_t));
+  if (!indices && (object->index_count > 0)) {
+    printf("Failed allocating cluster indices.\n");
+    return 0;
+  }
+  if (object->index_count > 0) {
+    memcpy(indices, object->indices, object->index_count * sizeof(uint32_t));
+  }
+  for (i = 0; i < m->sub_mesh_count; i++) {
+    s = m->sub_meshes + i;
+    if (!BuildClusters(object->vertices, object->vertex_count, indices +
+      s->first_index, s->index_count, &clusters, &cluster_count)) {
+      printf("Failed building clusters.\n");
+      free(indices);
+      return 0;
+    }
+    if (!AppendSubMeshClusters(s, clusters, cluster_count, m)) {
+      free(clusters);
+      free(indices);
+      return 0;
+    }
+    free(clusters);
+  }
+  m->visible_spans = (MeshDrawSpan *) malloc(m->cluster_count *
+    sizeof(MeshDrawSpan));
+  m->cluster_visible = (uint8_t *) malloc(m->cluster_count);
+  if ((!m->visible_spans || !m->cluster_visible) && (m->cluster_count > 0)) {
+    printf("Failed allocating visible cluster list.\n");
+    free(indices);
+    return 0;
+  }
+  *cluster_indices = indices;
+  return 1;
+}
+
+// Fills in m's lods, either with a chain of simplified LODs or with a single
+// LOD covering every index. LOD 0 uses the given indices, which may differ
+// from the object's if it was split into clusters. If LODs are generated,
+// *lod_indices is set to a new buffer holding every LOD's indices, which the
+// caller must free. Otherwise it's left NULL. Also sets m's radius. Returns 0
+// on error.
+static int SetupLODs(const CachedObjectFile *object, const uint32_t *indices,
+    const MeshLoadOptions *options, Mesh *m, uint32_t **lod_indices,
+    uint32_t *lod_index_count) {
+  MeshLOD lods[MAX_LOD_COUNT];
+  const float *v = NULL;
+  float d, radius = 0.0f;
+  uint32_t i;
+  int lod_count = 1;
+  *lod_indices = NULL;
+  *lod_index_count = 0;
+  for (i = 0; i < object->vertex_count; i++) {
+    v = object->vertices[i].location;
+    d = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    if (d > radius) radius = d;
+  }
+  m->radius = sqrtf(radius);
+  lods[0].first_index = 0;
+  lods[0].index_count = object->index_count;
+  lods[0].error = 0.0f;
+  if (options->generate_lods) {
+    if (!BuildLODChain(object->vertices, object->vertex_count, indices,
+      object->index_count, lod_indices, lod_index_count, lods, &lod_count)) {
+      printf("Failed generating LODs.\n");
+      return 0;
+    }
+  }
+  m->lods = (MeshLOD *) malloc(lod_count * sizeof(MeshLOD));
+  if (!m->lods) {
+    printf("Failed allocating LOD list.\n");
+    free(*lod_indices);
+    *lod_indices = NULL;
+    return 0;
+  }
+  memcpy(m->lods, lods, lod_count * sizeof(MeshLOD));
+  m->lod_count = lod_count;
+  return 1;
+}
+
+// Points the instanced vertex attributes at the instance transforms starting
+// with the given instance. Requires the mesh's VAO and instanced vertex buffer
+// to be bound.
+static void SetInstanceAttributePointers(size_t first_instance) {
+  size_t offset = first_instance * sizeof(ModelAndNormal);
+  int i;
+  // First, a mat4 using four attribute locations (for the model matrix)
+  for (i = 0; i < 4; i++) {
+    // Note that the stride needs to skip an entire ModelAndNormal. This
+    // assumes that each row in the mat4 is exactly sizeof(vec4).
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(ModelAndNormal),
+      (void *) (offset + i * sizeof(vec4) + offsetof(ModelAndNormal, model)));
+  }
+  // Next, a mat3 using three locations (for the normal matrix)
+  for (i = 0; i < 3; i++) {
+    // Like for the model matrices. Assumes that each row in the mat3 is
+    // exactly 3 * sizeof(float).
+    glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, sizeof(ModelAndNormal),
+      (void *) (offset + i * sizeof(vec3) + offsetof(ModelAndNormal,
+      normal)));
+  }
+}
+
+// Creates m's position-only vertex array, using the depth_vertex_buffer
+// filled in by SetupVertexAttributes. Shares the element buffer and instanced
+// vertex buffer with the main vertex array, but only the model matrix is
+// used. Returns 0 on error.
+static int SetupDepthVertexArray(Mesh *m) {
+  GLsizei stride = (GLsizei) DepthVertexSize(m);
+  int i;
+  glGenVertexArrays(1, &(m->depth_vertex_array));
+  glBindVertexArray(m->depth_vertex_array);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->element_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, m->depth_vertex_buffer);
+  if (m->compact_vertices) {
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, NULL);
+  } else {
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, NULL);
+  }
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, m->instanced_vertex_buffer);
+  SetInstanceAttributePointers(0);
+  for (i = 3; i < 7; i++) {
+    glEnableVertexAttribArray(i);
+    glVertexAttribDivisor(i, 1);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  if (!CheckGLErrors()) {
+    printf("Error setting up position-only vertex array.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Implements LoadMeshWithOptions, taking the texture paths as a va_list.
+static Mesh* LoadMeshV(const char *object_file_path,
+    const MeshLoadOptions *options, int texture_count, va_list args) {
+  CachedObjectFile object;
+  ShortIndexMesh split;
+  const ObjectFileVertex *added_vertices = NULL;
+  const uint32_t *indices = NULL;
+  uint32_t *lod_indices = NULL, *cluster_indices = NULL;
+  uint32_t added_vertex_count = 0, index_count = 0;
+  int use_short_indices = 0;
   GLuint *textures = NULL;
   GLuint vao = 0, vbo = 0, ebo = 0, instanced_vbo = 0;
   const char *image_path = NULL;
-  char *object_file_content = NULL;
   int i = 0;
   Mesh *to_return = NULL;
-  object_file_content = (char *) ReadFullFile(object_file_path);
-  if (!object_file_content) {
-    printf("Failed object file from %s\n", object_file_path);
+  memset(&split, 0, sizeof(split));
+  // This only parses the object file if its binary cache is missing or out of
+  // date. Otherwise, the vertices and indices point into the mapped cache.
+  if (!LoadCachedObjFile(object_file_path, &object)) {
+    printf("Failed loading object file %s\n", object_file_path);
     return NULL;
   }
-  object = ParseObjFile(object_file_content);
-  free(object_file_content);
-  object_file_content = NULL;
-  if (!object) {
-    printf("Failed parsing object file %s\n", object_file_path);
+  // Sub-meshes keep each draw call within 32 bits, but the rest of the mesh
+  // setup, such as clusters and LODs, works on the whole index buffer.
+  if (object.index_count > UINT32_MAX) {
+    printf("Object file %s has too many indices (%llu) to draw.\n",
+      object_file_path, (unsigned long long) object.index_count);
+    FreeCachedObjFile(&object);
+    return NULL;
+  }
+  to_return = (Mesh *) calloc(1, sizeof(Mesh));
+  if (!to_return) {
+    printf("Failed allocating mesh struct.\n");
+    FreeCachedObjFile(&object);
     return NULL;
   }
+  if (!SetupSubMeshes(&object, to_return)) goto error_cleanup;
+  indices = object.indices;
+  if (options->build_clusters) {
+    if (!SetupClusters(&object, to_return, &cluster_indices)) {
+      goto error_cleanup;
+    }
+    indices = cluster_indices;
+  }
+  if (!SetupLODs(&object, indices, options, to_return, &lod_indices,
+    &index_count)) {
+    goto error_cleanup;
+  }
+  if (lod_indices) {
+    indices = lod_indices;
+  } else {
+    index_count = object.index_count;
+  }
+  if (!SplitIndices(object.vertices, object.vertex_count, indices,
+    index_count, &split, &use_short_indices)) {
+    goto error_cleanup;
+  }
+  if (use_short_indices) {
+    added_vertices = (const ObjectFileVertex *) split.added_vertices;
+    added_vertex_count = split.added_vertex_count;
+  }
   // Next try loading the textures.
   textures = (GLuint *) calloc(texture_count, sizeof(GLuint));
   if (!textures) {
     printf("Failed allocating textures handle buffer.\n");
-    FreeObjectFileInfo(object);
-    return NULL;
+    goto error_cleanup;
   }
-  va_start(args, texture_count);
   for (i = 0; i < texture_count; i++) {
     image_path = va_arg(args, const char *);
     textures[i] = LoadTexture(image_path);
     if (!textures[i]) goto error_cleanup;
   }
-  va_end(args);
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
   // Set up the element buffer.
   glGenBuffers(1, &ebo);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, object->index_count * sizeof(GLuint),
-    object->indices, GL_STATIC_DRAW);
-  // Set up the vertex buffer.
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, object->vertex_count *
-    sizeof(ObjectFileVertex), object->vertices, GL_STATIC_DRAW);
+  if (!SetupElementBuffer(indices, index_count, &split, use_short_indices,
+    to_return)) {
+    goto error_cleanup;
+  }
   // Set up the instanced transform buffer.
   glGenBuffers(1, &instanced_vbo);
-
   if (!CheckGLErrors()) {
-    printf("Failed setting up element and vertex buffers.\n");
-    goto error_cleanup;
-  }
-  to_return = (Mesh *) calloc(1, sizeof(Mesh));
-  if (!to_return) {
-    printf("Failed allocating mesh struct.\n");
+    printf("Failed setting up element buffer.\n");
     goto error_cleanup;
   }
 
-  // Set up the position, normal, and texture coordinate attributes.
+  // Set up the vertex buffer, and the position, normal, and texture
+  // coordinate attributes.
+  glGenBuffers(1, &vbo);
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
-    (void *) offsetof(ObjectFileVertex, location));
+  if (!SetupVertexAttributes(object.vertices, object.vertex_count,
+    added_vertices, added_vertex_count, options, to_return)) {
+    goto error_cleanup;
+  }
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
-    (void *) offsetof(ObjectFileVertex, normal));
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ObjectFileVertex),
-    (void *) offsetof(ObjectFileVertex, uv));
   glEnableVertexAttribArray(2);
   if (!CheckGLErrors()) {
     printf("Error setting up mesh attributes.\n");
@@ -141,23 +598,12 @@ Mesh* LoadMesh(const char *object_file_path, int texture_count, ...) {
 
   // Set up the instanced vertex buffer.
   glBindBuffer(GL_ARRAY_BUFFER, instanced_vbo);
-  // First, a mat4 using four attribute locations (for the model matrix)
-  for (i = 0; i < 4; i++) {
-    // Note that the stride needs to skip an entire ModelAndNormal. This
-    // assumes that each row in the mat4 is exactly sizeof(vec4).
-    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(ModelAndNormal),
-      (void *) (i * sizeof(vec4) + offsetof(ModelAndNormal, model)));
-    glEnableVertexAttribArray(3 + i);
-    glVertexAttribDivisor(3 + i, 1);
-  }
-  // Next, a mat3 using three locations (for the normal matrix)
-  for (i = 0; i < 3; i++) {
-    // Like for the model matrices. Assumes that each row in the mat3 is
-    // exactly 3 * sizeof(float).
-    glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, sizeof(ModelAndNormal),
-      (void *) (i * sizeof(vec3) + offsetof(ModelAndNormal, normal)));
-    glEnableVertexAttribArray(7 + i);
-    glVertexAttribDivisor(7 + i, 1);
+  SetInstanceAttributePointers(0);
+  // The model matrix uses locations 3 through 6, and the normal matrix uses 7
+  // through 9.
+  for (i = 3; i < 10; i++) {
+    glEnableVertexAttribArray(i);
+    glVertexAttribDivisor(i, 1);
   }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   if (!CheckGLErrors()) {
@@ -171,8 +617,18 @@ Mesh* LoadMesh(const char *object_file_path, int texture_count, ...) {
   to_return->vertex_buffer = vbo;
   to_return->instanced_vertex_buffer = instanced_vbo;
   to_return->element_buffer = ebo;
-  to_return->element_count = object->index_count;
-  FreeObjectFileInfo(object);
+  to_return->element_count = object.index_count;
+  glm_vec3_copy(object.bounds.min, to_return->bounding_box[0]);
+  glm_vec3_copy(object.bounds.max, to_return->bounding_box[1]);
+  glm_vec3_copy(object.bounds.center, to_return->bounding_sphere);
+  to_return->bounding_sphere[3] = object.bounds.radius;
+  if (to_return->depth_vertex_buffer && !SetupDepthVertexArray(to_return)) {
+    goto error_cleanup;
+  }
+  free(lod_indices);
+  free(cluster_indices);
+  FreeShortIndexMesh(&split);
+  FreeCachedObjFile(&object);
   return to_return;
 
 error_cleanup:
@@ -180,29 +636,94 @@ error_cleanup:
   glDeleteBuffers(1, &ebo);
   glDeleteBuffers(1, &vbo);
   glDeleteBuffers(1, &instanced_vbo);
+  glDeleteVertexArrays(1, &(to_return->depth_vertex_array));
+  glDeleteBuffers(1, &(to_return->depth_vertex_buffer));
+  free(to_return->draw_ranges);
+  free(to_return->lods);
+  free(to_return->sub_meshes);
+  free(to_return->clusters);
+  free(to_return->visible_spans);
+  free(to_return->cluster_visible);
   free(to_return);
   if (textures) {
     glDeleteTextures(texture_count, textures);
     free(textures);
   }
-  FreeObjectFileInfo(object);
+  free(lod_indices);
+  free(cluster_indices);
+  FreeShortIndexMesh(&split);
+  FreeCachedObjFile(&object);
   return NULL;
 }
 
+Mesh* LoadMesh(const char *object_file_path, int texture_count, ...) {
+  MeshLoadOptions options;
+  va_list args;
+  Mesh *to_return = NULL;
+  memset(&options, 0, sizeof(options));
+  va_start(args, texture_count);
+  to_return = LoadMeshV(object_file_path, &options, texture_count, args);
+  va_end(args);
+  return to_return;
+}
+
+Mesh* LoadMeshWithOptions(const char *object_file_path,
+    const MeshLoadOptions *options, int texture_count, ...) {
+  va_list args;
+  Mesh *to_return = NULL;
+  va_start(args, texture_count);
+  to_return = LoadMeshV(object_file_path, options, texture_count, args);
+  va_end(args);
+  return to_return;
+}
+
 void DestroyMesh(Mesh *mesh) {
   if (!mesh) return;
   glDeleteTextures(mesh->texture_count, mesh->textures);
   free(mesh->textures);
   glDeleteBuffers(1, &(mesh->element_buffer));
+  free(mesh->draw_ranges);
+  free(mesh->lods);
+  free(mesh->sub_meshes);
+  free(mesh->clusters);
+  free(mesh->visible_spans);
+  free(mesh->cluster_visible);
+  free(mesh->instances);
+  free(mesh->sorted_instances);
   glDeleteBuffers(1, &(mesh->vertex_buffer));
   glDeleteBuffers(1, &(mesh->instanced_vertex_buffer));
   glDeleteVertexArrays(1, &(mesh->vertex_array));
+  glDeleteBuffers(1, &(mesh->depth_vertex_buffer));
+  glDeleteVertexArrays(1, &(mesh->depth_vertex_array));
   DestroyShaderProgram(mesh->shader_program);
   memset(mesh, 0, sizeof(*mesh));
   free(mesh);
 }
 
 int SetInstanceTransforms(Mesh *m, int instance_count, ModelAndNormal *data) {
+  ModelAndNormal *instances = NULL, *sorted = NULL;
+  // Meshes with LODs keep a copy of the transforms, so DrawMesh can sort them
+  // by LOD. Meshes with clusters need them for CullMeshClusters.
+  int keep_copy = (m->lod_count > 1) || (m->cluster_count > 0);
+  if (keep_copy && (m->instance_count != instance_count)) {
+    instances = (ModelAndNormal *) malloc(instance_count *
+      sizeof(ModelAndNormal));
+    sorted = (ModelAndNormal *) malloc(instance_count *
+      sizeof(ModelAndNormal));
+    if (!instances || !sorted) {
+      printf("Failed allocating instance transform copies.\n");
+      free(instances);
+      free(sorted);
+      return 0;
+    }
+    free(m->instances);
+    free(m->sorted_instances);
+    m->instances = instances;
+    m->sorted_instances = sorted;
+  }
+  if (keep_copy) {
+    memcpy(m->instances, data, instance_count * sizeof(ModelAndNormal));
+  }
   glBindBuffer(GL_ARRAY_BUFFER, m->instanced_vertex_buffer);
   if (m->instance_count == instance_count) {
     glBufferSubData(GL_ARRAY_BUFFER, 0, instance_count *
@@ -216,9 +737,219 @@ int SetInstanceTransforms(Mesh *m, int instance_count, ModelAndNormal *data) {
   return CheckGLErrors();
 }
 
-int DrawMesh(Mesh *m) {
+void SetMeshCamera(Mesh *m, vec3 position, mat4 projection,
+    int viewport_height) {
+  glm_vec3_copy(position, m->camera_position);
+  // projection[1][1] is 1 / tan(fov / 2), so this is the number of pixels
+  // covered by 1 unit at a distance of 1.
+  m->pixels_per_unit = projection[1][1] * ((float) viewport_height) * 0.5f;
+  m->camera_set = 1;
+}
+
+// Sets the uniforms the vertex shader in p uses to dequantize m's compact
+// vertices. For meshes with float vertices, these leave the vertices
+// unchanged. Shaders without these uniforms are only supported for meshes
+// with float vertices.
+static void SetDequantizationUniforms(Mesh *m, ShaderProgram *p) {
+  QuantizationParams identity;
+  QuantizationParams *q = &(m->quantization);
+  if (!m->compact_vertices) {
+    memset(&identity, 0, sizeof(identity));
+    identity.position_scale[0] = 1.0f;
+    identity.position_scale[1] = 1.0f;
+    identity.position_scale[2] = 1.0f;
+    identity.uv_scale[0] = 1.0f;
+    identity.uv_scale[1] = 1.0f;
+    q = &identity;
+  }
+  // Setting a uniform at location -1 is silently ignored.
+  glUniform3fv(p->position_offset_uniform, 1, q->position_offset);
+  glUniform3fv(p->position_scale_uniform, 1, q->position_scale);
+  glUniform2fv(p->uv_offset_uniform, 1, q->uv_offset);
+  glUniform2fv(p->uv_scale_uniform, 1, q->uv_scale);
+  glUniform1i(p->octahedral_normals_uniform, m->compact_vertices);
+}
+
+// Draws the given range of the element buffer with the given number of
+// instances, issuing a draw call for each part of the range in a different
+// draw range. Requires the mesh's VAO to be bound.
+static void DrawSpan(Mesh *m, uint32_t first_index, uint32_t index_count,
+    int instance_count) {
+  IndexRange *r = NULL;
+  size_t index_size;
+  uint32_t start, end;
+  int i;
+  index_size = (m->index_type == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) :
+    sizeof(GLuint);
+  for (i = 0; i < m->draw_range_count; i++) {
+    r = m->draw_ranges + i;
+    start = r->first_index;
+    if (start < first_index) start = first_index;
+    end = r->first_index + r->index_count;
+    if (end > (first_index + index_count)) end = first_index + index_count;
+    if (start >= end) continue;
+    if (instance_count > 1) {
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, end - start,
+        m->index_type, (void *) (start * index_size), instance_count,
+        r->base_vertex);
+    } else {
+      glDrawElementsBaseVertex(GL_TRIANGLES, end - start, m->index_type,
+        (void *) (start * index_size), r->base_vertex);
+    }
+  }
+}
+
+// Draws the triangles in the given LOD with the given number of instances.
+// If CullMeshClusters has been called, LOD 0 only draws the clusters that may
+// be visible. Requires the mesh's VAO to be bound.
+static void DrawLOD(Mesh *m, int lod, int instance_count) {
+  MeshDrawSpan *span = NULL;
+  uint32_t i;
+  if ((lod != 0) || !m->culling_active) {
+    DrawSpan(m, m->lods[lod].first_index, m->lods[lod].index_count,
+      instance_count);
+    return;
+  }
+  for (i = 0; i < m->visible_span_count; i++) {
+    span = m->visible_spans + i;
+    DrawSpan(m, span->first_index, span->index_count, instance_count);
+  }
+}
+
+// Returns nonzero if the given transform preserves angles and winding order:
+// a rotation, translation, and uniform scale. Backface culling in object
+// space only works for these.
+static int PreservesAngles(mat4 model) {
+  float x = glm_vec3_norm(model[0]);
+  float y = glm_vec3_norm(model[1]);
+  float z = glm_vec3_norm(model[2]);
+  float tolerance = 1e-3f * x;
+  mat3 upper;
+  if ((fabsf(x - y) > tolerance) || (fabsf(x - z) > tolerance)) return 0;
+  if ((fabsf(glm_vec3_dot(model[0], model[1])) > tolerance * x) ||
+    (fabsf(glm_vec3_dot(model[0], model[2])) > tolerance * x) ||
+    (fabsf(glm_vec3_dot(model[1], model[2])) > tolerance * x)) {
+    return 0;
+  }
+  glm_mat4_pick3(model, upper);
+  return glm_mat3_det(upper) > 0.0f;
+}
+
+void CullMeshClusters(Mesh *m, mat4 view_projection, vec3 camera_position) {
+  vec4 planes[6], camera, object_camera;
+  mat4 mvp, inverse;
+  MeshCluster *c = NULL;
+  MeshDrawSpan *span = NULL;
+  float *camera_in_object = NULL;
+  uint32_t i;
+  int j;
+  if ((m->cluster_count == 0) || (m->instance_count == 0)) return;
+  glm_vec4(camera_position, 1.0f, camera);
+  memset(m->cluster_visible, 0, m->cluster_count);
+  for (j = 0; j < m->instance_count; j++) {
+    // The planes and camera are moved into the mesh's object space, so the
+    // cluster bounds can be used as they are.
+    glm_mat4_mul(view_projection, m->instances[j].model, mvp);
+    glm_frustum_planes(mvp, planes);
+    camera_in_object = NULL;
+    if (PreservesAngles(m->instances[j].model)) {
+      glm_mat4_inv(m->instances[j].model, inverse);
+      glm_mat4_mulv(inverse, camera, object_camera);
+      camera_in_object = object_camera;
+    }
+    for (i = 0; i < m->cluster_count; i++) {
+      if (m->cluster_visible[i]) continue;
+      m->cluster_visible[i] = ClusterVisible(m->clusters + i, planes,
+        camera_in_object);
+    }
+  }
+  // Build the list of visible ranges, merging adjacent clusters.
+  m->visible_span_count = 0;
+  span = m->visible_spans;
+  for (i = 0; i < m->cluster_count; i++) {
+    if (!m->cluster_visible[i]) continue;
+    c = m->clusters + i;
+    if ((m->visible_span_count > 0) && ((span->first_index +
+      span->index_count) == c->first_index)) {
+      span->index_count += c->index_count;
+      continue;
+    }
+    span = m->visible_spans + m->visible_span_count;
+    span->first_index = c->first_index;
+    span->index_count = c->index_count;
+    m->visible_span_count++;
+  }
+  m->culling_active = 1;
+}
+
+// Returns the LOD to use for the given instance: the simplest one whose error
+// covers at most MAX_LOD_PIXEL_ERROR pixels on screen.
+static int ChooseLOD(Mesh *m, ModelAndNormal *instance) {
+  float scale = 0.0f, length, distance, error_pixels;
+  vec3 translation;
+  int i;
+  // Use the largest scale along any axis, so the result is conservative.
+  for (i = 0; i < 3; i++) {
+    length = glm_vec3_norm(instance->model[i]);
+    if (length > scale) scale = length;
+  }
+  glm_vec3_copy(instance->model[3], translation);
+  distance = glm_vec3_distance(translation, m->camera_position) - m->radius *
+    scale;
+  if (distance <= 0.0f) return 0;
+  for (i = m->lod_count - 1; i > 0; i--) {
+    error_pixels = m->lods[i].error * scale * m->pixels_per_unit / distance;
+    if (error_pixels <= MAX_LOD_PIXEL_ERROR) return i;
+  }
+  return 0;
+}
+
+// Sorts the instances by LOD, uploads them in that order, and draws each
+// group of instances using the same LOD. Requires the mesh's VAO to be bound.
+static void DrawInstancesByLOD(Mesh *m) {
+  int counts[MAX_LOD_COUNT], starts[MAX_LOD_COUNT];
+  int i, lod;
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < m->instance_count; i++) {
+    counts[ChooseLOD(m, m->instances + i)]++;
+  }
+  starts[0] = 0;
+  for (i = 1; i < m->lod_count; i++) {
+    starts[i] = starts[i - 1] + counts[i - 1];
+  }
+  for (i = 0; i < m->instance_count; i++) {
+    lod = ChooseLOD(m, m->instances + i);
+    m->sorted_instances[starts[lod]] = m->instances[i];
+    starts[lod]++;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, m->instanced_vertex_buffer);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, m->instance_count *
+    sizeof(ModelAndNormal), m->sorted_instances);
+  for (i = 0; i < m->lod_count; i++) {
+    if (counts[i] == 0) continue;
+    // After the loop above, starts[i] is the end of LOD i's instances.
+    SetInstanceAttributePointers(starts[i] - counts[i]);
+    DrawLOD(m, i, counts[i]);
+  }
+  SetInstanceAttributePointers(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Draws every instance of the mesh, each using the LOD picked for it. Requires
+// one of the mesh's VAOs to be bound.
+static void DrawInstances(Mesh *m) {
+  if ((m->lod_count > 1) && m->camera_set && (m->instance_count > 0)) {
+    DrawInstancesByLOD(m);
+  } else {
+    DrawLOD(m, 0, m->instance_count);
+  }
+}
+
+// Sets up the mesh's shader, uniforms, textures, and VAO for drawing.
+static void PrepareToDraw(Mesh *m) {
   int i = 0;
   glUseProgram(m->shader_program->shader_program);
+  SetDequantizationUniforms(m, m->shader_program);
   // Set up the textures.
   for (i = 0; i < m->texture_count; i++) {
     glUniform1i(m->shader_program->texture_uniform_indices[i], i);
@@ -227,12 +958,52 @@ int DrawMesh(Mesh *m) {
   }
   glActiveTexture(GL_TEXTURE0);
   glBindVertexArray(m->vertex_array);
-  if (m->instance_count > 1) {
-    glDrawElementsInstanced(GL_TRIANGLES, m->element_count, GL_UNSIGNED_INT, 0,
-      m->instance_count);
-  } else {
-    glDrawElements(GL_TRIANGLES, m->element_count, GL_UNSIGNED_INT, 0);
+}
+
+int DrawMesh(Mesh *m) {
+  PrepareToDraw(m);
+  DrawInstances(m);
+  return CheckGLErrors();
+}
+
+int DrawMeshPart(Mesh *m, uint32_t sub_mesh) {
+  ObjectFileSubMesh *s = NULL;
+  MeshDrawSpan *span = NULL;
+  uint32_t i, start, end;
+  if (sub_mesh >= m->sub_mesh_count) {
+    printf("Invalid sub-mesh %u in a mesh with %u.\n", (unsigned) sub_mesh,
+      (unsigned) m->sub_mesh_count);
+    return 0;
+  }
+  s = m->sub_meshes + sub_mesh;
+  PrepareToDraw(m);
+  if (!m->culling_active) {
+    DrawSpan(m, s->first_index, s->index_count, m->instance_count);
+    return CheckGLErrors();
+  }
+  // Only draw the parts of the visible spans within the sub-mesh.
+  for (i = 0; i < m->visible_span_count; i++) {
+    span = m->visible_spans + i;
+    start = span->first_index;
+    if (start < s->first_index) start = s->first_index;
+    end = span->first_index + span->index_count;
+    if (end > (s->first_index + s->index_count)) {
+      end = s->first_index + s->index_count;
+    }
+    if (start >= end) continue;
+    DrawSpan(m, start, end - start, m->instance_count);
   }
   return CheckGLErrors();
 }
 
+int DrawMeshDepth(Mesh *m, ShaderProgram *depth_program) {
+  glUseProgram(depth_program->shader_program);
+  SetDequantizationUniforms(m, depth_program);
+  if (m->depth_vertex_array) {
+    glBindVertexArray(m->depth_vertex_array);
+  } else {
+    glBindVertexArray(m->vertex_array);
+  }
+  DrawInstances(m);
+  return CheckGLErrors();
+}
@@ -6,7 +6,14 @@ extern "C" {
 #include <stdarg.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
 #include "shader_program.h"
+#include "vertex_quantization.h"
+
+// The largest error, in pixels, allowed when picking an instance's LOD.
+#define MAX_LOD_PIXEL_ERROR (1.0f)
 
 // Holds a model and normal matrix for a single instance of a model.
 typedef struct {
@@ -14,6 +21,12 @@ typedef struct {
   mat3 normal;
 } ModelAndNormal;
 
+// A range of indices in a mesh's element buffer.
+typedef struct {
+  uint32_t first_index;
+  uint32_t index_count;
+} MeshDrawSpan;
+
 // Holds a single 3D model along with its associated textures. The contents of
 // this struct should not be modified by the user.
 typedef struct {
@@ -29,16 +42,95 @@ typedef struct {
   GLuint instanced_vertex_buffer;
   GLuint element_buffer;
   GLuint element_count;
+  // If the mesh was loaded with build_depth_stream, a vertex array whose
+  // vertex buffer holds nothing but the vertices' positions, in the same
+  // format as the main vertex buffer. Both are 0 otherwise.
+  GLuint depth_vertex_array;
+  GLuint depth_vertex_buffer;
+  // The type of the indices in the element buffer: GL_UNSIGNED_SHORT or
+  // GL_UNSIGNED_INT.
+  GLenum index_type;
+  // The ranges of the element buffer to draw, each with its own base vertex.
+  // Meshes with 32-bit indices, or with at most 65536 vertices, only have one
+  // range.
+  IndexRange *draw_ranges;
+  int draw_range_count;
+  // The levels of detail in the element buffer, from most to least detailed.
+  // Meshes loaded without generate_lods only have one.
+  MeshLOD *lods;
+  int lod_count;
+  // The distance from the mesh's origin to its farthest vertex.
+  float radius;
+  // The mesh's bounds in object space, in the forms used by cglm's box and
+  // sphere functions: the minimum and maximum corners of the axis-aligned
+  // box, and a sphere's center and radius.
+  vec3 bounding_box[2];
+  vec4 bounding_sphere;
+  // The objects and groups in the mesh's file, as ranges of LOD 0's indices.
+  // Clusters never cross from one to another, so each can be drawn on its own
+  // using DrawMeshPart.
+  ObjectFileSubMesh *sub_meshes;
+  uint32_t sub_mesh_count;
+  // The clusters making up LOD 0, if the mesh was loaded with
+  // build_clusters. They appear in the element buffer in this order.
+  MeshCluster *clusters;
+  uint32_t cluster_count;
+  // Set by CullMeshClusters: the ranges of LOD 0 containing clusters that
+  // may be visible, with adjacent clusters merged into one range. If
+  // culling_active is 0, all of LOD 0 is drawn.
+  MeshDrawSpan *visible_spans;
+  uint32_t visible_span_count;
+  int culling_active;
+  // Space for CullMeshClusters to mark each cluster as visible or not.
+  uint8_t *cluster_visible;
+  // If the mesh has more than one LOD or has clusters, this holds a copy of
+  // the instance transforms, and space to sort them by LOD.
+  ModelAndNormal *instances;
+  ModelAndNormal *sorted_instances;
+  // Set by SetMeshCamera. If camera_set is 0, every instance uses LOD 0.
+  int camera_set;
+  vec3 camera_position;
+  // The height, in pixels, of an object 1 unit tall at a distance of 1 unit.
+  float pixels_per_unit;
   // The number of instances of this to draw.
   int instance_count;
+  // Nonzero if the vertex buffer holds QuantizedVertex structs rather than
+  // ObjectFileVertex structs. If so, quantization holds the values the
+  // vertex shader needs to dequantize them.
+  int compact_vertices;
+  QuantizationParams quantization;
 } Mesh;
 
+// Options controlling how LoadMeshWithOptions loads a mesh. A zero-initialized
+// struct selects the default behavior.
+typedef struct {
+  // If nonzero, store the vertices in the 16-byte QuantizedVertex format
+  // rather than as 32-byte ObjectFileVertex structs. Prints a warning if this
+  // introduces more error than the tolerances in vertex_quantization.h.
+  int compact_vertices;
+  // If nonzero, generate a chain of simplified LODs for the mesh. DrawMesh
+  // picks one for each instance, based on how large it appears from the
+  // camera given to SetMeshCamera.
+  int generate_lods;
+  // If nonzero, split the mesh's triangles into clusters with bounds that
+  // CullMeshClusters can use to skip parts of the mesh that can't be seen.
+  int build_clusters;
+  // If nonzero, also build a tightly packed, position-only copy of the
+  // vertex buffer, so DrawMeshDepth doesn't fetch normals and UVs.
+  int build_depth_stream;
+} MeshLoadOptions;
+
 // Creates a mesh from the given object file. Also takes the number of textures
 // and the corresponding number of paths to texture images. Returns NULL on
 // error. The returned mesh must be passed to DestroyMesh when no longer
 // needed.
 Mesh* LoadMesh(const char *object_file_path, int texture_count, ...);
 
+// The same as LoadMesh, but takes a set of options. The options must not be
+// NULL.
+Mesh* LoadMeshWithOptions(const char *object_file_path,
+    const MeshLoadOptions *options, int texture_count, ...);
+
 // Sets the instance_count field of m, and updates the instanced VBO. Requires
 // an array of ModelAndNormal structs, one per instance. Returns 0 on error.
 int SetInstanceTransforms(Mesh *m, int instance_count, ModelAndNormal *data);
@@ -49,11 +141,38 @@ int SetInstanceTransforms(Mesh *m, int instance_count, ModelAndNormal *data);
 // function returns 0 on error.
 int SetShaderProgram(Mesh *m, const char *vert_src, const char *frag_src);
 
+// Sets the camera used to pick each instance's LOD: its position, its
+// projection matrix, and the height of the viewport in pixels. Only affects
+// meshes loaded with generate_lods. Each instance uses the simplest LOD whose
+// error would be at most MAX_LOD_PIXEL_ERROR pixels on screen.
+void SetMeshCamera(Mesh *m, vec3 position, mat4 projection,
+    int viewport_height);
+
+// Decides which of the mesh's clusters may be visible from a camera with the
+// given combined projection and view matrix and position, in world space, and
+// makes DrawMesh skip the rest when drawing LOD 0. A cluster is skipped if it
+// is outside the view frustum or faces away from the camera for every
+// instance. Must be called again whenever the camera or instances move. Does
+// nothing for meshes loaded without build_clusters.
+void CullMeshClusters(Mesh *m, mat4 view_projection, vec3 camera_position);
+
 // Draws the mesh. Returns 0 on error, including if any GL errors occurs, or if
 // SetInstanceTransforms hasn't been called to create some instances of the
 // mesh.
 int DrawMesh(Mesh *m);
 
+// Draws a single object or group in the mesh, given by its index in
+// m->sub_meshes, with the mesh's shader. Always uses LOD 0, skipping any
+// clusters CullMeshClusters found to be invisible. Returns 0 on error.
+int DrawMeshPart(Mesh *m, uint32_t sub_mesh);
+
+// Draws the mesh into the depth buffer only, using depth_program, which must
+// compute gl_Position exactly the same way as the mesh's own shader; see
+// depth_only.vert. Uses the same LODs and visible clusters as DrawMesh, so a
+// later DrawMesh with glDepthFunc(GL_EQUAL) shades each pixel only once. Uses
+// the position-only vertex array if the mesh has one. Returns 0 on error.
+int DrawMeshDepth(Mesh *m, ShaderProgram *depth_program);
+
 // Frees any resources associated with the mesh, along with the mesh struct
 // itself. The mesh pointer is invalid after passing it to this.
 void DestroyMesh(Mesh *mesh);
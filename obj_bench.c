@@ -0,0 +1,788 @@
+// This defines a standalone benchmark for the .obj parser. It generates large
+// synthetic .obj files in memory: wavy grids and subdivided icospheres, each
+// with and without normals and UV coordinates. Each file is parsed using
+// several sets of options, and each set of options gets one line of CSV
+// output holding the time spent in each phase of parsing, the throughput in
+// MB/s and vertices per second, and the process's peak resident set size.
+// The peak RSS includes the generated file itself, which is also reported on
+// its own as the RSS before parsing.
+//
+// Usage: ./obj_bench [size in MB (default 64)] [iterations (default 3)]
+//     [output CSV path (default obj_bench.csv)]
+//
+// Passing --huge instead runs a correctness check of files too large for
+// 32-bit sizes and offsets, rather than a benchmark. It writes a file of the
+// given size to the given path, parses it by mapping it into memory and by
+// streaming it, and deletes it afterwards. This needs a 64-bit system and
+// that much free disk space, and takes a while, so it's opt-in.
+//
+// Usage: ./obj_bench --huge <path> [size in MB (default 4200)]
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "parse_obj.h"
+#include "thread_pool.h"
+
+// The tree engine is far slower than the others, so only benchmark it on
+// files up to this size.
+#define MAX_TREE_BENCHMARK_MB (16.0)
+
+// Flags for the optional attributes written by the generators.
+#define BENCH_NORMALS (1)
+#define BENCH_UVS (2)
+
+// The grid size and icosphere subdivision level used to estimate how large
+// each generated file is per vertex.
+#define SAMPLE_GRID_SIZE (64)
+#define SAMPLE_ICOSPHERE_LEVEL (3)
+
+#define GOLDEN_RATIO (1.6180339887f)
+
+// The default size of the file written by --huge, in MB. It must be over
+// 4 GB, so that sizes and offsets within it don't fit in 32 bits.
+#define DEFAULT_HUGE_FILE_MB (4200.0)
+
+// The width of the grid written by --huge, which is kept small so the file is
+// nearly all padding, and the length of each padding comment line.
+#define HUGE_FILE_GRID_SIZE (256)
+#define PADDING_LINE_LENGTH (128)
+
+// Holds a growable, null-terminated string.
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+} StringBuilder;
+
+// Generates a .obj file with the given attributes. The size parameter is the
+// grid's width or the icosphere's subdivision level. Returns 0 on error.
+typedef int (*GeneratorFunction)(int size, int attributes, StringBuilder *b);
+
+// Describes one set of parser options to benchmark.
+typedef struct {
+  const char *name;
+  int count_first;
+  // If 0, use one thread per CPU.
+  int thread_count;
+  ObjDedupEngine dedup_engine;
+  // If nonzero, feed the file to a stream parser in chunks of this size.
+  size_t stream_chunk_size;
+  // If nonzero, generate normals (for files without them) and tangents.
+  int generate_normals;
+  // If nonzero, weld vertices, only merging exact copies.
+  int weld_vertices;
+  // If nonzero, back the parser's temporary buffers with huge pages.
+  int use_huge_pages;
+  // If nonzero, optimize the output for the vertex cache and vertex fetches.
+  int optimize_vertices;
+} BenchmarkConfig;
+
+// Holds the results of the fastest of several runs with one config.
+typedef struct {
+  ObjParseTimings timings;
+  double total;
+  uint32_t vertex_count;
+  uint64_t triangle_count;
+  long rss_before_kb;
+  long peak_rss_kb;
+  ObjParseMemoryUsage memory_usage;
+} BenchmarkResult;
+
+static const BenchmarkConfig configs[] = {
+  {"count_first", 1, 1, OBJ_DEDUP_HASH, 0, 0, 0, 0, 0},
+  {"single_pass", 0, 1, OBJ_DEDUP_HASH, 0, 0, 0, 0, 0},
+  {"threaded_hash", 0, 0, OBJ_DEDUP_HASH, 0, 0, 0, 0, 0},
+  {"threaded_sort", 0, 0, OBJ_DEDUP_SORT, 0, 0, 0, 0, 0},
+  {"threaded_tree", 0, 0, OBJ_DEDUP_TREE, 0, 0, 0, 0, 0},
+  {"stream_64k", 0, 1, OBJ_DEDUP_HASH, 64 * 1024, 0, 0, 0, 0},
+  {"threaded_normals", 0, 0, OBJ_DEDUP_HASH, 0, 1, 0, 0, 0},
+  {"threaded_weld", 0, 0, OBJ_DEDUP_HASH, 0, 0, 1, 0, 0},
+  {"threaded_thp", 0, 0, OBJ_DEDUP_HASH, 0, 0, 0, 1, 0},
+  {"threaded_optimize", 0, 0, OBJ_DEDUP_HASH, 0, 0, 0, 0, 1},
+};
+#define CONFIG_COUNT (sizeof(configs) / sizeof(configs[0]))
+
+// Returns the current time, in seconds.
+static double CurrentSeconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double) t.tv_sec) + (((double) t.tv_nsec) / 1e9);
+}
+
+// Resets the process's peak resident set size to its current size, so the
+// next call to GetPeakRSS only covers what happens after this. This only
+// works on Linux; elsewhere the peak covers the entire process.
+static void ResetPeakRSS(void) {
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (!f) return;
+  fputs("5", f);
+  fclose(f);
+}
+
+// Returns the value, in KB, of the given field in /proc/self/status, or -1
+// if it isn't available.
+static long ReadProcStatusKB(const char *field) {
+  char line[256];
+  size_t field_length = strlen(field);
+  long to_return = -1;
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f) return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, field, field_length) != 0) continue;
+    if (line[field_length] != ':') continue;
+    to_return = atol(line + field_length + 1);
+    break;
+  }
+  fclose(f);
+  return to_return;
+}
+
+// Returns the process's peak resident set size, in KB.
+static long GetPeakRSS(void) {
+  struct rusage usage;
+  long to_return = ReadProcStatusKB("VmHWM");
+  if (to_return >= 0) return to_return;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+  return usage.ru_maxrss;
+}
+
+// Appends the printf-style formatted string to b. Returns 0 on error.
+static int AppendFormatted(StringBuilder *b, const char *format, ...) {
+  va_list args;
+  char *new_data = NULL;
+  size_t new_capacity;
+  int length;
+  // None of the lines we generate come anywhere close to this.
+  if ((b->capacity - b->size) < 256) {
+    new_capacity = b->capacity ? (b->capacity * 2) : (1024 * 1024);
+    new_data = (char *) realloc(b->data, new_capacity);
+    if (!new_data) {
+      printf("Failed growing generated obj file to %lu bytes.\n",
+        (unsigned long) new_capacity);
+      return 0;
+    }
+    b->data = new_data;
+    b->capacity = new_capacity;
+  }
+  va_start(args, format);
+  length = vsnprintf(b->data + b->size, b->capacity - b->size, format, args);
+  va_end(args);
+  if ((length < 0) || (((size_t) length) >= (b->capacity - b->size))) {
+    printf("Failed formatting generated obj file line.\n");
+    return 0;
+  }
+  b->size += length;
+  return 1;
+}
+
+// Appends the lines for a single vertex, with the given attributes, to b.
+// Returns 0 on error.
+static int AppendVertex(StringBuilder *b, const float *location,
+    const float *normal, const float *uv, int attributes) {
+  if (!AppendFormatted(b, "v %f %f %f\n", location[0], location[1],
+    location[2])) {
+    return 0;
+  }
+  if ((attributes & BENCH_UVS) && !AppendFormatted(b, "vt %f %f\n", uv[0],
+    uv[1])) {
+    return 0;
+  }
+  if ((attributes & BENCH_NORMALS) && !AppendFormatted(b, "vn %f %f %f\n",
+    normal[0], normal[1], normal[2])) {
+    return 0;
+  }
+  return 1;
+}
+
+// Appends a face to b. The vertices are numbered from 0, and each vertex's
+// location, normal, and UV coordinate all share its number. Returns 0 on
+// error.
+static int AppendTriangle(StringBuilder *b, uint32_t a, uint32_t c,
+    uint32_t d, int attributes) {
+  // The indices in the file start at 1.
+  unsigned long x = a + 1, y = c + 1, z = d + 1;
+  switch (attributes & (BENCH_NORMALS | BENCH_UVS)) {
+  case BENCH_NORMALS | BENCH_UVS:
+    return AppendFormatted(b, "f %lu/%lu/%lu %lu/%lu/%lu %lu/%lu/%lu\n", x, x,
+      x, y, y, y, z, z, z);
+  case BENCH_NORMALS:
+    return AppendFormatted(b, "f %lu//%lu %lu//%lu %lu//%lu\n", x, x, y, y, z,
+      z);
+  case BENCH_UVS:
+    return AppendFormatted(b, "f %lu/%lu %lu/%lu %lu/%lu\n", x, x, y, y, z,
+      z);
+  }
+  return AppendFormatted(b, "f %lu %lu %lu\n", x, y, z);
+}
+
+// Generates a wavy square grid of n x n vertices as .obj file content.
+// Returns 0 on error.
+static int GenerateGrid(int n, int attributes, StringBuilder *b) {
+  float location[3], normal[3], uv[2];
+  int x, y;
+  uint32_t a, c, d, e;
+  if (!AppendFormatted(b, "# Generated by obj_bench\no Grid\n")) return 0;
+  normal[0] = 0.0f;
+  normal[1] = 1.0f;
+  normal[2] = 0.0f;
+  for (y = 0; y < n; y++) {
+    for (x = 0; x < n; x++) {
+      uv[0] = ((float) x) / ((float) (n - 1));
+      uv[1] = ((float) y) / ((float) (n - 1));
+      location[0] = uv[0] * 2.0f - 1.0f;
+      location[1] = 0.05f * ((float) ((x * 7 + y * 13) % 11));
+      location[2] = uv[1] * 2.0f - 1.0f;
+      if (!AppendVertex(b, location, normal, uv, attributes)) return 0;
+    }
+  }
+  for (y = 0; y < (n - 1); y++) {
+    for (x = 0; x < (n - 1); x++) {
+      a = y * n + x;
+      c = a + 1;
+      d = a + n;
+      e = d + 1;
+      if (!AppendTriangle(b, a, d, c, attributes)) return 0;
+      if (!AppendTriangle(b, c, d, e, attributes)) return 0;
+    }
+  }
+  return 1;
+}
+
+// Holds the state used to subdivide an icosphere.
+typedef struct {
+  float *locations;
+  uint32_t location_count;
+  uint32_t *triangles;
+  uint32_t triangle_count;
+  // Maps each edge, as a pair of vertex numbers packed into a 64-bit key, to
+  // the vertex at its midpoint. Uses open addressing; unused slots have a key
+  // of 0, which never refers to a real edge since its vertices differ.
+  uint64_t *edge_keys;
+  uint32_t *edge_midpoints;
+  uint32_t edge_capacity;
+} Icosphere;
+
+// Returns the vertex at the midpoint of the edge between vertices a and c,
+// projected onto the unit sphere, adding it if it doesn't exist yet.
+static uint32_t GetMidpoint(Icosphere *s, uint32_t a, uint32_t c) {
+  uint64_t key;
+  uint32_t slot, tmp;
+  float *v = NULL, length;
+  int i;
+  if (a > c) {
+    tmp = a;
+    a = c;
+    c = tmp;
+  }
+  key = (((uint64_t) a) << 32) | c;
+  slot = ((uint32_t) ((key * 0x9e3779b97f4a7c15ull) >> 32)) &
+    (s->edge_capacity - 1);
+  while (s->edge_keys[slot] != 0) {
+    if (s->edge_keys[slot] == key) return s->edge_midpoints[slot];
+    slot = (slot + 1) & (s->edge_capacity - 1);
+  }
+  v = s->locations + 3 * s->location_count;
+  for (i = 0; i < 3; i++) {
+    v[i] = (s->locations[3 * a + i] + s->locations[3 * c + i]) * 0.5f;
+  }
+  length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  for (i = 0; i < 3; i++) v[i] /= length;
+  s->edge_keys[slot] = key;
+  s->edge_midpoints[slot] = s->location_count;
+  s->location_count++;
+  return s->edge_midpoints[slot];
+}
+
+// Splits each of the icosphere's triangles into four, using the memory that
+// was already allocated for the next level. Returns 0 on error.
+static int SubdivideIcosphere(Icosphere *s, uint32_t *new_triangles) {
+  uint32_t i, *t = NULL, *out = NULL, ab, bc, ca;
+  // A closed mesh has 1.5 edges per triangle; keep the table half full.
+  s->edge_capacity = 1;
+  while (s->edge_capacity < (s->triangle_count * 3)) s->edge_capacity *= 2;
+  s->edge_keys = (uint64_t *) calloc(s->edge_capacity, sizeof(uint64_t));
+  s->edge_midpoints = (uint32_t *) malloc(s->edge_capacity *
+    sizeof(uint32_t));
+  if (!s->edge_keys || !s->edge_midpoints) {
+    printf("Failed allocating icosphere edge table.\n");
+    free(s->edge_keys);
+    free(s->edge_midpoints);
+    return 0;
+  }
+  for (i = 0; i < s->triangle_count; i++) {
+    t = s->triangles + 3 * i;
+    out = new_triangles + 12 * i;
+    ab = GetMidpoint(s, t[0], t[1]);
+    bc = GetMidpoint(s, t[1], t[2]);
+    ca = GetMidpoint(s, t[2], t[0]);
+    out[0] = t[0];
+    out[1] = ab;
+    out[2] = ca;
+    out[3] = t[1];
+    out[4] = bc;
+    out[5] = ab;
+    out[6] = t[2];
+    out[7] = ca;
+    out[8] = bc;
+    out[9] = ab;
+    out[10] = bc;
+    out[11] = ca;
+  }
+  free(s->edge_keys);
+  free(s->edge_midpoints);
+  s->edge_keys = NULL;
+  s->edge_midpoints = NULL;
+  free(s->triangles);
+  s->triangles = new_triangles;
+  s->triangle_count *= 4;
+  return 1;
+}
+
+// Generates a unit icosphere, made by subdividing an icosahedron the given
+// number of times, as .obj file content. Returns 0 on error.
+static int GenerateIcosphere(int level, int attributes, StringBuilder *b) {
+  // The icosahedron's vertices are at the corners of three orthogonal golden
+  // rectangles.
+  static const float base_locations[12 * 3] = {
+    -1, GOLDEN_RATIO, 0, 1, GOLDEN_RATIO, 0,
+    -1, -GOLDEN_RATIO, 0, 1, -GOLDEN_RATIO, 0,
+    0, -1, GOLDEN_RATIO, 0, 1, GOLDEN_RATIO,
+    0, -1, -GOLDEN_RATIO, 0, 1, -GOLDEN_RATIO,
+    GOLDEN_RATIO, 0, -1, GOLDEN_RATIO, 0, 1,
+    -GOLDEN_RATIO, 0, -1, -GOLDEN_RATIO, 0, 1,
+  };
+  static const uint32_t base_triangles[20 * 3] = {
+    0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+    1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+    3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+    4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1,
+  };
+  Icosphere s;
+  uint32_t *new_triangles = NULL;
+  uint64_t final_triangles = 20, final_locations;
+  float *v = NULL, length, uv[2];
+  uint32_t i;
+  int j, to_return = 0;
+  memset(&s, 0, sizeof(s));
+  for (j = 0; j < level; j++) final_triangles *= 4;
+  // Every closed triangle mesh of genus 0 has F / 2 + 2 vertices.
+  final_locations = final_triangles / 2 + 2;
+  if ((final_triangles * 3) > UINT32_MAX) {
+    printf("Icosphere level %d is too large.\n", level);
+    return 0;
+  }
+  s.locations = (float *) malloc(final_locations * 3 * sizeof(float));
+  s.triangles = (uint32_t *) malloc(20 * 3 * sizeof(uint32_t));
+  if (!s.locations || !s.triangles) {
+    printf("Failed allocating icosphere.\n");
+    goto cleanup;
+  }
+  for (i = 0; i < 12; i++) {
+    v = s.locations + 3 * i;
+    length = sqrtf(1.0f + GOLDEN_RATIO * GOLDEN_RATIO);
+    for (j = 0; j < 3; j++) v[j] = base_locations[3 * i + j] / length;
+  }
+  s.location_count = 12;
+  memcpy(s.triangles, base_triangles, sizeof(base_triangles));
+  s.triangle_count = 20;
+  for (j = 0; j < level; j++) {
+    new_triangles = (uint32_t *) malloc(s.triangle_count * 12 *
+      sizeof(uint32_t));
+    if (!new_triangles) {
+      printf("Failed allocating icosphere triangles.\n");
+      goto cleanup;
+    }
+    if (!SubdivideIcosphere(&s, new_triangles)) {
+      free(new_triangles);
+      goto cleanup;
+    }
+  }
+
+  if (!AppendFormatted(b, "# Generated by obj_bench\no Icosphere\n")) {
+    goto cleanup;
+  }
+  for (i = 0; i < s.location_count; i++) {
+    v = s.locations + 3 * i;
+    // Spherical coordinates. The seam isn't handled, since these only need
+    // to look like real UV coordinates to the parser.
+    uv[0] = 0.5f + atan2f(v[2], v[0]) / (2.0f * 3.14159265f);
+    uv[1] = 0.5f + asinf(v[1]) / 3.14159265f;
+    // On a unit sphere, each vertex's normal is the same as its location.
+    if (!AppendVertex(b, v, v, uv, attributes)) goto cleanup;
+  }
+  for (i = 0; i < s.triangle_count; i++) {
+    if (!AppendTriangle(b, s.triangles[3 * i], s.triangles[3 * i + 1],
+      s.triangles[3 * i + 2], attributes)) {
+      goto cleanup;
+    }
+  }
+  to_return = 1;
+
+cleanup:
+  free(s.locations);
+  free(s.triangles);
+  return to_return;
+}
+
+// Generates a file using the given generator, with the size parameter chosen
+// so that the file is close to target_bytes long. Grid widths can be picked
+// freely, but each icosphere level is four times as large as the last, so
+// those use the closest level. Sets *size_parameter to the value used.
+// Returns 0 on error.
+static int GenerateWithTargetSize(GeneratorFunction generate, int is_grid,
+    int attributes, double target_bytes, StringBuilder *b,
+    int *size_parameter) {
+  double scale;
+  int size = is_grid ? SAMPLE_GRID_SIZE : SAMPLE_ICOSPHERE_LEVEL;
+  // Generate a small sample first, to see how many bytes each vertex takes.
+  if (!generate(size, attributes, b)) return 0;
+  scale = target_bytes / ((double) b->size);
+  b->size = 0;
+  if (is_grid) {
+    size = (int) (((double) SAMPLE_GRID_SIZE) * sqrt(scale) + 0.5);
+    if (size < 2) size = 2;
+  } else {
+    size = SAMPLE_ICOSPHERE_LEVEL + (int) floor(log(scale) / log(4.0) + 0.5);
+    if (size < 0) size = 0;
+  }
+  *size_parameter = size;
+  return generate(size, attributes, b);
+}
+
+// Parses the content by feeding it to a stream parser, in chunks of the given
+// size. Returns NULL on error.
+static ObjectFileInfo* ParseInChunks(const char *content, size_t size,
+    size_t chunk_size, const ObjParseOptions *options) {
+  ObjStreamParser *p = CreateObjStreamParser(options);
+  size_t offset, length;
+  if (!p) return NULL;
+  for (offset = 0; offset < size; offset += length) {
+    length = size - offset;
+    if (length > chunk_size) length = chunk_size;
+    if (!FeedObjStreamParser(p, content + offset, length)) break;
+  }
+  return FinishObjStreamParser(p);
+}
+
+// Parses the content the given number of times using the given config, and
+// fills in result with the fastest run. Returns 0 on error.
+static int RunBenchmark(const char *content, size_t size,
+    const BenchmarkConfig *config, int iterations, BenchmarkResult *result) {
+  ObjParseOptions options;
+  ObjParseTimings timings;
+  ObjectFileInfo *o = NULL;
+  double start, elapsed;
+  int i;
+  memset(&options, 0, sizeof(options));
+  memset(result, 0, sizeof(*result));
+  options.count_first = config->count_first;
+  options.thread_count = config->thread_count ? config->thread_count :
+    GetCPUCount();
+  options.dedup_engine = config->dedup_engine;
+  options.generate_normals = config->generate_normals;
+  options.generate_tangents = config->generate_normals;
+  options.weld_vertices = config->weld_vertices;
+  options.use_huge_pages = config->use_huge_pages;
+  options.optimize_vertex_cache = config->optimize_vertices;
+  options.optimize_vertex_fetch = config->optimize_vertices;
+  options.timings = &timings;
+  options.memory_usage = &(result->memory_usage);
+  result->total = -1.0;
+  result->rss_before_kb = ReadProcStatusKB("VmRSS");
+  ResetPeakRSS();
+  for (i = 0; i < iterations; i++) {
+    start = CurrentSeconds();
+    if (config->stream_chunk_size) {
+      o = ParseInChunks(content, size, config->stream_chunk_size, &options);
+    } else {
+      o = ParseObjFileWithOptions(content, size, &options);
+    }
+    elapsed = CurrentSeconds() - start;
+    if (!o) {
+      printf("Failed parsing the generated obj file.\n");
+      return 0;
+    }
+    result->vertex_count = o->vertex_count;
+    result->triangle_count = o->index_count / 3;
+    FreeObjectFileInfo(o);
+    if ((result->total >= 0) && (elapsed >= result->total)) continue;
+    result->total = elapsed;
+    result->timings = timings;
+  }
+  result->peak_rss_kb = GetPeakRSS();
+  return 1;
+}
+
+// Writes a line of CSV with the given result. Returns 0 on error.
+static int WriteResult(FILE *f, const char *shape, int attributes,
+    const BenchmarkConfig *config, size_t size,
+    const BenchmarkResult *result) {
+  ObjParseTimings t = result->timings;
+  double mb = ((double) size) / (1024.0 * 1024.0);
+  int thread_count = config->thread_count ? config->thread_count :
+    GetCPUCount();
+  if (fprintf(f, "%s,%d,%d,%s,%d,%d,%lu,%lu,%llu,%.6f,%.6f,%.6f,%.6f,%.6f,"
+    "%.6f,%.6f,%.6f,%.2f,%.0f,%ld,%ld,%lu,%lu\n", shape,
+    (attributes & BENCH_NORMALS) ? 1 : 0,
+    (attributes & BENCH_UVS) ? 1 : 0, config->name, thread_count,
+    config->count_first, (unsigned long) size,
+    (unsigned long) result->vertex_count,
+    (unsigned long long) result->triangle_count, t.count, t.parse, t.dedup,
+    t.remap, t.optimize, t.weld, t.normals, result->total, mb / result->total,
+    ((double) result->vertex_count) / result->total, result->rss_before_kb,
+    result->peak_rss_kb,
+    (unsigned long) (result->memory_usage.peak_used_bytes / 1024),
+    (unsigned long) (result->memory_usage.peak_reserved_bytes / 1024)) < 0) {
+    printf("Failed writing benchmark results.\n");
+    return 0;
+  }
+  printf("  %-16s %8.1f MB/s %12.0f vertices/s, peak RSS %ld KB\n",
+    config->name, mb / result->total, ((double) result->vertex_count) /
+    result->total, result->peak_rss_kb);
+  return 1;
+}
+
+// Writes the content to a new file at path, with enough comment lines inserted
+// before the first face to pad it to at least total_bytes. The faces then come
+// after the first 4 GB of a large enough file. Returns 0 on error.
+static int WritePaddedFile(const char *path, const StringBuilder *b,
+    uint64_t total_bytes) {
+  char *padding = NULL;
+  const char *faces = strstr(b->data, "\nf ");
+  size_t head_size, padding_size = 1024 * PADDING_LINE_LENGTH, i;
+  uint64_t written;
+  FILE *f = NULL;
+  int ok = 1;
+  if (!faces) {
+    printf("The generated obj file has no faces.\n");
+    return 0;
+  }
+  head_size = faces + 1 - b->data;
+  padding = (char *) malloc(padding_size);
+  if (!padding) {
+    printf("Failed allocating padding buffer.\n");
+    return 0;
+  }
+  for (i = 0; i < padding_size; i += PADDING_LINE_LENGTH) {
+    memset(padding + i, 'x', PADDING_LINE_LENGTH - 1);
+    padding[i] = '#';
+    padding[i + PADDING_LINE_LENGTH - 1] = '\n';
+  }
+  f = fopen(path, "wb");
+  if (!f) {
+    printf("Failed opening %s\n", path);
+    free(padding);
+    return 0;
+  }
+  if (fwrite(b->data, 1, head_size, f) != head_size) ok = 0;
+  // Count the faces too, since they'll follow the padding.
+  written = b->size;
+  while (ok && (written < total_bytes)) {
+    if (fwrite(padding, 1, padding_size, f) != padding_size) ok = 0;
+    written += padding_size;
+  }
+  if (ok && (fwrite(faces + 1, 1, b->size - head_size, f) !=
+    (b->size - head_size))) {
+    ok = 0;
+  }
+  if (fclose(f) != 0) ok = 0;
+  if (!ok) printf("Failed writing %s\n", path);
+  free(padding);
+  return ok;
+}
+
+// Maps the file at path into memory and parses it with the given options.
+// Returns NULL on error.
+static ObjectFileInfo* ParseMappedFile(const char *path,
+    const ObjParseOptions *options) {
+  ObjectFileInfo *to_return = NULL;
+  struct stat info;
+  void *mapping = NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Failed opening %s\n", path);
+    return NULL;
+  }
+  if (fstat(fd, &info) != 0) {
+    printf("Failed getting the size of %s\n", path);
+    close(fd);
+    return NULL;
+  }
+  mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    printf("Failed mapping %s\n", path);
+    return NULL;
+  }
+  to_return = ParseObjFileWithOptions((const char *) mapping,
+    (size_t) info.st_size, options);
+  munmap(mapping, (size_t) info.st_size);
+  return to_return;
+}
+
+// Returns 1 if the two parsed files have the same vertices, indices, and
+// sub-meshes.
+static int SameParsedFile(const ObjectFileInfo *a, const ObjectFileInfo *b) {
+  if ((a->vertex_count != b->vertex_count) ||
+    (a->index_count != b->index_count) ||
+    (a->sub_mesh_count != b->sub_mesh_count)) {
+    return 0;
+  }
+  if (memcmp(a->vertices, b->vertices, ((size_t) a->vertex_count) *
+    sizeof(ObjectFileVertex)) != 0) {
+    return 0;
+  }
+  if (memcmp(a->indices, b->indices, ((size_t) a->index_count) *
+    sizeof(uint32_t)) != 0) {
+    return 0;
+  }
+  return memcmp(a->sub_meshes, b->sub_meshes, ((size_t) a->sub_mesh_count) *
+    sizeof(ObjectFileSubMesh)) == 0;
+}
+
+// Implements --huge: writes a padded file of at least size_mb MB to path, and
+// checks that each way of parsing it gets the same result as parsing the
+// unpadded content in memory. Returns 0 if any of them fail.
+static int RunHugeFileCheck(const char *path, double size_mb) {
+  const char *names[] = {"mmap_single", "mmap_threaded", "mmap_count_first",
+    "stream_file"};
+  ObjParseOptions options;
+  ObjectFileInfo *expected = NULL, *o = NULL;
+  StringBuilder b;
+  FILE *f = NULL;
+  double start;
+  int i, same, to_return = 0;
+  memset(&b, 0, sizeof(b));
+  memset(&options, 0, sizeof(options));
+  if (sizeof(size_t) < 8) {
+    printf("--huge needs a 64-bit system.\n");
+    return 0;
+  }
+  if (!GenerateGrid(HUGE_FILE_GRID_SIZE, BENCH_NORMALS | BENCH_UVS, &b)) {
+    goto cleanup;
+  }
+  expected = ParseObjFileWithOptions(b.data, b.size, &options);
+  if (!expected) {
+    printf("Failed parsing the unpadded obj file.\n");
+    goto cleanup;
+  }
+  printf("Writing %.1f MB to %s\n", size_mb, path);
+  start = CurrentSeconds();
+  if (!WritePaddedFile(path, &b, (uint64_t) (size_mb * 1024.0 * 1024.0))) {
+    goto cleanup;
+  }
+  printf("  Took %.1f s\n", CurrentSeconds() - start);
+  to_return = 1;
+  for (i = 0; i < 4; i++) {
+    memset(&options, 0, sizeof(options));
+    options.thread_count = (i == 1) ? GetCPUCount() : 1;
+    options.count_first = i == 2;
+    start = CurrentSeconds();
+    if (i < 3) {
+      o = ParseMappedFile(path, &options);
+    } else {
+      f = fopen(path, "rb");
+      o = f ? ParseObjStream(f, &options) : NULL;
+      if (f) fclose(f);
+    }
+    if (!o) {
+      printf("  %-16s failed\n", names[i]);
+      to_return = 0;
+      continue;
+    }
+    same = SameParsedFile(expected, o);
+    if (!same) to_return = 0;
+    printf("  %-16s %s, %u vertices, %llu indices, %.1f s\n", names[i],
+      same ? "OK" : "MISMATCH", (unsigned) o->vertex_count,
+      (unsigned long long) o->index_count, CurrentSeconds() - start);
+    FreeObjectFileInfo(o);
+    o = NULL;
+  }
+  remove(path);
+
+cleanup:
+  if (expected) FreeObjectFileInfo(expected);
+  free(b.data);
+  return to_return;
+}
+
+int main(int argc, char **argv) {
+  const GeneratorFunction generators[] = {GenerateGrid, GenerateIcosphere};
+  const char *shape_names[] = {"grid", "icosphere"};
+  const char *csv_path = "obj_bench.csv";
+  BenchmarkResult result;
+  StringBuilder b;
+  FILE *csv = NULL;
+  double size_mb = 64.0;
+  int iterations = 3, shape, attributes, size_parameter, to_return = 1;
+  size_t i;
+  if ((argc > 1) && (strcmp(argv[1], "--huge") == 0)) {
+    size_mb = (argc > 3) ? atof(argv[3]) : DEFAULT_HUGE_FILE_MB;
+    if ((argc < 3) || (size_mb <= 0)) {
+      printf("Usage: %s --huge <path> [size in MB]\n", argv[0]);
+      return 1;
+    }
+    return RunHugeFileCheck(argv[2], size_mb) ? 0 : 1;
+  }
+  if (argc > 1) size_mb = atof(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if (argc > 3) csv_path = argv[3];
+  if ((size_mb <= 0) || (iterations <= 0)) {
+    printf("Usage: %s [size in MB] [iterations] [output CSV path]\n",
+      argv[0]);
+    return 1;
+  }
+  csv = fopen(csv_path, "w");
+  if (!csv) {
+    printf("Failed opening %s\n", csv_path);
+    return 1;
+  }
+  fprintf(csv, "shape,normals,uvs,config,threads,count_first,bytes,"
+    "vertices,triangles,count_s,parse_s,dedup_s,remap_s,optimize_s,weld_s,"
+    "normals_s,total_s,mb_per_s,vertices_per_s,rss_before_kb,peak_rss_kb,"
+    "arena_used_kb,arena_reserved_kb\n");
+  memset(&b, 0, sizeof(b));
+  for (shape = 0; shape < 2; shape++) {
+    for (attributes = 0; attributes < 4; attributes++) {
+      b.size = 0;
+      if (!GenerateWithTargetSize(generators[shape], shape == 0, attributes,
+        size_mb * 1024.0 * 1024.0, &b, &size_parameter)) {
+        goto cleanup;
+      }
+      printf("%s %d (%.1f MB, normals: %s, UVs: %s), best of %d:\n",
+        shape_names[shape], size_parameter,
+        ((double) b.size) / (1024.0 * 1024.0),
+        (attributes & BENCH_NORMALS) ? "yes" : "no",
+        (attributes & BENCH_UVS) ? "yes" : "no", iterations);
+      for (i = 0; i < CONFIG_COUNT; i++) {
+        if ((configs[i].dedup_engine == OBJ_DEDUP_TREE) &&
+          (((double) b.size) > (MAX_TREE_BENCHMARK_MB * 1024.0 * 1024.0))) {
+          continue;
+        }
+        if (!RunBenchmark(b.data, b.size, configs + i, iterations, &result)) {
+          goto cleanup;
+        }
+        if (!WriteResult(csv, shape_names[shape], attributes, configs + i,
+          b.size, &result)) {
+          goto cleanup;
+        }
+      }
+    }
+  }
+  printf("Wrote results to %s\n", csv_path);
+  to_return = 0;
+
+cleanup:
+  free(b.data);
+  fclose(csv);
+  return to_return;
+}
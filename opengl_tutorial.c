@@ -13,6 +13,7 @@
 
 #include "model.h"
 #include "parse_obj.h"
+#include "shader_program.h"
 #include "utilities.h"
 #include "opengl_tutorial.h"
 
@@ -40,6 +41,7 @@ void FreeApplicationState(ApplicationState *s) {
   DestroyMesh(s->mesh);
   DestroyMesh(s->floor);
   DestroyMesh(s->lamp);
+  DestroyShaderProgram(s->depth_program);
   glDeleteBuffers(1, &(s->uniform_buffer));
   free(s->transforms);
   free(s->transform_matrices);
@@ -148,15 +150,39 @@ static void UpdateModelTransforms(ApplicationState *s) {
 }
 
 // Processes window inputs. Returns 0 on error.
-static int ProcessInputs(GLFWwindow *window) {
-  if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
-    glfwSetWindowShouldClose(window, 1);
+static int ProcessInputs(ApplicationState *s) {
+  int key_down;
+  if (glfwGetKey(s->window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+    glfwSetWindowShouldClose(s->window, 1);
   }
+  key_down = glfwGetKey(s->window, GLFW_KEY_P) == GLFW_PRESS;
+  if (key_down && !s->prepass_key_down) {
+    s->depth_prepass = !s->depth_prepass;
+    printf("Depth pre-pass %s.\n", s->depth_prepass ? "on" : "off");
+  }
+  s->prepass_key_down = key_down;
+  return 1;
+}
+
+// Draws every mesh into the depth buffer, without writing any color, and sets
+// up the depth test so the following shading pass only draws the fragments
+// that ended up on top. Returns 0 on error.
+static int DrawDepthPrepass(ApplicationState *s) {
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  if (!DrawMeshDepth(s->lamp, s->depth_program)) return 0;
+  if (!DrawMeshDepth(s->floor, s->depth_program)) return 0;
+  if (!DrawMeshDepth(s->mesh, s->depth_program)) return 0;
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  // The depth buffer already holds the final depths, so there's no need to
+  // write them again.
+  glDepthFunc(GL_EQUAL);
+  glDepthMask(GL_FALSE);
   return 1;
 }
 
 // Runs the main window loop. Returns 0 on error.
 static int RunMainLoop(ApplicationState *s) {
+  mat4 view_projection;
   s->shared_uniforms.ambient_color[0] = 1.0;
   s->shared_uniforms.ambient_color[1] = 1.0;
   s->shared_uniforms.ambient_color[2] = 1.0;
@@ -173,7 +199,7 @@ static int RunMainLoop(ApplicationState *s) {
   glCullFace(GL_BACK);
 
   while (!glfwWindowShouldClose(s->window)) {
-    if (!ProcessInputs(s->window)) {
+    if (!ProcessInputs(s)) {
       printf("Error processing inputs.\n");
       return 0;
     }
@@ -186,6 +212,12 @@ static int RunMainLoop(ApplicationState *s) {
 
     UpdateView(s);
     UpdateLamp(s);
+    SetMeshCamera(s->mesh, s->shared_uniforms.view_position,
+      s->shared_uniforms.projection, s->window_height);
+    glm_mat4_mul(s->shared_uniforms.projection, s->shared_uniforms.view,
+      view_projection);
+    CullMeshClusters(s->mesh, view_projection,
+      s->shared_uniforms.view_position);
 
     // Update the uniform data, now that we've adjusted the camera and lamp.
     // NOTE: Maybe eventually update this to only copy the parts that change.
@@ -193,9 +225,14 @@ static int RunMainLoop(ApplicationState *s) {
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SharedUniformBlock),
       (void *) &(s->shared_uniforms));
 
+    if (s->depth_prepass && !DrawDepthPrepass(s)) return 0;
     if (!DrawMesh(s->lamp)) return 0;
     if (!DrawMesh(s->floor)) return 0;
     if (!DrawMesh(s->mesh)) return 0;
+    // Restore the normal depth test, which glClear also needs to be able to
+    // clear the depth buffer.
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
 
     glfwSwapBuffers(s->window);
     glfwPollEvents();
@@ -239,9 +276,15 @@ static int SetupFloorPlane(ApplicationState *s) {
 // Sets up the box meshes, including randomizing their positions, rotations,
 // etc. Returns 0 on error.
 static int SetupBoxMeshes(ApplicationState *s) {
+  MeshLoadOptions options;
   int i;
   MeshTransformConfiguration *t = NULL;
-  s->mesh = LoadMesh("cube.obj", 2, "container.jpg", "awesomeface.png");
+  memset(&options, 0, sizeof(options));
+  options.generate_lods = 1;
+  options.build_clusters = 1;
+  options.build_depth_stream = 1;
+  s->mesh = LoadMeshWithOptions("cube.obj", &options, 2, "container.jpg",
+    "awesomeface.png");
   if (!s->mesh) return 0;
   if (!SetShaderProgram(s->mesh, "basic_vertices.vert",
     "two_texture_shader.frag")) {
@@ -311,11 +354,25 @@ static int SetupLamp(ApplicationState *s) {
   return 1;
 }
 
+// Loads the shader used for the depth pre-pass, and turns the pre-pass on.
+// Returns 0 on error.
+static int SetupDepthPrepass(ApplicationState *s) {
+  s->depth_program = SetupShaderProgram("depth_only.vert", "depth_only.frag",
+    0);
+  if (!s->depth_program) {
+    printf("Failed loading depth pre-pass shaders.\n");
+    return 0;
+  }
+  s->depth_prepass = 1;
+  return 1;
+}
+
 // Loads the 3D models to render. Returns 0 on error.
 static int Setup3DModels(ApplicationState *s) {
   if (!SetupFloorPlane(s)) return 0;
   if (!SetupBoxMeshes(s)) return 0;
   if (!SetupLamp(s)) return 0;
+  if (!SetupDepthPrepass(s)) return 0;
   return 1;
 }
 
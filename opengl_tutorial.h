@@ -56,6 +56,14 @@ typedef struct {
   // Holds the shared ubo for shared transform matrices and lighting.
   GLuint uniform_buffer;
   SharedUniformBlock shared_uniforms;
+  // Writes depth only, for the depth pre-pass.
+  ShaderProgram *depth_program;
+  // If nonzero, every mesh is drawn into the depth buffer before shading, so
+  // that overlapping meshes don't run the fragment shader more than once per
+  // pixel. Toggled by pressing P.
+  int depth_prepass;
+  // Nonzero while the P key is held down, so holding it only toggles once.
+  int prepass_key_down;
 } ApplicationState;
 
 // Allocates an ApplicationState struct and initializes its values to 0.
@@ -1,245 +1,597 @@
+#include <float.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "memory_arena.h"
+#include "mesh_normals.h"
+#include "mesh_optimizer.h"
+#include "mesh_weld.h"
 #include "scapegoat_tree.h"
+#include "thread_pool.h"
 #include "parse_obj.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define OBJ_SCAN_X86
+#endif
+
 // Maps internal "indices," consisting of the three numbers in the object file,
 // to final indices, which refer to a single ObjectFileVertex struct.
 typedef struct {
   // The three internal indices.
   uint32_t index_triple[3];
   // The single index into the vertices in the ObjectFileInfo struct.
-  // Initialized after the entire file has been parsed.
+  // Initialized after the entire file has been parsed. Until then, this holds
+  // a bitmask of which of the three indices were negative (relative) indices
+  // in the file, which need to be adjusted when merging chunks of a file
+  // parsed by multiple threads.
   uint32_t final_index;
 } InternalIndexMapping;
 
 // Holds important parsed file content, prior to merging the list of locations,
-// normals, and uv coords into the ObjectFileVertex struct.
+// normals, and uv coords into the ObjectFileVertex struct. Every count is 64
+// bits, but the file's indices are 32 bits, so there can't be more than
+// UINT32_MAX locations, normals, or UV coords. See CheckAttributeCounts.
 typedef struct {
   // Contains each vertex's location coordinate, as specified by "v" lines in
   // the file. Contains 3 * location_count floats.
   float *locations;
-  uint32_t location_count;
-  // The number of locations we've already seen, if we're parsing the file.
-  uint32_t locations_read;
+  uint64_t location_count;
+  // The number of locations the locations buffer has space for.
+  uint64_t location_capacity;
   // Contains each normal vector, as specified by "vn" lines in the file.
   // Contains 3 * normal_count floats.
   float *normals;
-  uint32_t normal_count;
-  // The number of normals we've already seen, if we're parsing the file.
-  uint32_t normals_read;
+  uint64_t normal_count;
+  // The number of normals the normals buffer has space for.
+  uint64_t normal_capacity;
   // Contains each UV coordinate, as specified by the "vt" lines in the file.
   // Contains 2 * uv_coord_count floats.
   float *uv_coords;
-  uint32_t uv_coord_count;
-  // The number of UV coords we've already seen, if we're parsing the file.
-  uint32_t uv_coords_read;
-  // Contains each vertex index in the file. Each index contains three ints:
+  uint64_t uv_coord_count;
+  // The number of UV coords the uv_coords buffer has space for.
+  uint64_t uv_coord_capacity;
+  // Contains each index in the file. Each index contains three ints:
   // specifying the location, UV coordinate, and normal in their respective
-  // arrays. So this contains index_count * 3 uint32_t values. Additionally,
-  // the index_count must be divisible by 3, since we're expecting triangles.
-  // Contains each index in the file. Each face consists of 3 groups of 3 or
-  // fewer indices. So, index_count / 3 = # of faces.
+  // arrays. Each face consists of 3 groups of 3 or fewer indices, so
+  // index_count must be divisible by 3, and index_count / 3 = # of faces.
   InternalIndexMapping *indices;
-  uint32_t index_count;
-  // The number of indices we've already seen, if we're parsing the file.
-  uint32_t indices_read;
+  uint64_t index_count;
+  // The number of indices the indices buffer has space for.
+  uint64_t index_capacity;
+  // The objects and groups started by "o" and "g" lines so far, in order.
+  // Each one's first_index is the number of indices before it. Their
+  // index_counts aren't filled in until the whole file has been parsed.
+  ObjectFileSubMesh *sub_meshes;
+  uint64_t sub_mesh_count;
+  // The number of sub-meshes the sub_meshes buffer has space for.
+  uint64_t sub_mesh_capacity;
+  // Holds the buffers above, along with every other temporary buffer used
+  // while converting this file's content, so they're all freed at once by
+  // CleanupInternalObjectFile.
+  MemoryArena arena;
 } InternalObjectFile;
 
 // Used when traversing a tree containing information about unique vertices.
 typedef struct {
-  InternalObjectFile *o;
-  ObjectFileVertex *final_vertices;
+  // Receives the index triple of each final vertex, in order.
+  InternalIndexMapping **vertex_mappings;
   uint32_t next_index;
 } TraversalCallbackData;
 
+// Returns the current time, in seconds.
+static double CurrentSeconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double) t.tv_sec) + (((double) t.tv_nsec) / 1e9);
+}
+
 // Returns the pointer to the next character after in that is non-whitespace.
-// This does *not* count newlines as whitespace.
-static const char* SkipSpaces(const char *in) {
-  while ((*in == ' ') || (*in == '\t')) in++;
+// This does *not* count newlines as whitespace. Never returns a pointer past
+// end.
+static const char* SkipSpaces(const char *in, const char *end) {
+  while ((in < end) && ((*in == ' ') || (*in == '\t'))) in++;
   return in;
 }
 
-// Returns the number of indices on a line starting with "f ". Returns a
-// negative value on error.
-static int CountIndicesOnLine(const char *l) {
-  int to_return;
-  to_return = 0;
-  char c;
-
-  // We basically count the number of indices here by scanning the number of
-  // space-separated tokens.
-  while (*l) {
-    c = *l;
-    if (c == '\n') break;
-    if ((c == ' ') || (c == '\t')) {
-      to_return++;
-      l = SkipSpaces(l);
-      continue;
-    }
-    // We're not at a newline or a whitespace.
+// The different kinds of lines we care about in an obj file.
+typedef enum {
+  OBJ_LINE_OTHER,
+  OBJ_LINE_COMMENT,
+  OBJ_LINE_LOCATION,
+  OBJ_LINE_NORMAL,
+  OBJ_LINE_UV,
+  OBJ_LINE_FACE,
+  OBJ_LINE_OBJECT,
+  OBJ_LINE_GROUP,
+} ObjLineType;
+
+// Returns the type of the line starting at line, which must not start with
+// whitespace. Only looks at the first few bytes rather than comparing entire
+// strings, and never reads past end.
+static ObjLineType ClassifyLine(const char *line, const char *end) {
+  size_t length = end - line;
+  if (length < 2) {
+    if ((length == 1) && (line[0] == '#')) return OBJ_LINE_COMMENT;
+    return OBJ_LINE_OTHER;
+  }
+  switch (line[0]) {
+  case '#':
+    return OBJ_LINE_COMMENT;
+  case 'v':
+    if (line[1] == ' ') return OBJ_LINE_LOCATION;
+    if ((length < 3) || (line[2] != ' ')) return OBJ_LINE_OTHER;
+    if (line[1] == 'n') return OBJ_LINE_NORMAL;
+    if (line[1] == 't') return OBJ_LINE_UV;
+    return OBJ_LINE_OTHER;
+  case 'f':
+    if (line[1] == ' ') return OBJ_LINE_FACE;
+    return OBJ_LINE_OTHER;
+  case 'o':
+    if (line[1] == ' ') return OBJ_LINE_OBJECT;
+    return OBJ_LINE_OTHER;
+  case 'g':
+    if (line[1] == ' ') return OBJ_LINE_GROUP;
+    return OBJ_LINE_OTHER;
+  default:
+    break;
+  }
+  return OBJ_LINE_OTHER;
+}
+
+// Returns a pointer to the first newline character at or after s, or end if
+// there isn't one. This is used to skip lines, so we have SIMD versions of it
+// that look at 16 or 32 bytes at a time, selected at runtime by
+// InitializeLineScanner. Each version handles the last partial block one byte
+// at a time, so none of them read past end.
+typedef const char* (*FindNewlineFunction)(const char *s, const char *end);
+
+static const char* FindNewlineScalar(const char *s, const char *end) {
+  while ((s < end) && (*s != '\n')) s++;
+  return s;
+}
+
+#ifdef OBJ_SCAN_X86
+__attribute__((target("sse2")))
+static const char* FindNewlineSSE2(const char *s, const char *end) {
+  const __m128i newlines = _mm_set1_epi8('\n');
+  __m128i block;
+  int mask;
+  while ((end - s) >= 16) {
+    block = _mm_loadu_si128((const __m128i *) s);
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 16;
+  }
+  return FindNewlineScalar(s, end);
+}
+
+__attribute__((target("avx2")))
+static const char* FindNewlineAVX2(const char *s, const char *end) {
+  const __m256i newlines = _mm256_set1_epi8('\n');
+  __m256i block;
+  uint32_t mask;
+  // Most obj lines are shorter than 32 bytes, so check the first 16 bytes on
+  // their own before switching to 32-byte blocks.
+  if ((end - s) >= 16) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(
+      (const __m128i *) s), _mm256_castsi256_si128(newlines)));
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 16;
+  }
+  while ((end - s) >= 32) {
+    block = _mm256_loadu_si256((const __m256i *) s);
+    mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block,
+      newlines));
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 32;
+  }
+  return FindNewlineScalar(s, end);
+}
+#endif  // OBJ_SCAN_X86
+
+// Returns the number of indices on a line starting with "f ", by counting the
+// runs of whitespace on the line. The line ends at line_end, which must point
+// to the newline or the end of the file. Like FindNewline, this has a SIMD
+// version selected by InitializeLineScanner.
+typedef int (*CountIndicesFunction)(const char *l, const char *line_end);
+
+static int CountIndicesOnLineScalar(const char *l, const char *line_end) {
+  int to_return = 0;
+  int previous_was_space = 0;
+  int is_space;
+  while (l < line_end) {
+    is_space = (*l == ' ') || (*l == '\t');
+    if (is_space && !previous_was_space) to_return++;
+    previous_was_space = is_space;
     l++;
   }
   return to_return;
 }
 
-// Returns 1 if string a starts with string b.
-static int StartsWith(const char *a, const char *b) {
-  if (strstr(a, b) == a) return 1;
-  return 0;
+#ifdef OBJ_SCAN_X86
+// Face lines are short, so there's no point in an AVX2 version of this.
+__attribute__((target("sse2,popcnt")))
+static int CountIndicesOnLineSSE2(const char *l, const char *line_end) {
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i tabs = _mm_set1_epi8('\t');
+  __m128i block;
+  uint32_t mask, previous_was_space = 0;
+  int to_return = 0;
+  while ((line_end - l) >= 16) {
+    block = _mm_loadu_si128((const __m128i *) l);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, spaces),
+      _mm_cmpeq_epi8(block, tabs)));
+    // A run of whitespace starts at any space that doesn't directly follow
+    // another one, including the last byte of the previous block.
+    to_return += __builtin_popcount(mask & ~((mask << 1) |
+      previous_was_space));
+    previous_was_space = (mask >> 15) & 1;
+    l += 16;
+  }
+  // Don't count a run continuing from the last full block twice.
+  if (previous_was_space) {
+    while ((l < line_end) && ((*l == ' ') || (*l == '\t'))) l++;
+  }
+  return to_return + CountIndicesOnLineScalar(l, line_end);
 }
+#endif  // OBJ_SCAN_X86
+
+// Set by InitializeLineScanner to the best implementations for the current
+// CPU.
+static FindNewlineFunction FindNewline = FindNewlineScalar;
+static CountIndicesFunction CountIndicesOnLine = CountIndicesOnLineScalar;
 
-// Takes a string and skips past the following newline. If a null character is
-// encountered before the next newline, stops at the null instead.
-static const char* SkipLine(const char *in) {
-  // Move to the next newline character.
-  while (*in != '\n') {
-    // Stop early if we encounter the null character.
-    if (*in == 0) return in;
-    in++;
+// Picks the FindNewline and CountIndicesOnLine implementations to use. This
+// only needs to be called once, but it's safe to call it every time we parse
+// a file.
+static void InitializeLineScanner(void) {
+  FindNewline = FindNewlineScalar;
+  CountIndicesOnLine = CountIndicesOnLineScalar;
+#ifdef OBJ_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) FindNewline = FindNewlineSSE2;
+  if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+    CountIndicesOnLine = CountIndicesOnLineSSE2;
   }
+  if (__builtin_cpu_supports("avx2")) FindNewline = FindNewlineAVX2;
+#endif
+}
+
+// Takes a string and skips past the following newline. If end is reached
+// before the next newline, returns end instead.
+static const char* SkipLine(const char *in, const char *end) {
+  // After parsing a line's content we're usually already at the newline, so
+  // don't bother with FindNewline in that case.
+  if ((in < end) && (*in == '\n')) return in + 1;
+  in = FindNewline(in, end);
   // Skip the newline.
-  in++;
+  if (in < end) in++;
   return in;
 }
 
 // Counts the number of vertices, normals, texture coordinates, and indices in
-// the file so we can allocate the arrays to hold them. Returns 0 on error,
-// including if the file contains too many objects or the file uses
+// the file so we can allocate the arrays to hold them. Sets the capacity
+// fields in o to the counts. Returns 0 on error, including if the file uses
 // non-triangular faces.
-static int CountVerticesAndIndices(const char *content,
+static int CountVerticesAndIndices(const char *content, const char *end,
     InternalObjectFile *o) {
-  int object_count = 0;
-  char c = 0;
-  o->location_count = 0;
-  o->normal_count = 0;
-  o->uv_coord_count = 0;
-  o->index_count = 0;
+  const char *line_end = NULL, *face_end = NULL;
+  o->location_capacity = 0;
+  o->normal_capacity = 0;
+  o->uv_coord_capacity = 0;
+  o->index_capacity = 0;
 
-  while (*content) {
+  while (content < end) {
     // Skip any leading whitespace.
-    content = SkipSpaces(content);
-    c = *content;
-    // Skip blank lines.
-    if (c == '\n') {
-      content++;
-      continue;
-    }
-    // Skip comments.
-    if (c == '#') {
-      content = SkipLine(content);
-      continue;
-    }
-    // We're looking at a new object.
-    if (StartsWith(content, "o ")) {
-      object_count++;
-      if (object_count > 1) {
-        printf("The obj file contains too many objects.\n");
-        return 0;
+    content = SkipSpaces(content, end);
+    line_end = FindNewline(content, end);
+    switch (ClassifyLine(content, line_end)) {
+    case OBJ_LINE_LOCATION:
+      o->location_capacity++;
+      break;
+    case OBJ_LINE_UV:
+      o->uv_coord_capacity++;
+      break;
+    case OBJ_LINE_NORMAL:
+      o->normal_capacity++;
+      break;
+    case OBJ_LINE_FACE:
+      // Trailing whitespace would count as another run of spaces.
+      face_end = line_end;
+      while ((face_end > content) && ((face_end[-1] == ' ') ||
+        (face_end[-1] == '\t') || (face_end[-1] == '\r'))) {
+        face_end--;
       }
-      content = SkipLine(content);
-      continue;
-    }
-    if (StartsWith(content, "v ")) {
-      o->location_count++;
-      content = SkipLine(content);
-      continue;
-    }
-    if (StartsWith(content, "vt ")) {
-      o->uv_coord_count++;
-      content = SkipLine(content);
-      continue;
-    }
-    if (StartsWith(content, "vn ")) {
-      o->normal_count++;
-      content = SkipLine(content);
-      continue;
-    }
-    if (StartsWith(content, "f ")) {
-      if (CountIndicesOnLine(content) != 3) {
+      if (CountIndicesOnLine(content, face_end) != 3) {
         printf("Found a non-triangular face.\n");
         return 0;
       }
-      o->index_count += 3;
-      content = SkipLine(content);
-      continue;
+      o->index_capacity += 3;
+      break;
+    default:
+      // Skip comments, blank lines, and anything else we don't recognize.
+      break;
     }
-    // Fallback for unrecognized line. Skip it.
-    content = SkipLine(content);
+    // Skip the newline.
+    content = line_end;
+    if (content < end) content++;
+  }
+  return 1;
+}
+
+// Sets *size to the number of bytes in count elements of element_size bytes
+// each. Returns 0 if that doesn't fit in a size_t, which can only happen on
+// 32-bit systems.
+static int GetBufferSize(uint64_t count, size_t element_size, size_t *size) {
+  if (count > (SIZE_MAX / element_size)) {
+    printf("Obj file contains too many elements for this system.\n");
+    return 0;
   }
+  *size = (size_t) count * element_size;
   return 1;
 }
 
-// Call this after counting vertices, etc, to allocate the buffers in o. If any
-// allocation fails, this returns 0 and o is unchanged. Buffers are filled with
-// zero.
+// Call this after counting vertices, etc, to allocate the buffers in o with
+// the counted capacities. The arena is first grown to hold all of them, so
+// they end up in a single block. If any allocation fails, this returns 0 and
+// o's buffers are unchanged. Buffers are filled with zero.
 static int AllocateTemporaryBuffers(InternalObjectFile *o) {
   float *locations = NULL, *normals = NULL, *uv_coords = NULL;
   InternalIndexMapping *indices = NULL;
-  locations = (float *) calloc(sizeof(float), 3 * o->location_count);
-  if (!locations) return 0;
-  normals = (float *) calloc(sizeof(float), 3 * o->normal_count);
-  if (!normals) {
-    free(locations);
+  ObjectFileSubMesh *sub_meshes = NULL;
+  size_t location_size, normal_size, uv_coord_size, index_size;
+  size_t sub_mesh_size;
+  if (!GetBufferSize(o->location_capacity, 3 * sizeof(float),
+    &location_size) || !GetBufferSize(o->normal_capacity, 3 * sizeof(float),
+    &normal_size) || !GetBufferSize(o->uv_coord_capacity, 2 * sizeof(float),
+    &uv_coord_size) || !GetBufferSize(o->index_capacity,
+    sizeof(InternalIndexMapping), &index_size) ||
+    !GetBufferSize(o->sub_mesh_capacity, sizeof(ObjectFileSubMesh),
+    &sub_mesh_size)) {
     return 0;
   }
-  uv_coords = (float *) calloc(sizeof(float), 2 * o->uv_coord_count);
-  if (!uv_coords) {
-    free(locations);
-    free(normals);
+  if (!ReserveArena(&(o->arena), location_size + normal_size +
+    uv_coord_size + index_size + sub_mesh_size + 5 * ARENA_ALIGNMENT)) {
     return 0;
   }
-  indices = (InternalIndexMapping *) calloc(sizeof(InternalIndexMapping),
-    o->index_count);
-  if (!indices) {
-    free(locations);
-    free(normals);
-    free(uv_coords);
+  locations = (float *) ArenaAllocateZeroed(&(o->arena), location_size);
+  normals = (float *) ArenaAllocateZeroed(&(o->arena), normal_size);
+  uv_coords = (float *) ArenaAllocateZeroed(&(o->arena), uv_coord_size);
+  indices = (InternalIndexMapping *) ArenaAllocateZeroed(&(o->arena),
+    index_size);
+  sub_meshes = (ObjectFileSubMesh *) ArenaAllocateZeroed(&(o->arena),
+    sub_mesh_size);
+  if (!locations || !normals || !uv_coords || !indices || !sub_meshes) {
     return 0;
   }
   o->locations = locations;
   o->normals = normals;
   o->uv_coords = uv_coords;
   o->indices = indices;
+  o->sub_meshes = sub_meshes;
+  return 1;
+}
+
+// Makes sure that *buffer, which currently has space for *capacity elements
+// of element_size bytes each, has space for at least needed elements. Grows
+// the buffer geometrically, so that parsing a file in a single pass only
+// copies each element a constant number of times on average. The buffer is
+// in the given arena, or on the heap if arena is NULL. Since an arena can't
+// free the old copies, they add up to at most the size of the final buffer.
+// Returns 0 on error, in which case *buffer and *capacity are unchanged.
+static int ReserveCapacity(MemoryArena *arena, void **buffer,
+    uint64_t *capacity, uint64_t needed, size_t element_size) {
+  uint64_t new_capacity = *capacity;
+  size_t old_size, new_size;
+  void *new_buffer = NULL;
+  if (needed <= *capacity) return 1;
+  if (new_capacity < 1024) new_capacity = 1024;
+  while (new_capacity < needed) new_capacity *= 2;
+  if (!GetBufferSize(new_capacity, element_size, &new_size)) return 0;
+  old_size = (size_t) *capacity * element_size;
+  if (arena) {
+    new_buffer = ArenaResize(arena, *buffer, old_size, new_size);
+  } else {
+    new_buffer = realloc(*buffer, new_size);
+  }
+  if (!new_buffer) {
+    printf("Failed growing obj parsing buffer to %llu elements.\n",
+      (unsigned long long) new_capacity);
+    return 0;
+  }
+  *buffer = new_buffer;
+  *capacity = new_capacity;
   return 1;
 }
 
-// Frees any memory associated with the given InternalObjectFile.
+// Frees any memory associated with the given InternalObjectFile, leaving it
+// zeroed apart from its arena's settings.
 static void CleanupInternalObjectFile(InternalObjectFile *o) {
-  free(o->locations);
-  free(o->normals);
-  free(o->uv_coords);
-  free(o->indices);
+  int use_huge_pages = o->arena.use_huge_pages;
+  DestroyArena(&(o->arena));
   memset(o, 0, sizeof(*o));
+  o->arena.use_huge_pages = use_huge_pages;
+}
+
+// Returns nonzero if c can occur in a floating-point number in an obj file,
+// including in the "inf" and "nan" special values.
+static int IsFloatCharacter(char c) {
+  if ((c >= '0') && (c <= '9')) return 1;
+  switch (c) {
+  case '-':
+  case '+':
+  case '.':
+  case 'e':
+  case 'E':
+  case 'a':
+  case 'A':
+  case 'f':
+  case 'F':
+  case 'i':
+  case 'I':
+  case 'n':
+  case 'N':
+  case 't':
+  case 'T':
+  case 'y':
+  case 'Y':
+    return 1;
+  default:
+    break;
+  }
+  return 0;
+}
+
+// The slow path for ParseNextFloat, used for any float that can't be parsed
+// exactly by the fast path. s must not start with whitespace. Otherwise the
+// same as ParseNextFloat.
+static const char* ParseFloatSlow(const char *s, const char *end,
+    float *out) {
+  // strtof requires a null-terminated string, which we can't count on, so we
+  // copy the float's characters to this buffer first. We never call setlocale,
+  // so strtof always expects a '.' as the decimal point.
+  char buffer[64];
+  char *buffer_end = NULL;
+  size_t length = 0;
+  while (((s + length) < end) && IsFloatCharacter(s[length])) {
+    length++;
+    if (length >= sizeof(buffer)) {
+      printf("Float in obj file is too long.\n");
+      return NULL;
+    }
+  }
+  memcpy(buffer, s, length);
+  buffer[length] = 0;
+  *out = strtof(buffer, &buffer_end);
+  if (buffer_end == buffer) {
+    printf("String doesn't start with a float.\n");
+    return NULL;
+  }
+  return s + (buffer_end - buffer);
 }
 
+// Every integer up to this value can be represented exactly as a float.
+#define MAX_EXACT_FLOAT_INTEGER (1 << 24)
+
+// The powers of ten that can be represented exactly as floats.
+#define MAX_EXACT_FLOAT_POWER_OF_TEN (10)
+static const float exact_powers_of_ten[] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+};
+
 // Reads a single floating-point value from s, writing it to *out. Returns a
 // pointer to the first char after the float. Returns NULL on error. Skips
-// any leading whitespace in s, apart from newlines.
-static const char* ParseNextFloat(const char *s, float *out) {
-  char *end = NULL;
+// any leading whitespace in s, apart from newlines. Never reads past end.
+//
+// Nearly every float in an obj file looks like "-0.123456", which we parse
+// into an integer mantissa and a power of ten. If both are exactly
+// representable as floats, then a single IEEE multiply or divide gives the
+// correctly-rounded result, the same as strtof would. Anything else falls
+// back to strtof.
+static const char* ParseNextFloat(const char *s, const char *end,
+    float *out) {
+  const char *p = NULL;
+  const char *exponent_start = NULL;
+  uint64_t mantissa = 0;
+  unsigned digit;
+  int negative = 0, exponent = 0, explicit_exponent = 0;
+  int exponent_negative = 0, digit_count = 0, significant_digits = 0;
   float result;
-  s = SkipSpaces(s);
-  result = strtof(s, &end);
-  if (end == s) {
-    printf("String doesn't start with a float.\n");
-    return NULL;
+  s = SkipSpaces(s, end);
+  p = s;
+  if ((p < end) && ((*p == '-') || (*p == '+'))) {
+    negative = *p == '-';
+    p++;
+  }
+  // The integer part. Leading zeros aren't significant, so they don't count
+  // towards the 19 digits we can fit in the mantissa. Every digit after the
+  // first nonzero one does, even if the mantissa has wrapped around to 0.
+  while (p < end) {
+    digit = ((unsigned char) *p) - '0';
+    if (digit > 9) break;
+    mantissa = mantissa * 10 + digit;
+    if ((significant_digits > 0) || (digit != 0)) significant_digits++;
+    digit_count++;
+    p++;
+  }
+  // The fractional part.
+  if ((p < end) && (*p == '.')) {
+    p++;
+    while (p < end) {
+      digit = ((unsigned char) *p) - '0';
+      if (digit > 9) break;
+      mantissa = mantissa * 10 + digit;
+      if ((significant_digits > 0) || (digit != 0)) significant_digits++;
+      digit_count++;
+      exponent--;
+      p++;
+    }
+  }
+  if ((digit_count == 0) || (significant_digits > 19)) {
+    return ParseFloatSlow(s, end, out);
+  }
+  // The optional exponent. Like strtof, we don't consume the 'e' unless it's
+  // followed by digits.
+  if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+    exponent_start = p;
+    p++;
+    if ((p < end) && ((*p == '-') || (*p == '+'))) {
+      exponent_negative = *p == '-';
+      p++;
+    }
+    if ((p >= end) || ((((unsigned char) *p) - '0') > 9)) {
+      p = exponent_start;
+    } else {
+      while (p < end) {
+        digit = ((unsigned char) *p) - '0';
+        if (digit > 9) break;
+        // Anything this big will go to the slow path regardless.
+        if (explicit_exponent < 100000) {
+          explicit_exponent = explicit_exponent * 10 + digit;
+        }
+        p++;
+      }
+      if (exponent_negative) explicit_exponent = -explicit_exponent;
+      exponent += explicit_exponent;
+    }
+  }
+  // Trailing zeros, as in "1000000.000000", don't need to be in the mantissa.
+  while ((mantissa > MAX_EXACT_FLOAT_INTEGER) && ((mantissa % 10) == 0)) {
+    mantissa /= 10;
+    exponent++;
+  }
+#if FLT_EVAL_METHOD == 0
+  if ((mantissa <= MAX_EXACT_FLOAT_INTEGER) &&
+    (exponent >= -MAX_EXACT_FLOAT_POWER_OF_TEN) &&
+    (exponent <= MAX_EXACT_FLOAT_POWER_OF_TEN)) {
+    result = (float) mantissa;
+    if (exponent < 0) {
+      result /= exact_powers_of_ten[-exponent];
+    } else {
+      result *= exact_powers_of_ten[exponent];
+    }
+    *out = negative ? -result : result;
+    return p;
   }
-  *out = result;
-  return end;
+#endif
+  // Platforms that evaluate float operations at a higher precision (i.e., x87)
+  // would round twice, so they always use the slow path.
+  return ParseFloatSlow(s, end, out);
 }
 
 // Reads n consecutive whitespace-separated floats on the given line. The
 // floats must be separated by whitespace, and the line may start with
 // whitespace. The out array must have enough capacity for n floats. Returns 0
 // on error.
-static int ParseFloats(int n, const char *line, float *out) {
+static int ParseFloats(int n, const char *line, const char *end, float *out) {
   int i;
   float tmp;
   for (i = 0; i < n; i++) {
-    line = ParseNextFloat(line, &tmp);
+    line = ParseNextFloat(line, end, &tmp);
     if (!line) {
       printf("Failed parsing float %d/%d on line.\n", i + 1, n);
       return 0;
@@ -249,157 +601,245 @@ static int ParseFloats(int n, const char *line, float *out) {
   return 1;
 }
 
-// Reads the next 3 '/'-separated indices from s. s may have leading
-// whitepsace. out must have space to store the 3 indices. Returns the first
-// character after the third index. Returns NULL on error.
+// Reads a decimal integer from s, writing it to *value. Returns a pointer to
+// the first character after the digits. Returns s itself, and sets *value to
+// 0, if s doesn't start with a digit. Wraps around on overflow, like casting
+// the result of strtoul to a uint32_t. Never reads past end.
+static const char* ScanIndex(const char *s, const char *end,
+    uint32_t *value) {
+  uint32_t result = 0;
+  unsigned digit;
+  while (s < end) {
+    digit = ((unsigned char) *s) - '0';
+    if (digit > 9) break;
+    result = result * 10 + digit;
+    s++;
+  }
+  *value = result;
+  return s;
+}
+
 // Reads the next indices in a face from s. s may have leading whitespace. out
 // must have space to store 3 indices.  Returns the first character after the
 // indices (or single index).  If only one or two indices were specified, the
-// remaining of the three indices in out will be set to 0.
-static const char* ParseNextIndices(const char *s, uint32_t *out) {
-  int i;
-  unsigned long tmp;
-  char *end = NULL;
-  s = SkipSpaces(s);
+// remaining of the three indices in out will be set to 0, but the location
+// index is required, so this returns NULL if it's missing. Never reads past
+// end. Negative indices, which count backwards from the most recently defined
+// location, normal, or UV coordinate, are stored as their negated (two's
+// complement) values in out, and the corresponding bits in *relative_mask
+// are set. The caller is responsible for resolving them.
+static const char* ParseNextIndices(const char *s, const char *end,
+    uint32_t *out, uint32_t *relative_mask) {
+  int i, negative;
+  uint32_t tmp;
+  const char *digits_end = NULL;
+  *relative_mask = 0;
+  s = SkipSpaces(s, end);
   for (i = 0; i < 3; i++) {
-    // If we're already seeing a space, then the obj file didn't define all
-    // three indices for this vertex in the face.
-    if ((*s == ' ') || (*s == '\t') || (*s == '\n')) {
-      // Set the value, but don't consume a character.
-      out[i] = 0;
+    negative = (s < end) && (*s == '-');
+    digits_end = ScanIndex(s + negative, end, &tmp);
+    if (digits_end != (s + negative)) {
+      if (negative) {
+        out[i] = -tmp;
+        *relative_mask |= 1 << i;
+      } else {
+        // The indices in the file start at 1 rather than 0.
+        out[i] = tmp - 1;
+      }
+      s = digits_end;
+      // Skip the '/' for the first two numbers.
+      if ((i < 2) && (s < end) && (*s == '/')) s++;
       continue;
     }
-    // Leave values at 0 if they are omitted in the file, i.e. something like
-    // "1//3", which omits the texture coordinate index.
-    if (*s == '/') {
-      out[i] = 0;
+    // Every corner needs a location. Without this check, a face with too few
+    // corners, like "f 1 2", would get a made-up third corner.
+    if (i == 0) {
+      printf("Face corner is missing a location index.\n");
+      return NULL;
+    }
+    // There's no number here, so leave the value at 0. This is either
+    // something like "1//3", which omits the texture coordinate index, or a
+    // space or end of line, meaning that the file didn't define all three
+    // indices for this vertex in the face.
+    out[i] = 0;
+    if ((s < end) && (*s == '/')) {
       // Advance past the '/'
       s++;
       continue;
     }
-
-    // At this point, we must be looking at a number.
-    tmp = strtoul(s, &end, 10);
-    if (s == end) {
-      printf("String doesn't start with a number.\n");
-      return NULL;
+    if ((s >= end) || (*s == ' ') || (*s == '\t') || (*s == '\n') ||
+      (*s == '\r')) {
+      // Don't consume a character.
+      continue;
     }
-    // Advance past the number.
-    s = end;
-    // The indices in the file start at 1 rather than 0.
-    out[i] = tmp - 1;
-    // Skip the '/' for the first two numbers.
-    if ((i < 2) && (*s == '/')) s++;
+    printf("String doesn't start with a number.\n");
+    return NULL;
   }
   return s;
 }
 
 // Reads 3 sets of indices for a single face: 3 space-separated sets of 3
-// '/'-separated indices. Returns 0 on error. The out buffer must have space
-// for 3 indces. The line may have leading whitespace.
-static int ParseFace(const char *line, InternalIndexMapping *out) {
-  int i;
+// '/'-separated indices. Returns a pointer to the first character after the
+// last set of indices, or NULL on error. The out buffer must have space for 3
+// indces. The line may have leading whitespace. Resolves any negative indices
+// using the number of locations, UV coords, and normals read so far in o, and
+// records which indices were negative in each final_index field.
+static const char* ParseFace(const char *line, const char *end,
+    InternalObjectFile *o, InternalIndexMapping *out) {
+  int i, j;
   uint32_t indices[3];
+  uint32_t relative_mask;
+  uint32_t counts[3];
+  // Files with more elements than this are rejected by CheckAttributeCounts
+  // once they've been parsed.
+  counts[0] = (uint32_t) o->location_count;
+  counts[1] = (uint32_t) o->uv_coord_count;
+  counts[2] = (uint32_t) o->normal_count;
   for (i = 0; i < 3; i++) {
-    line = ParseNextIndices(line, indices);
+    line = ParseNextIndices(line, end, indices, &relative_mask);
     if (line == NULL) {
       printf("Failed parsing indices group %d/3.\n", i);
-      return 0;
+      return NULL;
+    }
+    // A relative index of -1 refers to the most recent element, so this
+    // (intentionally) wraps around to count - 1.
+    for (j = 0; j < 3; j++) {
+      if (relative_mask & (1 << j)) indices[j] += counts[j];
     }
     memcpy(out[i].index_triple, indices, sizeof(indices));
+    out[i].final_index = relative_mask;
+  }
+  return line;
+}
+
+// Starts a new sub-mesh in o at the current index, named by the text
+// following the "o" or "g" at the start of line. Returns 0 on error.
+static int StartSubMesh(const char *line, const char *end,
+    InternalObjectFile *o) {
+  ObjectFileSubMesh *sub_mesh = NULL;
+  const char *name_end = NULL;
+  size_t length;
+  if (!ReserveCapacity(&(o->arena), (void **) &(o->sub_meshes),
+    &(o->sub_mesh_capacity), o->sub_mesh_count + 1,
+    sizeof(ObjectFileSubMesh))) {
+    return 0;
+  }
+  sub_mesh = o->sub_meshes + o->sub_mesh_count;
+  memset(sub_mesh, 0, sizeof(*sub_mesh));
+  sub_mesh->first_index = o->index_count;
+  line = SkipSpaces(line + 1, end);
+  name_end = FindNewline(line, end);
+  while ((name_end > line) && ((name_end[-1] == '\r') ||
+    (name_end[-1] == ' ') || (name_end[-1] == '\t'))) {
+    name_end--;
   }
+  length = name_end - line;
+  if (length >= OBJ_MAX_NAME_LENGTH) length = OBJ_MAX_NAME_LENGTH - 1;
+  memcpy(sub_mesh->name, line, length);
+  o->sub_mesh_count++;
   return 1;
 }
 
 // Parses a single line in the object file, returning a pointer to the start
 // of the next line, or NULL on error. Updates the content of o with the
-// line's content.
-static const char* ParseLine(const char *line, InternalObjectFile *o) {
+// line's content, growing o's buffers if they're too small.
+static const char* ParseLine(const char *line, const char *end,
+    InternalObjectFile *o) {
   float parsed_floats[3];
   InternalIndexMapping parsed_indices[3];
-  line = SkipSpaces(line);
-
-  // Skip comments.
-  if (StartsWith(line, "#")) return SkipLine(line);
+  line = SkipSpaces(line, end);
 
-  // Parse a vertex location.
-  if (StartsWith(line, "v ")) {
+  switch (ClassifyLine(line, end)) {
+  case OBJ_LINE_LOCATION:
     line += 1;
-    if (!ParseFloats(3, line, parsed_floats)) {
+    if (!ParseFloats(3, line, end, parsed_floats)) {
       printf("Failed parsing vertex location.\n");
       return NULL;
     }
-    if (o->locations_read >= o->location_count) {
-      printf("Internal error: read more than expected number of locations.\n");
+    if (!ReserveCapacity(&(o->arena), (void **) &(o->locations),
+      &(o->location_capacity), o->location_count + 1, 3 * sizeof(float))) {
       return NULL;
     }
-    memcpy(o->locations + (3 * o->locations_read), parsed_floats,
+    memcpy(o->locations + (3 * o->location_count), parsed_floats,
       3 * sizeof(float));
-    o->locations_read++;
-    return SkipLine(line);
-  }
+    o->location_count++;
+    return SkipLine(line, end);
 
-  // Parse a normal.
-  if (StartsWith(line, "vn ")) {
+  case OBJ_LINE_NORMAL:
     line += 2;
-    if (!ParseFloats(3, line, parsed_floats)) {
+    if (!ParseFloats(3, line, end, parsed_floats)) {
       printf("Failed parsing normal.\n");
       return NULL;
     }
-    if (o->normals_read >= o->normal_count) {
-      printf("Internal error: read more than expected number of normals.\n");
+    if (!ReserveCapacity(&(o->arena), (void **) &(o->normals),
+      &(o->normal_capacity), o->normal_count + 1, 3 * sizeof(float))) {
       return NULL;
     }
-    memcpy(o->normals + (3 * o->normals_read), parsed_floats,
+    memcpy(o->normals + (3 * o->normal_count), parsed_floats,
       3 * sizeof(float));
-    o->normals_read++;
-    return SkipLine(line);
-  }
+    o->normal_count++;
+    return SkipLine(line, end);
 
-  if (StartsWith(line, "vt ")) {
+  case OBJ_LINE_UV:
     line += 2;
-    if (!ParseFloats(2, line, parsed_floats)) {
+    if (!ParseFloats(2, line, end, parsed_floats)) {
       printf("Failed parsing UV coords.\n");
       return NULL;
     }
-    if (o->uv_coords_read >= o->uv_coord_count) {
-      printf("Internal error: read more than expected number of UV coords.\n");
+    if (!ReserveCapacity(&(o->arena), (void **) &(o->uv_coords),
+      &(o->uv_coord_capacity), o->uv_coord_count + 1, 2 * sizeof(float))) {
       return NULL;
     }
-    memcpy(o->uv_coords + (2 * o->uv_coords_read), parsed_floats,
+    memcpy(o->uv_coords + (2 * o->uv_coord_count), parsed_floats,
       2 * sizeof(float));
-    o->uv_coords_read++;
-    return SkipLine(line);
-  }
+    o->uv_coord_count++;
+    return SkipLine(line, end);
 
-  if (StartsWith(line, "f ")) {
+  case OBJ_LINE_FACE:
     line += 1;
     memset(parsed_indices, 0, sizeof(parsed_indices));
-    if (!ParseFace(line, parsed_indices)) {
+    line = ParseFace(line, end, o, parsed_indices);
+    if (!line) {
       printf("Failed parsing face coord indices.\n");
       return NULL;
     }
-    if (o->indices_read >= o->index_count) {
-      printf("Internal error: read more than expected number of indices.\n");
+    // The counting pass checks this up front, but we need to check it here
+    // too when parsing the file in a single pass.
+    line = SkipSpaces(line, end);
+    if ((line < end) && (*line != '\n') && (*line != '\r')) {
+      printf("Found a non-triangular face.\n");
       return NULL;
     }
-    memcpy(o->indices + o->indices_read, parsed_indices,
+    if (!ReserveCapacity(&(o->arena), (void **) &(o->indices),
+      &(o->index_capacity), o->index_count + 3,
+      sizeof(InternalIndexMapping))) {
+      return NULL;
+    }
+    memcpy(o->indices + o->index_count, parsed_indices,
       sizeof(parsed_indices));
-    o->indices_read += 3;
-    return SkipLine(line);
-  }
+    o->index_count += 3;
+    return SkipLine(line, end);
+
+  case OBJ_LINE_OBJECT:
+  case OBJ_LINE_GROUP:
+    if (!StartSubMesh(line, end, o)) return NULL;
+    return SkipLine(line, end);
 
-  // Skip any unknown lines.
-  return SkipLine(line);
+  default:
+    // Skip comments and any unknown lines.
+    break;
+  }
+  return SkipLine(line, end);
 }
 
-// Populates the buffers in o with the content from the object file. Expects
-// the buffers to have been allocated already.
-static int ParseInternalObjectFile(const char *content,
+// Populates the buffers in o with the content from the object file. The
+// buffers may either be preallocated by AllocateTemporaryBuffers, or left
+// empty, in which case they'll be grown as needed.
+static int ParseInternalObjectFile(const char *content, const char *end,
     InternalObjectFile *o) {
   const char *current = content;
-  while (*current) {
-    current = ParseLine(current, o);
+  while (current < end) {
+    current = ParseLine(current, end, o);
     if (!current) {
       printf("Error parsing obj file line.\n");
       return 0;
@@ -427,8 +867,8 @@ static int InternalIndexComparator(const void *a, const void *b) {
 // Ignores any indices greater than the number of corresponding attributes in
 // the object file, leaving the ObjectFileVertex fields at 0 for the incorrect
 // or undefined attributes.
-static void CopyVertexInfo(InternalIndexMapping *indices, ObjectFileVertex *v,
-   InternalObjectFile *o) {
+static void CopyVertexInfo(const InternalIndexMapping *indices,
+    ObjectFileVertex *v, const InternalObjectFile *o) {
   uint32_t i;
   // NOTE: Should we print a warning or something if we get a nonzero index
   // that's invalid?
@@ -436,70 +876,174 @@ static void CopyVertexInfo(InternalIndexMapping *indices, ObjectFileVertex *v,
   // Location
   i = indices->index_triple[0];
   if (i < o->location_count) {
-    memcpy(v->location, o->locations + (3 * i), sizeof(v->location));
+    memcpy(v->location, o->locations + 3 * ((size_t) i),
+      sizeof(v->location));
   }
   // UV Coordinate (aka texture coordinate)
   i = indices->index_triple[1];
   if (i < o->uv_coord_count) {
-    memcpy(v->uv, o->uv_coords + (2 * i), sizeof(v->uv));
+    memcpy(v->uv, o->uv_coords + 2 * ((size_t) i), sizeof(v->uv));
   }
   // Normal
   i = indices->index_triple[2];
   if (i < o->normal_count) {
-    memcpy(v->normal, o->normals + (3 * i), sizeof(v->normal));
+    memcpy(v->normal, o->normals + 3 * ((size_t) i), sizeof(v->normal));
   }
 }
 
 // Used when traversing a binary tree of unique internal vertex mappings to
-// populate the final list of vertices and assign final indices.
+// assign final indices, and record which mapping each final vertex uses.
 static void TreeTraversalCallback(void *key, void *user_data) {
   TraversalCallbackData *data = (TraversalCallbackData *) user_data;
   InternalIndexMapping *v = (InternalIndexMapping *) key;
   v->final_index = data->next_index;
-  CopyVertexInfo(v, data->final_vertices + data->next_index, data->o);
+  data->vertex_mappings[data->next_index] = v;
   data->next_index += 1;
 }
 
-// Converts the data collected in o to the format in the ObjectFileInfo struct.
-// Returns 0 on error.
-static int ConvertInternalObjectFile(InternalObjectFile *o,
-    ObjectFileInfo *out) {
-  InternalIndexMapping *tmp = NULL;
-  ObjectFileVertex *final_vertices = NULL;
-  ScapegoatTree *vertex_set = NULL;
-  TraversalCallbackData callback_data;
-  uint32_t *final_indices = NULL;
-  uint32_t i;
+// Smaller meshes aren't worth starting threads for, so each thread building
+// final vertices or indices gets at least this many of them. Tests may define
+// a smaller value so that small meshes are still split between threads.
+#ifndef MIN_REMAP_ITEMS_PER_THREAD
+#define MIN_REMAP_ITEMS_PER_THREAD (65536)
+#endif
 
-  // Do some sanity checks to make sure the second pass was OK.
-  printf("Object file info:\n");
-  printf("  # of vertex locations: %d\n", (int) o->location_count);
-  printf("  # of normals: %d\n", (int) o->normal_count);
-  printf("  # of UV coordinates: %d\n", (int) o->uv_coord_count);
-  printf("  # of indices: %d\n", (int) o->index_count);
-  if (o->location_count != o->locations_read) {
-    printf("Expected to parse %d locations, got %d.\n",
-      (int) o->location_count, (int) o->locations_read);
+// Holds the state shared by the threads building the final vertices and
+// indices once the unique vertices are known. Each thread handles one
+// contiguous slice, so most of the output pages a thread writes are written
+// by it alone, which keeps them local to it on NUMA systems.
+typedef struct {
+  const InternalObjectFile *o;
+  // The hash table slots to copy vertices from. Used by
+  // CopySlotVerticesThread.
+  const InternalIndexMapping *slots;
+  uint64_t slot_count;
+  // The index triple of each final vertex, in order. Used by
+  // CopyMappedVerticesThread.
+  InternalIndexMapping **vertex_mappings;
+  uint32_t vertex_count;
+  // The tree to find each corner's final index in. Used by
+  // LookupTreeIndicesThread, which sets its thread's entry in thread_failed
+  // if a corner is missing.
+  ScapegoatTree *vertex_set;
+  int *thread_failed;
+  ObjectFileVertex *final_vertices;
+  uint32_t *final_indices;
+} RemapState;
+
+// Sets *start and *end to the range of count items handled by the given
+// thread.
+static void GetThreadSlice(int thread_index, int thread_count, uint64_t count,
+    uint64_t *start, uint64_t *end) {
+  *start = (count * thread_index) / thread_count;
+  *end = (count * (thread_index + 1)) / thread_count;
+}
+
+// Returns the number of threads to use for building count final vertices or
+// indices.
+static int LimitRemapThreadCount(int thread_count, uint64_t count) {
+  uint64_t max_threads = count / MIN_REMAP_ITEMS_PER_THREAD;
+  if (((uint64_t) thread_count) > max_threads) {
+    thread_count = (int) max_threads;
+  }
+  if (thread_count < 1) thread_count = 1;
+  return thread_count;
+}
+
+// Fills in the thread's slice of the final vertices from their mappings.
+static void CopyMappedVerticesThread(int thread_index, int thread_count,
+    void *user_data) {
+  RemapState *state = (RemapState *) user_data;
+  uint64_t i, start, end;
+  GetThreadSlice(thread_index, thread_count, state->vertex_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    CopyVertexInfo(state->vertex_mappings[i], state->final_vertices + i,
+      state->o);
+  }
+}
+
+// Looks up the final index of each corner in the thread's slice. The tree
+// isn't modified while searching, so the threads can share it.
+static void LookupTreeIndicesThread(int thread_index, int thread_count,
+    void *user_data) {
+  RemapState *state = (RemapState *) user_data;
+  InternalIndexMapping *m = NULL;
+  uint64_t i, start, end;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    m = (InternalIndexMapping *) ScapegoatSearch(state->vertex_set,
+      state->o->indices + i);
+    if (!m) {
+      state->thread_failed[thread_index] = 1;
+      return;
+    }
+    state->final_indices[i] = m->final_index;
+  }
+}
+
+// Makes sure that the second pass over the file found the same number of
+// elements as the counting pass. Returns 0 if any count doesn't match.
+static int CheckCountedCapacities(InternalObjectFile *o) {
+  if (o->location_count != o->location_capacity) {
+    printf("Expected to parse %llu locations, got %llu.\n",
+      (unsigned long long) o->location_capacity,
+      (unsigned long long) o->location_count);
     return 0;
   }
-  if (o->normal_count != o->normals_read) {
-    printf("Expected to parse %d normals, got %d.\n",
-      (int) o->normal_count, (int) o->normals_read);
+  if (o->normal_count != o->normal_capacity) {
+    printf("Expected to parse %llu normals, got %llu.\n",
+      (unsigned long long) o->normal_capacity,
+      (unsigned long long) o->normal_count);
     return 0;
   }
-  if (o->uv_coord_count != o->uv_coords_read) {
-    printf("Exected to parse %d UV coords, got %d.\n",
-      (int) o->uv_coord_count, (int) o->uv_coords_read);
+  if (o->uv_coord_count != o->uv_coord_capacity) {
+    printf("Exected to parse %llu UV coords, got %llu.\n",
+      (unsigned long long) o->uv_coord_capacity,
+      (unsigned long long) o->uv_coord_count);
     return 0;
   }
-  if (o->index_count != o->indices_read) {
-    printf("Expected to parse %d indices, got %d.\n", (int) o->index_count,
-      (int) o->indices_read);
+  if (o->index_count != o->index_capacity) {
+    printf("Expected to parse %llu indices, got %llu.\n",
+      (unsigned long long) o->index_capacity,
+      (unsigned long long) o->index_count);
+    return 0;
+  }
+  return 1;
+}
+
+// Makes sure that o's locations, normals, and UV coordinates can all be
+// referred to by the 32-bit indices in the file. Returns 0 if any can't.
+static int CheckAttributeCounts(InternalObjectFile *o) {
+  if ((o->location_count > UINT32_MAX) || (o->normal_count > UINT32_MAX) ||
+    (o->uv_coord_count > UINT32_MAX)) {
+    printf("Obj file contains too many elements.\n");
     return 0;
   }
+  return 1;
+}
+
+// Fills in out's vertices and indices by inserting each of o's index triples
+// into a ScapegoatTree. The final vertices are sorted by their index triples.
+// The inserts happen on one thread, but the given number of threads build the
+// final vertices and indices. Adds the time spent to timings. Returns 0 on
+// error.
+static int DeduplicateWithTree(InternalObjectFile *o, int thread_count,
+    ObjParseTimings *timings, ObjectFileInfo *out) {
+  ObjectFileVertex *final_vertices = NULL;
+  ScapegoatTree *vertex_set = NULL;
+  TraversalCallbackData callback_data;
+  RemapState state;
+  uint32_t *final_indices = NULL;
+  uint64_t i;
+  int t;
+  double start = CurrentSeconds();
+  if (thread_count < 1) thread_count = 1;
 
   // Create a tree to hold the list of unique vertices.
-  vertex_set = CreateScapegoatTree(InternalIndexComparator);
+  vertex_set = CreateScapegoatTreeInArena(InternalIndexComparator,
+    &(o->arena));
   if (!vertex_set) {
     printf("Failed creating tree to track unique vertices.\n");
     return 0;
@@ -511,20 +1055,36 @@ static int ConvertInternalObjectFile(InternalObjectFile *o,
       return 0;
     }
   }
+  timings->dedup += CurrentSeconds() - start;
+  start = CurrentSeconds();
 
-  // Traverse the tree in order to populate the list of final vertex data.
+  // Traverse the tree in order to assign final indices, and remember which
+  // mapping each final vertex came from, so the vertices can be filled in by
+  // several threads.
+  memset(&state, 0, sizeof(state));
+  state.o = o;
+  state.vertex_set = vertex_set;
+  state.vertex_count = vertex_set->tree_size;
+  state.vertex_mappings = (InternalIndexMapping **) ArenaAllocate(&(o->arena),
+    ((size_t) state.vertex_count) * sizeof(InternalIndexMapping *));
+  state.thread_failed = (int *) ArenaAllocateZeroed(&(o->arena),
+    thread_count * sizeof(int));
+  if (!state.vertex_mappings || !state.thread_failed) {
+    printf("Failed allocating final vertex mappings.\n");
+    goto fail_cleanup;
+  }
+  memset(&callback_data, 0, sizeof(callback_data));
+  callback_data.vertex_mappings = state.vertex_mappings;
+  TraverseScapegoatTree(vertex_set, TreeTraversalCallback, &callback_data);
   final_vertices = (ObjectFileVertex *) calloc(sizeof(ObjectFileVertex),
     vertex_set->tree_size);
   if (!final_vertices) {
     printf("Failed allocating list of final vertices.\n");
     goto fail_cleanup;
   }
-  // Traverse the tree in order, to create a list of final vertices and assign
-  // indices.
-  memset(&callback_data, 0, sizeof(callback_data));
-  callback_data.o = o;
-  callback_data.final_vertices = final_vertices;
-  TraverseScapegoatTree(vertex_set, TreeTraversalCallback, &callback_data);
+  state.final_vertices = final_vertices;
+  RunInParallel(LimitRemapThreadCount(thread_count, state.vertex_count),
+    CopyMappedVerticesThread, &state);
 
   // Finally, create the array of final vertex indices, in the order they were
   // in the .obj file, but with the updated single indices.
@@ -533,15 +1093,14 @@ static int ConvertInternalObjectFile(InternalObjectFile *o,
     printf("Failed allocating final index array.\n");
     goto fail_cleanup;
   }
-  for (i = 0; i < o->index_count; i++) {
-    // Search for the entry in the sorted array with the same three indices.
-    tmp = (InternalIndexMapping *) ScapegoatSearch(vertex_set, o->indices + i);
-    if (!tmp) {
-      // Sanity check for an internal error.
-      printf("Failed finding final index for internal vertex info.\n");
-      goto fail_cleanup;
-    }
-    final_indices[i] = tmp->final_index;
+  state.final_indices = final_indices;
+  RunInParallel(LimitRemapThreadCount(thread_count, o->index_count),
+    LookupTreeIndicesThread, &state);
+  for (t = 0; t < thread_count; t++) {
+    if (!state.thread_failed[t]) continue;
+    // Sanity check for an internal error.
+    printf("Failed finding final index for internal vertex info.\n");
+    goto fail_cleanup;
   }
 
   // Finally, we've identified unique location/normal/uv combinations, built
@@ -552,6 +1111,7 @@ static int ConvertInternalObjectFile(InternalObjectFile *o,
   out->vertices = final_vertices;
   out->vertex_count = vertex_set->tree_size;
   DestroyScapegoatTree(vertex_set);
+  timings->remap += CurrentSeconds() - start;
   return 1;
 
 fail_cleanup:
@@ -561,50 +1121,1506 @@ fail_cleanup:
   return 0;
 }
 
-ObjectFileInfo* ParseObjFile(const char *content) {
-  InternalObjectFile o;
-  ObjectFileInfo *to_return = NULL;
-  if (sizeof(ObjectFileVertex) != (sizeof(float) * 8)) {
-    printf("Internal error: expected exactly 8 floats per vertex struct.\n");
-    return NULL;
+// Marks an unused slot in a VertexHashTable.
+#define EMPTY_HASH_SLOT (0xffffffff)
+
+// The most slots a VertexHashTable can have. It's kept at most half full, so
+// this is enough for every final index below EMPTY_HASH_SLOT.
+#define MAX_HASH_TABLE_CAPACITY (((uint64_t) 1) << 33)
+
+// An open-addressing hash table mapping index triples to final vertex
+// indices. Each slot's final_index is EMPTY_HASH_SLOT if the slot is unused.
+typedef struct {
+  // Allocated from the arena. Old slots are left in it when the table grows.
+  MemoryArena *arena;
+  InternalIndexMapping *slots;
+  // Always a power of two.
+  uint64_t capacity;
+  // The number of used slots, which is also the next final index to assign.
+  uint32_t size;
+} VertexHashTable;
+
+// Returns a hash of the given index triple. Multiplying by large odd constants
+// spreads the (usually small and similar) indices across all of the bits, and
+// the high bits are folded in since the table only looks at the low ones.
+static uint64_t HashIndexTriple(const uint32_t *triple) {
+  uint64_t h = (((uint64_t) triple[0]) << 32) | triple[1];
+  h *= 0x9e3779b97f4a7c15ull;
+  h ^= triple[2] * 0xc2b2ae3d27d4eb4full;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 32;
+  return h;
+}
+
+// Allocates t's slots from the arena, with room for at least the given number
+// of them. Returns 0 on error.
+static int InitializeVertexHashTable(VertexHashTable *t, uint64_t capacity,
+    MemoryArena *arena) {
+  uint64_t i;
+  size_t size;
+  t->arena = arena;
+  t->capacity = 1024;
+  while ((t->capacity < capacity) &&
+    (t->capacity < MAX_HASH_TABLE_CAPACITY)) {
+    t->capacity *= 2;
   }
-  if (!content) {
-    printf("Got NULL in place of .obj file content.\n");
-    return NULL;
+  t->size = 0;
+  t->slots = NULL;
+  if (!GetBufferSize(t->capacity, sizeof(InternalIndexMapping), &size)) {
+    return 0;
   }
-  memset(&o, 0, sizeof(o));
-  if (!CountVerticesAndIndices(content, &o)) {
-    printf("Failed initial pass over object file.\n");
-    return NULL;
+  t->slots = (InternalIndexMapping *) ArenaAllocate(arena, size);
+  if (!t->slots) {
+    printf("Failed allocating vertex hash table.\n");
+    return 0;
   }
-  if (!AllocateTemporaryBuffers(&o)) {
-    printf("Failed allocating temporary buffer to hold obj content.\n");
-    return NULL;
+  for (i = 0; i < t->capacity; i++) {
+    t->slots[i].final_index = EMPTY_HASH_SLOT;
   }
-  if (!ParseInternalObjectFile(content, &o)) {
-    printf("Failed parsing object file content.\n");
-    CleanupInternalObjectFile(&o);
-    return NULL;
+  return 1;
+}
+
+// Doubles the number of slots in t, re-inserting all of the existing entries.
+// Returns 0 on error, in which case t is unchanged.
+static int GrowVertexHashTable(VertexHashTable *t) {
+  VertexHashTable bigger;
+  InternalIndexMapping *slot = NULL;
+  uint64_t i, j, mask;
+  if (t->capacity >= MAX_HASH_TABLE_CAPACITY) {
+    printf("The vertex hash table is too big.\n");
+    return 0;
   }
-  to_return = (ObjectFileInfo *) calloc(sizeof(ObjectFileInfo), 1);
-  if (!to_return) {
-    printf("Failed allocating object file.\n");
-    CleanupInternalObjectFile(&o);
-    return NULL;
+  if (!InitializeVertexHashTable(&bigger, t->capacity * 2, t->arena)) {
+    return 0;
   }
-  if (!ConvertInternalObjectFile(&o, to_return)) {
-    printf("Failed generating ObjectFileInfo struct.\n");
-    CleanupInternalObjectFile(&o);
-    free(to_return);
-    return NULL;
+  mask = bigger.capacity - 1;
+  for (i = 0; i < t->capacity; i++) {
+    slot = t->slots + i;
+    if (slot->final_index == EMPTY_HASH_SLOT) continue;
+    j = HashIndexTriple(slot->index_triple) & mask;
+    while (bigger.slots[j].final_index != EMPTY_HASH_SLOT) {
+      j = (j + 1) & mask;
+    }
+    bigger.slots[j] = *slot;
   }
-  CleanupInternalObjectFile(&o);
-  return to_return;
+  bigger.size = t->size;
+  *t = bigger;
+  return 1;
 }
 
-void FreeObjectFileInfo(ObjectFileInfo *o) {
-  free(o->vertices);
-  free(o->indices);
-  memset(o, 0, sizeof(*o));
-  free(o);
+// Returns the final index of the vertex with the given index triple, adding
+// it to the table with the next final index if it isn't there yet. Returns
+// EMPTY_HASH_SLOT on error.
+static uint32_t FindOrInsertVertex(VertexHashTable *t,
+    const uint32_t *triple) {
+  InternalIndexMapping *slot = NULL;
+  uint64_t i, mask;
+  // Keep the table at most half full, so probe sequences stay short.
+  if ((t->size >= (t->capacity / 2)) && !GrowVertexHashTable(t)) {
+    return EMPTY_HASH_SLOT;
+  }
+  mask = t->capacity - 1;
+  i = HashIndexTriple(triple) & mask;
+  while (1) {
+    slot = t->slots + i;
+    if (slot->final_index == EMPTY_HASH_SLOT) break;
+    if ((slot->index_triple[0] == triple[0]) &&
+      (slot->index_triple[1] == triple[1]) &&
+      (slot->index_triple[2] == triple[2])) {
+      return slot->final_index;
+    }
+    i = (i + 1) & mask;
+  }
+  if (t->size == EMPTY_HASH_SLOT) {
+    printf("The obj file contains too many unique vertices.\n");
+    return EMPTY_HASH_SLOT;
+  }
+  memcpy(slot->index_triple, triple, sizeof(slot->index_triple));
+  slot->final_index = t->size;
+  t->size++;
+  return slot->final_index;
+}
+
+// Fills in the final vertex for each used slot in the thread's slice of the
+// hash table.
+static void CopySlotVerticesThread(int thread_index, int thread_count,
+    void *user_data) {
+  RemapState *state = (RemapState *) user_data;
+  const InternalIndexMapping *slot = NULL;
+  uint64_t i, start, end;
+  GetThreadSlice(thread_index, thread_count, state->slot_count, &start, &end);
+  for (i = start; i < end; i++) {
+    slot = state->slots + i;
+    if (slot->final_index == EMPTY_HASH_SLOT) continue;
+    CopyVertexInfo(slot, state->final_vertices + slot->final_index, state->o);
+  }
+}
+
+// Fills in final_vertices, which must be zeroed, with the vertex for each
+// used slot in t, using up to thread_count threads.
+static void CopyHashTableVertices(const VertexHashTable *t,
+    const InternalObjectFile *o, ObjectFileVertex *final_vertices,
+    int thread_count) {
+  RemapState state;
+  memset(&state, 0, sizeof(state));
+  state.o = o;
+  state.slots = t->slots;
+  state.slot_count = t->capacity;
+  state.final_vertices = final_vertices;
+  RunInParallel(LimitRemapThreadCount(thread_count, t->capacity),
+    CopySlotVerticesThread, &state);
+}
+
+// Fills in out's vertices and indices using a hash table of index triples.
+// Final indices are assigned as each triple is first seen, so the vertices end
+// up in the order they're first used by the faces, and each index only needs
+// a single lookup. That order depends on every earlier lookup, so only copying
+// the final vertices uses the given number of threads. Adds the time spent to
+// timings. Returns 0 on error.
+static int DeduplicateWithHash(InternalObjectFile *o, int thread_count,
+    ObjParseTimings *timings, ObjectFileInfo *out) {
+  VertexHashTable table;
+  ObjectFileVertex *final_vertices = NULL;
+  uint32_t *final_indices = NULL;
+  uint64_t i, initial_capacity;
+  size_t size;
+  double start = CurrentSeconds();
+
+  // Most files have about as many unique vertices as locations, so start
+  // with enough room for that, but there can't be more than one per index.
+  initial_capacity = o->location_count;
+  if (initial_capacity > o->index_count) initial_capacity = o->index_count;
+  if (!InitializeVertexHashTable(&table, initial_capacity * 2,
+    &(o->arena))) {
+    return 0;
+  }
+  if (!GetBufferSize(o->index_count, sizeof(uint32_t), &size)) return 0;
+  final_indices = (uint32_t *) malloc(size);
+  if (!final_indices) {
+    printf("Failed allocating final index array.\n");
+    goto fail_cleanup;
+  }
+  for (i = 0; i < o->index_count; i++) {
+    final_indices[i] = FindOrInsertVertex(&table, o->indices[i].index_triple);
+    if (final_indices[i] == EMPTY_HASH_SLOT) {
+      printf("Failed adding vertex to hash table.\n");
+      goto fail_cleanup;
+    }
+  }
+  timings->dedup += CurrentSeconds() - start;
+  start = CurrentSeconds();
+
+  final_vertices = (ObjectFileVertex *) calloc(sizeof(ObjectFileVertex),
+    table.size);
+  if (!final_vertices) {
+    printf("Failed allocating list of final vertices.\n");
+    goto fail_cleanup;
+  }
+  CopyHashTableVertices(&table, o, final_vertices, thread_count);
+
+  out->indices = final_indices;
+  out->index_count = o->index_count;
+  out->vertices = final_vertices;
+  out->vertex_count = table.size;
+  timings->remap += CurrentSeconds() - start;
+  return 1;
+
+fail_cleanup:
+  free(final_indices);
+  free(final_vertices);
+  return 0;
+}
+
+// The number of bits sorted by each pass of the radix sort in
+// DeduplicateWithSort.
+#define RADIX_BITS (8)
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Holds the state shared by the threads in DeduplicateWithSort.
+typedef struct {
+  InternalObjectFile *o;
+  int thread_count;
+  // Each corner's packed index triple, and the corner's position in the
+  // file, sorted by the radix sort. The *_tmp arrays are the scatter targets
+  // for each pass, and are swapped with the others after it.
+  uint64_t *keys;
+  uint64_t *keys_tmp;
+  uint32_t *corners;
+  uint32_t *corners_tmp;
+  // The number of bits to shift the uv and location indices by when packing
+  // them into a key. The normal index is in the lowest bits.
+  int uv_shift;
+  int location_shift;
+  // The shift of the digit being sorted by the current radix sort pass.
+  int digit_shift;
+  // Holds three maximum indices (location, uv, normal) per thread.
+  uint32_t *thread_max;
+  // Holds RADIX_BUCKETS counts per thread. After the prefix sum, each entry
+  // holds the position where the thread puts its first key with that digit.
+  uint32_t *histograms;
+  // The number of unique keys starting in each thread's slice, and then the
+  // number starting before each thread's slice, after the prefix sum.
+  uint32_t *thread_runs;
+  ObjectFileVertex *final_vertices;
+  uint32_t *final_indices;
+} SortDedupState;
+
+// Finds the largest location, uv, and normal indices in the thread's slice
+// of the corners.
+static void FindMaxIndicesThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  uint32_t *max = state->thread_max + 3 * thread_index;
+  InternalIndexMapping *m = NULL;
+  uint64_t i, start, end;
+  uint32_t j;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  max[0] = 0;
+  max[1] = 0;
+  max[2] = 0;
+  for (i = start; i < end; i++) {
+    m = state->o->indices + i;
+    for (j = 0; j < 3; j++) {
+      if (m->index_triple[j] > max[j]) max[j] = m->index_triple[j];
+    }
+  }
+}
+
+// Packs the thread's slice of the corners into keys. Keys compare in the same
+// order as the index triples, so the sorted output matches the tree engine.
+static void BuildSortKeysThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  InternalIndexMapping *m = NULL;
+  uint64_t i, start, end;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    m = state->o->indices + i;
+    state->keys[i] = (((uint64_t) m->index_triple[0]) <<
+      state->location_shift) | (((uint64_t) m->index_triple[1]) <<
+      state->uv_shift) | m->index_triple[2];
+    state->corners[i] = i;
+  }
+}
+
+// Counts the digits in the thread's slice of the keys for the current pass.
+static void RadixHistogramThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  uint32_t *histogram = state->histograms + RADIX_BUCKETS * thread_index;
+  uint64_t i, start, end;
+  int shift = state->digit_shift;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  memset(histogram, 0, RADIX_BUCKETS * sizeof(uint32_t));
+  for (i = start; i < end; i++) {
+    histogram[(state->keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+  }
+}
+
+// Moves the thread's slice of the keys to their positions for the current
+// pass. Each thread's keys with a given digit go after those of the earlier
+// threads, so the sort stays stable.
+static void RadixScatterThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  uint32_t *positions = state->histograms + RADIX_BUCKETS * thread_index;
+  uint64_t i, start, end;
+  uint32_t dst;
+  int shift = state->digit_shift;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    dst = positions[(state->keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+    state->keys_tmp[dst] = state->keys[i];
+    state->corners_tmp[dst] = state->corners[i];
+  }
+}
+
+// Counts the number of unique keys starting in the thread's slice of the
+// sorted keys.
+static void CountSortedRunsThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  uint64_t i, start, end;
+  uint32_t runs = 0;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    if ((i == 0) || (state->keys[i] != state->keys[i - 1])) runs++;
+  }
+  state->thread_runs[thread_index] = runs;
+}
+
+// Assigns final indices to the thread's slice of the sorted keys, and fills
+// in the final vertex for each unique key starting in the slice.
+static void AssignSortedIndicesThread(int thread_index, int thread_count,
+    void *user_data) {
+  SortDedupState *state = (SortDedupState *) user_data;
+  uint64_t i, start, end;
+  uint32_t corner;
+  // This wraps around to UINT32_MAX if no keys precede the slice, but the
+  // first key is always the start of a run, so it's never used that way.
+  uint32_t current = state->thread_runs[thread_index] - 1;
+  GetThreadSlice(thread_index, thread_count, state->o->index_count, &start,
+    &end);
+  for (i = start; i < end; i++) {
+    corner = state->corners[i];
+    if ((i == 0) || (state->keys[i] != state->keys[i - 1])) {
+      current++;
+      CopyVertexInfo(state->o->indices + corner, state->final_vertices +
+        current, state->o);
+    }
+    state->final_indices[corner] = current;
+  }
+}
+
+// Returns the number of bits needed to hold the given value.
+static int BitsNeeded(uint32_t v) {
+  if (v == 0) return 0;
+  return 32 - __builtin_clz(v);
+}
+
+// Fills in out's vertices and indices by packing each corner's index triple
+// into a 64-bit key and radix sorting the keys across the given number of
+// threads. The final vertices are sorted by index triple, like the tree
+// engine. Falls back to the hash engine if the triples don't fit in 64 bits,
+// or if there are too many corners to number with 32 bits. Adds the time
+// spent to timings. Returns 0 on error.
+static int DeduplicateWithSort(InternalObjectFile *o, int thread_count,
+    ObjParseTimings *timings, ObjectFileInfo *out) {
+  SortDedupState state;
+  uint64_t *tmp_keys = NULL;
+  uint32_t *tmp_corners = NULL;
+  uint32_t i, max[3], sum, tmp, unique_count;
+  int t, normal_bits, key_bits, digit;
+  double start;
+  if (o->index_count == 0) {
+    return DeduplicateWithHash(o, thread_count, timings, out);
+  }
+  if (o->index_count > UINT32_MAX) {
+    printf("Too many indices to sort, using a hash table.\n");
+    return DeduplicateWithHash(o, thread_count, timings, out);
+  }
+  start = CurrentSeconds();
+  if (thread_count < 1) thread_count = 1;
+  memset(&state, 0, sizeof(state));
+  state.o = o;
+  state.thread_count = thread_count;
+  state.thread_max = (uint32_t *) ArenaAllocateZeroed(&(o->arena),
+    thread_count * 3 * sizeof(uint32_t));
+  state.histograms = (uint32_t *) ArenaAllocateZeroed(&(o->arena),
+    thread_count * RADIX_BUCKETS * sizeof(uint32_t));
+  state.thread_runs = (uint32_t *) ArenaAllocateZeroed(&(o->arena),
+    thread_count * sizeof(uint32_t));
+  if (!state.thread_max || !state.histograms || !state.thread_runs) {
+    printf("Failed allocating radix sort state.\n");
+    goto fail_cleanup;
+  }
+
+  // Only use as many bits for each index as the file needs.
+  RunInParallel(thread_count, FindMaxIndicesThread, &state);
+  memset(max, 0, sizeof(max));
+  for (t = 0; t < thread_count; t++) {
+    for (i = 0; i < 3; i++) {
+      if (state.thread_max[3 * t + i] > max[i]) {
+        max[i] = state.thread_max[3 * t + i];
+      }
+    }
+  }
+  normal_bits = BitsNeeded(max[2]);
+  state.uv_shift = normal_bits;
+  state.location_shift = normal_bits + BitsNeeded(max[1]);
+  key_bits = state.location_shift + BitsNeeded(max[0]);
+  if (key_bits > 64) {
+    printf("Index triples don't fit in 64 bits, using a hash table.\n");
+    timings->dedup += CurrentSeconds() - start;
+    return DeduplicateWithHash(o, thread_count, timings, out);
+  }
+
+  state.keys = (uint64_t *) ArenaAllocate(&(o->arena),
+    ((size_t) o->index_count) * sizeof(uint64_t));
+  state.keys_tmp = (uint64_t *) ArenaAllocate(&(o->arena),
+    ((size_t) o->index_count) * sizeof(uint64_t));
+  state.corners = (uint32_t *) ArenaAllocate(&(o->arena),
+    ((size_t) o->index_count) * sizeof(uint32_t));
+  state.corners_tmp = (uint32_t *) ArenaAllocate(&(o->arena),
+    ((size_t) o->index_count) * sizeof(uint32_t));
+  state.final_indices = (uint32_t *) malloc(o->index_count *
+    sizeof(uint32_t));
+  if (!state.keys || !state.keys_tmp || !state.corners ||
+    !state.corners_tmp || !state.final_indices) {
+    printf("Failed allocating radix sort buffers.\n");
+    goto fail_cleanup;
+  }
+  RunInParallel(thread_count, BuildSortKeysThread, &state);
+
+  // Sort by each digit, starting from the least significant one.
+  for (digit = 0; digit < key_bits; digit += RADIX_BITS) {
+    state.digit_shift = digit;
+    RunInParallel(thread_count, RadixHistogramThread, &state);
+    // Convert the counts to starting positions: all keys with a smaller
+    // digit come first, followed by keys with the same digit from earlier
+    // threads.
+    sum = 0;
+    for (i = 0; i < RADIX_BUCKETS; i++) {
+      for (t = 0; t < thread_count; t++) {
+        tmp = state.histograms[RADIX_BUCKETS * t + i];
+        state.histograms[RADIX_BUCKETS * t + i] = sum;
+        sum += tmp;
+      }
+    }
+    RunInParallel(thread_count, RadixScatterThread, &state);
+    tmp_keys = state.keys;
+    state.keys = state.keys_tmp;
+    state.keys_tmp = tmp_keys;
+    tmp_corners = state.corners;
+    state.corners = state.corners_tmp;
+    state.corners_tmp = tmp_corners;
+  }
+
+  // Number the runs of equal keys using a prefix sum of each thread's count.
+  RunInParallel(thread_count, CountSortedRunsThread, &state);
+  unique_count = 0;
+  for (t = 0; t < thread_count; t++) {
+    tmp = state.thread_runs[t];
+    state.thread_runs[t] = unique_count;
+    unique_count += tmp;
+  }
+  timings->dedup += CurrentSeconds() - start;
+  start = CurrentSeconds();
+  state.final_vertices = (ObjectFileVertex *) calloc(sizeof(ObjectFileVertex),
+    unique_count);
+  if (!state.final_vertices) {
+    printf("Failed allocating list of final vertices.\n");
+    goto fail_cleanup;
+  }
+  RunInParallel(thread_count, AssignSortedIndicesThread, &state);
+
+  out->indices = state.final_indices;
+  out->index_count = o->index_count;
+  out->vertices = state.final_vertices;
+  out->vertex_count = unique_count;
+  timings->remap += CurrentSeconds() - start;
+  return 1;
+
+fail_cleanup:
+  free(state.final_indices);
+  free(state.final_vertices);
+  return 0;
+}
+
+// Converts the data collected in o to the format in the ObjectFileInfo struct,
+// using the given method to find unique vertices, with up to thread_count
+// threads. Adds the time spent to timings. Returns 0 on error.
+static int ConvertInternalObjectFile(InternalObjectFile *o,
+    ObjDedupEngine dedup_engine, int thread_count, ObjParseTimings *timings,
+    ObjectFileInfo *out) {
+  printf("Object file info:\n");
+  printf("  # of vertex locations: %llu\n",
+    (unsigned long long) o->location_count);
+  printf("  # of normals: %llu\n", (unsigned long long) o->normal_count);
+  printf("  # of UV coordinates: %llu\n",
+    (unsigned long long) o->uv_coord_count);
+  printf("  # of indices: %llu\n", (unsigned long long) o->index_count);
+  if (!CheckAttributeCounts(o)) return 0;
+  switch (dedup_engine) {
+  case OBJ_DEDUP_HASH:
+    return DeduplicateWithHash(o, thread_count, timings, out);
+  case OBJ_DEDUP_TREE:
+    return DeduplicateWithTree(o, thread_count, timings, out);
+  case OBJ_DEDUP_SORT:
+    return DeduplicateWithSort(o, thread_count, timings, out);
+  }
+  printf("Invalid vertex deduplication engine: %d\n", (int) dedup_engine);
+  return 0;
+}
+
+// Fills in o, which must be zeroed apart from its arena's settings, with the
+// content between start and end. If count_first is nonzero, makes a counting
+// pass over the content before parsing it. Adds the time spent to timings.
+// Returns 0 on error, in which case o will be cleaned up.
+static int ParseContent(const char *start, const char *end, int count_first,
+    ObjParseTimings *timings, InternalObjectFile *o) {
+  double phase_start = CurrentSeconds();
+  if (count_first) {
+    if (!CountVerticesAndIndices(start, end, o)) {
+      printf("Failed initial pass over object file.\n");
+      return 0;
+    }
+    if (!AllocateTemporaryBuffers(o)) {
+      printf("Failed allocating temporary buffer to hold obj content.\n");
+      CleanupInternalObjectFile(o);
+      return 0;
+    }
+    timings->count += CurrentSeconds() - phase_start;
+    phase_start = CurrentSeconds();
+  }
+  if (!ParseInternalObjectFile(start, end, o)) {
+    printf("Failed parsing object file content.\n");
+    CleanupInternalObjectFile(o);
+    return 0;
+  }
+  if (count_first && !CheckCountedCapacities(o)) {
+    CleanupInternalObjectFile(o);
+    return 0;
+  }
+  timings->parse += CurrentSeconds() - phase_start;
+  return 1;
+}
+
+// Raises the peak usage recorded in memory_usage to the given number of bytes
+// used and reserved, if they're higher.
+static void UpdateMemoryUsage(ObjParseMemoryUsage *memory_usage, size_t used,
+    size_t reserved) {
+  if (used > memory_usage->peak_used_bytes) {
+    memory_usage->peak_used_bytes = used;
+  }
+  if (reserved > memory_usage->peak_reserved_bytes) {
+    memory_usage->peak_reserved_bytes = reserved;
+  }
+}
+
+// Files smaller than this many bytes per thread aren't worth splitting up.
+#define MIN_BYTES_PER_PARSING_THREAD (1024 * 1024)
+
+// Holds one thread's portion of a file being parsed by multiple threads.
+typedef struct {
+  // The chunk of the file content. Always starts at the beginning of a line.
+  const char *start;
+  const char *end;
+  // The content parsed from this chunk, using chunk-local numbering.
+  InternalObjectFile o;
+  // The number of locations, UV coords, normals, and indices in all earlier
+  // chunks. Used to place this chunk's content in the merged arrays.
+  uint64_t location_offset;
+  uint64_t uv_coord_offset;
+  uint64_t normal_offset;
+  uint64_t index_offset;
+  uint64_t sub_mesh_offset;
+  // The time this chunk's thread spent in each phase.
+  ObjParseTimings timings;
+  // The size of this chunk's arena, recorded before it's freed.
+  size_t arena_used_bytes;
+  size_t arena_reserved_bytes;
+  // Set to nonzero if this chunk was parsed successfully.
+  int success;
+} ObjFileChunk;
+
+// Holds the state shared by the threads parsing a single file.
+typedef struct {
+  ObjFileChunk *chunks;
+  int count_first;
+  // The combined output, filled in by the merge phase.
+  InternalObjectFile *merged;
+} ParallelParseState;
+
+// Run by each thread to parse its own chunk of the file.
+static void ParseChunkThread(int thread_index, int thread_count,
+    void *user_data) {
+  ParallelParseState *state = (ParallelParseState *) user_data;
+  ObjFileChunk *chunk = state->chunks + thread_index;
+  (void) thread_count;
+  chunk->success = ParseContent(chunk->start, chunk->end, state->count_first,
+    &(chunk->timings), &(chunk->o));
+}
+
+// Run by each thread to copy its chunk's content into the merged arrays.
+// Positive face indices already use the file's global numbering, but any
+// negative ones were resolved against this chunk's local counts, so they need
+// to be shifted by the number of elements in earlier chunks.
+static void MergeChunkThread(int thread_index, int thread_count,
+    void *user_data) {
+  ParallelParseState *state = (ParallelParseState *) user_data;
+  ObjFileChunk *chunk = state->chunks + thread_index;
+  InternalObjectFile *merged = state->merged;
+  InternalIndexMapping *indices = merged->indices + chunk->index_offset;
+  ObjectFileSubMesh *sub_meshes = merged->sub_meshes +
+    chunk->sub_mesh_offset;
+  uint64_t i;
+  uint32_t relative_mask;
+  (void) thread_count;
+  // A chunk may have none of some kind of element, in which case its array is
+  // NULL, and passing NULL to memcpy is undefined even for 0 bytes.
+  if (chunk->o.location_count != 0) {
+    memcpy(merged->locations + 3 * chunk->location_offset, chunk->o.locations,
+      chunk->o.location_count * 3 * sizeof(float));
+  }
+  if (chunk->o.uv_coord_count != 0) {
+    memcpy(merged->uv_coords + 2 * chunk->uv_coord_offset, chunk->o.uv_coords,
+      chunk->o.uv_coord_count * 2 * sizeof(float));
+  }
+  if (chunk->o.normal_count != 0) {
+    memcpy(merged->normals + 3 * chunk->normal_offset, chunk->o.normals,
+      chunk->o.normal_count * 3 * sizeof(float));
+  }
+  if (chunk->o.index_count != 0) {
+    memcpy(indices, chunk->o.indices, chunk->o.index_count *
+      sizeof(InternalIndexMapping));
+  }
+  for (i = 0; i < chunk->o.index_count; i++) {
+    relative_mask = indices[i].final_index;
+    if (relative_mask & 1) indices[i].index_triple[0] += chunk->location_offset;
+    if (relative_mask & 2) indices[i].index_triple[1] += chunk->uv_coord_offset;
+    if (relative_mask & 4) indices[i].index_triple[2] += chunk->normal_offset;
+  }
+  // Any faces before the chunk's first "o" or "g" line just continue the
+  // previous chunk's last sub-mesh.
+  if (chunk->o.sub_mesh_count != 0) {
+    memcpy(sub_meshes, chunk->o.sub_meshes, chunk->o.sub_mesh_count *
+      sizeof(ObjectFileSubMesh));
+  }
+  for (i = 0; i < chunk->o.sub_mesh_count; i++) {
+    sub_meshes[i].first_index += chunk->index_offset;
+  }
+  chunk->arena_used_bytes = chunk->o.arena.used_bytes;
+  chunk->arena_reserved_bytes = chunk->o.arena.reserved_bytes;
+  CleanupInternalObjectFile(&(chunk->o));
+}
+
+// Splits the content into thread_count chunks at line boundaries, parses each
+// chunk on a separate thread, and merges the results into o, which must be
+// zeroed apart from its arena's settings. Each chunk's arena uses the same
+// settings. Adds the time spent to timings, and raises memory_usage to the
+// size of the chunks' arenas and o's together, since they're all held until
+// the merge is done. Returns 0 on error.
+static int ParseContentInParallel(const char *data, const char *end,
+    int thread_count, int count_first, ObjParseTimings *timings,
+    ObjParseMemoryUsage *memory_usage, InternalObjectFile *o) {
+  ParallelParseState state;
+  ObjFileChunk *chunks = NULL;
+  ObjFileChunk *chunk = NULL;
+  size_t length = end - data, used, reserved;
+  double start = CurrentSeconds(), count_time = 0.0;
+  int i, success = 1;
+  chunks = (ObjFileChunk *) calloc(thread_count, sizeof(ObjFileChunk));
+  if (!chunks) {
+    printf("Failed allocating obj file chunks.\n");
+    return 0;
+  }
+  for (i = 0; i < thread_count; i++) {
+    chunks[i].o.arena.use_huge_pages = o->arena.use_huge_pages;
+    if (i == 0) {
+      chunks[i].start = data;
+    } else {
+      // Start each chunk at the first line beginning after its even share of
+      // the file.
+      chunks[i].start = SkipLine(data + (length / thread_count) * i, end);
+      if (chunks[i].start < chunks[i - 1].start) {
+        chunks[i].start = chunks[i - 1].start;
+      }
+      chunks[i - 1].end = chunks[i].start;
+    }
+  }
+  chunks[thread_count - 1].end = end;
+  memset(&state, 0, sizeof(state));
+  state.chunks = chunks;
+  state.count_first = count_first;
+  state.merged = o;
+  RunInParallel(thread_count, ParseChunkThread, &state);
+
+  // Compute where each chunk's content goes in the merged arrays.
+  for (i = 0; i < thread_count; i++) {
+    chunk = chunks + i;
+    if (!chunk->success) success = 0;
+    if (chunk->timings.count > count_time) count_time = chunk->timings.count;
+    chunk->location_offset = o->location_count;
+    chunk->uv_coord_offset = o->uv_coord_count;
+    chunk->normal_offset = o->normal_count;
+    chunk->index_offset = o->index_count;
+    chunk->sub_mesh_offset = o->sub_mesh_count;
+    o->location_count += chunk->o.location_count;
+    o->uv_coord_count += chunk->o.uv_coord_count;
+    o->normal_count += chunk->o.normal_count;
+    o->index_count += chunk->o.index_count;
+    o->sub_mesh_count += chunk->o.sub_mesh_count;
+  }
+  // Chunks' relative indices are shifted using 32-bit arithmetic, which is
+  // only correct if the offsets fit.
+  if (success && !CheckAttributeCounts(o)) success = 0;
+  if (success) {
+    o->location_capacity = o->location_count;
+    o->uv_coord_capacity = o->uv_coord_count;
+    o->normal_capacity = o->normal_count;
+    o->index_capacity = o->index_count;
+    o->sub_mesh_capacity = o->sub_mesh_count;
+    if (!AllocateTemporaryBuffers(o)) {
+      printf("Failed allocating buffers for merged obj content.\n");
+      success = 0;
+    }
+  }
+  if (!success) {
+    for (i = 0; i < thread_count; i++) {
+      CleanupInternalObjectFile(&(chunks[i].o));
+    }
+    free(chunks);
+    CleanupInternalObjectFile(o);
+    return 0;
+  }
+  RunInParallel(thread_count, MergeChunkThread, &state);
+  used = o->arena.used_bytes;
+  reserved = o->arena.reserved_bytes;
+  for (i = 0; i < thread_count; i++) {
+    used += chunks[i].arena_used_bytes;
+    reserved += chunks[i].arena_reserved_bytes;
+  }
+  UpdateMemoryUsage(memory_usage, used, reserved);
+  free(chunks);
+  timings->count += count_time;
+  timings->parse += CurrentSeconds() - start - count_time;
+  return 1;
+}
+
+// Returns the number of threads to use for parsing a file of the given size.
+static int ChooseParsingThreadCount(const ObjParseOptions *options,
+    size_t length) {
+  size_t max_threads = length / MIN_BYTES_PER_PARSING_THREAD;
+  int to_return = options->thread_count;
+  if (to_return > 0) return to_return;
+  to_return = GetCPUCount();
+  if (((size_t) to_return) > max_threads) to_return = (int) max_threads;
+  if (to_return < 1) to_return = 1;
+  return to_return;
+}
+
+// Sets min and max to the corners of the vertices' bounding box. There must
+// be at least one vertex.
+static void ComputeBoundingBox(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, float *min, float *max) {
+#ifdef OBJ_SCAN_X86
+  // Each vertex starts with its location, so one unaligned load gets the
+  // location along with the first component of the normal, which is ignored.
+  __m128 low = _mm_loadu_ps(vertices[0].data);
+  __m128 high = low, v;
+  float tmp[4];
+  uint32_t i;
+  for (i = 1; i < vertex_count; i++) {
+    v = _mm_loadu_ps(vertices[i].data);
+    low = _mm_min_ps(low, v);
+    high = _mm_max_ps(high, v);
+  }
+  _mm_storeu_ps(tmp, low);
+  memcpy(min, tmp, 3 * sizeof(float));
+  _mm_storeu_ps(tmp, high);
+  memcpy(max, tmp, 3 * sizeof(float));
+#else
+  const float *v = NULL;
+  uint32_t i;
+  int j;
+  memcpy(min, vertices[0].location, 3 * sizeof(float));
+  memcpy(max, vertices[0].location, 3 * sizeof(float));
+  for (i = 1; i < vertex_count; i++) {
+    v = vertices[i].location;
+    for (j = 0; j < 3; j++) {
+      if (v[j] < min[j]) min[j] = v[j];
+      if (v[j] > max[j]) max[j] = v[j];
+    }
+  }
+#endif
+}
+
+// Returns the squared distance between two points.
+static float SquaredDistance(const float *a, const float *b) {
+  float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+  return x * x + y * y + z * z;
+}
+
+// Returns the index of the vertex farthest from the given point.
+static uint32_t FarthestVertex(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, const float *point) {
+  uint32_t i, farthest = 0;
+  float d, max_distance = -1.0f;
+  for (i = 0; i < vertex_count; i++) {
+    d = SquaredDistance(vertices[i].location, point);
+    if (d <= max_distance) continue;
+    max_distance = d;
+    farthest = i;
+  }
+  return farthest;
+}
+
+// Grows the given sphere just enough to contain each vertex in turn, moving
+// its center towards any vertex outside it (Ritter, 1990).
+static void GrowSphere(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, float *center, float *radius) {
+  const float *v = NULL;
+  float d, new_radius, shift;
+  uint32_t i;
+  int j;
+  for (i = 0; i < vertex_count; i++) {
+    v = vertices[i].location;
+    d = SquaredDistance(v, center);
+    if (d <= (*radius * *radius)) continue;
+    d = sqrtf(d);
+    new_radius = (*radius + d) * 0.5f;
+    shift = (new_radius - *radius) / d;
+    for (j = 0; j < 3; j++) center[j] += (v[j] - center[j]) * shift;
+    *radius = new_radius;
+  }
+}
+
+void ComputeObjectFileBounds(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, ObjectFileBounds *bounds) {
+  const float *a = NULL, *b = NULL;
+  float center[3], radius = 0.0f, d;
+  uint32_t i;
+  int j;
+  memset(bounds, 0, sizeof(*bounds));
+  if (vertex_count == 0) return;
+  ComputeBoundingBox(vertices, vertex_count, bounds->min, bounds->max);
+  // First, try the sphere around the box's center.
+  for (j = 0; j < 3; j++) {
+    bounds->center[j] = (bounds->min[j] + bounds->max[j]) * 0.5f;
+  }
+  for (i = 0; i < vertex_count; i++) {
+    d = SquaredDistance(vertices[i].location, bounds->center);
+    if (d > radius) radius = d;
+  }
+  bounds->radius = sqrtf(radius);
+  // Next, try Ritter's sphere, which is usually tighter for meshes that are
+  // stretched along a direction other than the axes: start with the sphere
+  // between two distant vertices, and grow it to contain the rest.
+  a = vertices[FarthestVertex(vertices, vertex_count,
+    vertices[0].location)].location;
+  b = vertices[FarthestVertex(vertices, vertex_count, a)].location;
+  for (j = 0; j < 3; j++) center[j] = (a[j] + b[j]) * 0.5f;
+  radius = sqrtf(SquaredDistance(a, b)) * 0.5f;
+  GrowSphere(vertices, vertex_count, center, &radius);
+  if (radius < bounds->radius) {
+    memcpy(bounds->center, center, sizeof(center));
+    bounds->radius = radius;
+  }
+  // Rounding while moving the center can leave vertices a tiny distance
+  // outside the sphere, so make sure every one is inside.
+  radius = bounds->radius * bounds->radius;
+  for (i = 0; i < vertex_count; i++) {
+    d = SquaredDistance(vertices[i].location, bounds->center);
+    if (d > radius) radius = d;
+  }
+  bounds->radius = sqrtf(radius) * (1.0f + FLT_EPSILON);
+}
+
+// Appends sub-meshes with the given name, covering index_count indices
+// starting at first_index, to the sub_meshes array, which holds *count of
+// them. The range is split into as many sub-meshes as it takes to keep each
+// one's index count at or below OBJ_MAX_SUB_MESH_INDICES. If sub_meshes is
+// NULL, only updates *count.
+static void AppendSubMeshRange(const char *name, uint64_t first_index,
+    uint64_t index_count, ObjectFileSubMesh *sub_meshes, uint64_t *count) {
+  ObjectFileSubMesh *s = NULL;
+  uint64_t part;
+  while (index_count > 0) {
+    part = index_count;
+    if (part > OBJ_MAX_SUB_MESH_INDICES) part = OBJ_MAX_SUB_MESH_INDICES;
+    if (sub_meshes) {
+      s = sub_meshes + *count;
+      memset(s, 0, sizeof(*s));
+      strncpy(s->name, name, sizeof(s->name) - 1);
+      s->first_index = first_index;
+      s->index_count = (uint32_t) part;
+    }
+    first_index += part;
+    index_count -= part;
+    *count += 1;
+  }
+}
+
+// Fills in info's sub-meshes from the ones started in o, covering the
+// index_count indices parsed from the file. Faces before the first "o" or "g"
+// line get an unnamed sub-mesh, sub-meshes without faces are dropped, and
+// ones that are too big are split up. Returns 0 on error.
+static int BuildSubMeshes(const InternalObjectFile *o, uint64_t index_count,
+    ObjectFileInfo *info) {
+  ObjectFileSubMesh *sub_meshes = NULL;
+  uint64_t i, end, count = 0;
+  int pass;
+  info->sub_meshes = NULL;
+  info->sub_mesh_count = 0;
+  if (index_count == 0) return 1;
+  // The first pass only counts the sub-meshes, and the second fills them in.
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      if (count > UINT32_MAX) {
+        printf("Obj file contains too many sub-meshes.\n");
+        return 0;
+      }
+      sub_meshes = (ObjectFileSubMesh *) calloc(count,
+        sizeof(ObjectFileSubMesh));
+      if (!sub_meshes) {
+        printf("Failed allocating obj sub-meshes.\n");
+        return 0;
+      }
+      count = 0;
+    }
+    end = index_count;
+    if (o->sub_mesh_count > 0) end = o->sub_meshes[0].first_index;
+    AppendSubMeshRange("", 0, end, sub_meshes, &count);
+    for (i = 0; i < o->sub_mesh_count; i++) {
+      end = index_count;
+      if ((i + 1) < o->sub_mesh_count) end = o->sub_meshes[i + 1].first_index;
+      AppendSubMeshRange(o->sub_meshes[i].name, o->sub_meshes[i].first_index,
+        end - o->sub_meshes[i].first_index, sub_meshes, &count);
+    }
+  }
+  info->sub_meshes = sub_meshes;
+  info->sub_mesh_count = (uint32_t) count;
+  return 1;
+}
+
+// Runs OptimizeVertexCache on each of info's sub-meshes separately, so that
+// triangles never move between them. Each sub-mesh's vertices are numbered
+// from 0 while it's optimized, so the time taken doesn't depend on the number
+// of sub-meshes. Returns 0 on error.
+static int OptimizeSubMeshVertexCache(ObjectFileInfo *info) {
+  ObjectFileSubMesh *s = NULL;
+  uint32_t *local_index = NULL, *global_index = NULL, *local_indices = NULL;
+  uint32_t *indices = NULL;
+  uint32_t i, j, v, local_count, max_index_count = 0;
+  int to_return = 0;
+  // A lone sub-mesh covers every index, so the count fits in 32 bits.
+  if (info->sub_mesh_count <= 1) {
+    return OptimizeVertexCache(info->indices, (uint32_t) info->index_count,
+      info->vertex_count, DEFAULT_VERTEX_CACHE_SIZE);
+  }
+  for (i = 0; i < info->sub_mesh_count; i++) {
+    s = info->sub_meshes + i;
+    if (s->index_count > max_index_count) max_index_count = s->index_count;
+  }
+  local_index = (uint32_t *) malloc(info->vertex_count * sizeof(uint32_t));
+  global_index = (uint32_t *) malloc(max_index_count * sizeof(uint32_t));
+  local_indices = (uint32_t *) malloc(max_index_count * sizeof(uint32_t));
+  if (!local_index || !global_index || !local_indices) {
+    printf("Failed allocating sub-mesh vertex numbering.\n");
+    goto cleanup;
+  }
+  memset(local_index, 0xff, info->vertex_count * sizeof(uint32_t));
+  for (i = 0; i < info->sub_mesh_count; i++) {
+    s = info->sub_meshes + i;
+    indices = info->indices + s->first_index;
+    local_count = 0;
+    for (j = 0; j < s->index_count; j++) {
+      v = indices[j];
+      if (local_index[v] == UINT32_MAX) {
+        local_index[v] = local_count;
+        global_index[local_count] = v;
+        local_count++;
+      }
+      local_indices[j] = local_index[v];
+    }
+    if (!OptimizeVertexCache(local_indices, s->index_count, local_count,
+      DEFAULT_VERTEX_CACHE_SIZE)) {
+      goto cleanup;
+    }
+    for (j = 0; j < s->index_count; j++) {
+      indices[j] = global_index[local_indices[j]];
+    }
+    for (j = 0; j < local_count; j++) local_index[global_index[j]] = UINT32_MAX;
+  }
+  to_return = 1;
+cleanup:
+  free(local_index);
+  free(global_index);
+  free(local_indices);
+  return to_return;
+}
+
+// Runs the vertex cache and vertex fetch optimizations requested in options
+// on the parsed file, and adds the time spent to timings. Returns 0 on error.
+static int OptimizeObjectFileInfo(ObjectFileInfo *info,
+    const ObjParseOptions *options, ObjParseTimings *timings) {
+  double start = CurrentSeconds();
+  if (options->optimize_vertex_cache && !OptimizeSubMeshVertexCache(info)) {
+    printf("Failed optimizing obj file for the vertex cache.\n");
+    return 0;
+  }
+  if (options->optimize_vertex_fetch && !OptimizeVertexFetch(info->vertices,
+    info->vertex_count, sizeof(ObjectFileVertex), info->indices,
+    info->index_count)) {
+    printf("Failed optimizing obj file for vertex fetches.\n");
+    return 0;
+  }
+  timings->optimize += CurrentSeconds() - start;
+  return 1;
+}
+
+// Welds info's vertices and removes degenerate and duplicate triangles from
+// each of its sub-meshes, if options asks for it. Sub-meshes and vertices
+// left unused are dropped. vertex_groups may be NULL, or hold each vertex's
+// group for GenerateParsedNormals, which is kept in step with the vertices.
+// Adds the time spent to timings. Returns 0 on error.
+static int WeldObjectFileInfo(ObjectFileInfo *info,
+    const ObjParseOptions *options, uint32_t *vertex_groups,
+    ObjParseTimings *timings) {
+  ObjectFileSubMesh s;
+  uint64_t kept_indices = 0;
+  uint32_t i, count, kept_sub_meshes = 0;
+  double start = CurrentSeconds();
+  if (!options->weld_vertices) return 1;
+  if (!WeldVertices(info->vertices, &(info->vertex_count), info->indices,
+    info->index_count, options->weld_epsilon, vertex_groups)) {
+    printf("Failed welding obj file vertices.\n");
+    return 0;
+  }
+  for (i = 0; i < info->sub_mesh_count; i++) {
+    s = info->sub_meshes[i];
+    count = s.index_count;
+    if (!RemoveDegenerateTriangles(info->vertices, info->indices +
+      s.first_index, &count, options->weld_epsilon)) {
+      printf("Failed removing degenerate triangles from obj file.\n");
+      return 0;
+    }
+    if (count == 0) continue;
+    memmove(info->indices + kept_indices, info->indices + s.first_index,
+      ((size_t) count) * sizeof(uint32_t));
+    s.first_index = kept_indices;
+    s.index_count = count;
+    info->sub_meshes[kept_sub_meshes] = s;
+    kept_indices += count;
+    kept_sub_meshes++;
+  }
+  info->index_count = kept_indices;
+  info->sub_mesh_count = kept_sub_meshes;
+  if (!RemoveUnusedVertices(info->vertices, &(info->vertex_count),
+    info->indices, info->index_count, vertex_groups)) {
+    printf("Failed removing unused obj file vertices.\n");
+    return 0;
+  }
+  timings->weld += CurrentSeconds() - start;
+  return 1;
+}
+
+// Returns the location index in o used by the given index triple, or
+// o->location_count if the index isn't valid.
+static uint32_t GetLocationGroup(const InternalObjectFile *o,
+    const InternalIndexMapping *m) {
+  uint32_t i = m->index_triple[0];
+  // CheckAttributeCounts makes sure the location count fits in 32 bits.
+  if (i >= o->location_count) return (uint32_t) o->location_count;
+  return i;
+}
+
+// Generates smooth normals for info's vertices, for files like o, which info
+// was built from, that don't have any. vertex_locations holds each vertex's
+// group from GetLocationGroup, so every copy of a location gets the same
+// normal. Adds the time spent to timings. Returns 0 on error.
+static int GenerateParsedNormals(ObjectFileInfo *info,
+    const InternalObjectFile *o, const uint32_t *vertex_locations,
+    int thread_count, ObjParseTimings *timings) {
+  double start = CurrentSeconds();
+  if (!GenerateSmoothNormals(info->vertices, info->vertex_count,
+    info->indices, info->index_count, vertex_locations, o->location_count + 1,
+    thread_count)) {
+    printf("Failed generating normals for obj file.\n");
+    return 0;
+  }
+  timings->normals += CurrentSeconds() - start;
+  return 1;
+}
+
+// Fills in info's tangents, if options asks for them. This must happen after
+// the vertices are reordered. Adds the time spent to timings. Returns 0 on
+// error.
+static int GenerateParsedTangents(ObjectFileInfo *info,
+    const ObjParseOptions *options, int thread_count,
+    ObjParseTimings *timings) {
+  double start = CurrentSeconds();
+  if (!options->generate_tangents) return 1;
+  info->tangents = (float *) malloc((((size_t) info->vertex_count) + 1) * 4 *
+    sizeof(float));
+  if (!info->tangents) {
+    printf("Failed allocating obj file tangents.\n");
+    return 0;
+  }
+  if (!GenerateTangents(info->vertices, info->vertex_count, info->indices,
+    info->index_count, info->tangents, thread_count)) {
+    printf("Failed generating tangents for obj file.\n");
+    return 0;
+  }
+  timings->normals += CurrentSeconds() - start;
+  return 1;
+}
+
+ObjectFileInfo* ParseObjFile(const char *content) {
+  if (!content) {
+    printf("Got NULL in place of .obj file content.\n");
+    return NULL;
+  }
+  return ParseObjFileN(content, strlen(content));
+}
+
+ObjectFileInfo* ParseObjFileN(const char *data, size_t length) {
+  ObjParseOptions options;
+  memset(&options, 0, sizeof(options));
+  return ParseObjFileWithOptions(data, length, &options);
+}
+
+ObjectFileInfo* ParseObjFileWithOptions(const char *data, size_t length,
+    const ObjParseOptions *options) {
+  InternalObjectFile o;
+  ObjParseTimings timings;
+  ObjParseMemoryUsage memory_usage;
+  ObjectFileInfo *to_return = NULL;
+  uint32_t *vertex_locations = NULL;
+  const char *end = data + length;
+  double start;
+  uint64_t i;
+  int thread_count, generate_normals;
+  if (sizeof(ObjectFileVertex) != (sizeof(float) * 8)) {
+    printf("Internal error: expected exactly 8 floats per vertex struct.\n");
+    return NULL;
+  }
+  if (!data) {
+    printf("Got NULL in place of .obj file content.\n");
+    return NULL;
+  }
+  InitializeLineScanner();
+  memset(&o, 0, sizeof(o));
+  memset(&timings, 0, sizeof(timings));
+  memset(&memory_usage, 0, sizeof(memory_usage));
+  o.arena.use_huge_pages = options->use_huge_pages;
+  thread_count = ChooseParsingThreadCount(options, length);
+  if (thread_count > 1) {
+    if (!ParseContentInParallel(data, end, thread_count, options->count_first,
+      &timings, &memory_usage, &o)) {
+      return NULL;
+    }
+  } else if (!ParseContent(data, end, options->count_first, &timings, &o)) {
+    return NULL;
+  }
+  to_return = (ObjectFileInfo *) calloc(sizeof(ObjectFileInfo), 1);
+  if (!to_return) {
+    printf("Failed allocating object file.\n");
+    CleanupInternalObjectFile(&o);
+    return NULL;
+  }
+  if (!ConvertInternalObjectFile(&o, options->dedup_engine, thread_count,
+    &timings, to_return)) {
+    printf("Failed generating ObjectFileInfo struct.\n");
+    CleanupInternalObjectFile(&o);
+    free(to_return);
+    return NULL;
+  }
+  if (!BuildSubMeshes(&o, o.index_count, to_return)) goto fail;
+  generate_normals = options->generate_normals && (o.normal_count == 0);
+  if (generate_normals) {
+    vertex_locations = (uint32_t *) ArenaAllocateZeroed(&(o.arena),
+      (((size_t) to_return->vertex_count) + 1) * sizeof(uint32_t));
+    if (!vertex_locations) {
+      printf("Failed allocating vertex locations.\n");
+      goto fail;
+    }
+    for (i = 0; i < o.index_count; i++) {
+      vertex_locations[to_return->indices[i]] = GetLocationGroup(&o,
+        o.indices + i);
+    }
+  }
+  if (!WeldObjectFileInfo(to_return, options, vertex_locations, &timings)) {
+    goto fail;
+  }
+  if (generate_normals && !GenerateParsedNormals(to_return, &o,
+    vertex_locations, thread_count, &timings)) {
+    goto fail;
+  }
+  UpdateMemoryUsage(&memory_usage, o.arena.used_bytes,
+    o.arena.reserved_bytes);
+  CleanupInternalObjectFile(&o);
+  start = CurrentSeconds();
+  ComputeObjectFileBounds(to_return->vertices, to_return->vertex_count,
+    &(to_return->bounds));
+  timings.remap += CurrentSeconds() - start;
+  if (!OptimizeObjectFileInfo(to_return, options, &timings) ||
+    !GenerateParsedTangents(to_return, options, thread_count, &timings)) {
+    FreeObjectFileInfo(to_return);
+    return NULL;
+  }
+  if (options->timings) *(options->timings) = timings;
+  if (options->memory_usage) *(options->memory_usage) = memory_usage;
+  return to_return;
+
+fail:
+  CleanupInternalObjectFile(&o);
+  FreeObjectFileInfo(to_return);
+  return NULL;
+}
+
+void FreeObjectFileInfo(ObjectFileInfo *o) {
+  free(o->vertices);
+  free(o->indices);
+  free(o->sub_meshes);
+  free(o->tangents);
+  memset(o, 0, sizeof(*o));
+  free(o);
+}
+
+struct ObjStreamParser {
+  ObjParseOptions options;
+  ObjParseTimings timings;
+  // Holds the locations, normals, and UV coordinates parsed so far. The
+  // indices buffer only holds the faces parsed since the last call to
+  // DeduplicateStreamedIndices.
+  InternalObjectFile o;
+  // Maps each index triple seen so far to its final vertex. Its slots are in
+  // o's arena.
+  VertexHashTable table;
+  // The final indices of every face parsed so far.
+  uint32_t *final_indices;
+  uint64_t final_index_count;
+  uint64_t final_index_capacity;
+  // Holds the start of a line that was split across chunks, until the rest
+  // of it arrives.
+  char *partial_line;
+  size_t partial_line_size;
+  size_t partial_line_capacity;
+  // Set if an earlier call failed, after which every call fails.
+  int failed;
+};
+
+ObjStreamParser* CreateObjStreamParser(const ObjParseOptions *options) {
+  ObjStreamParser *p = NULL;
+  p = (ObjStreamParser *) calloc(1, sizeof(*p));
+  if (!p) {
+    printf("Failed allocating obj stream parser.\n");
+    return NULL;
+  }
+  p->options = *options;
+  p->o.arena.use_huge_pages = options->use_huge_pages;
+  if (!InitializeVertexHashTable(&(p->table), 0, &(p->o.arena))) {
+    free(p);
+    return NULL;
+  }
+  InitializeLineScanner();
+  return p;
+}
+
+void DestroyObjStreamParser(ObjStreamParser *p) {
+  if (!p) return;
+  CleanupInternalObjectFile(&(p->o));
+  free(p->final_indices);
+  free(p->partial_line);
+  memset(p, 0, sizeof(*p));
+  free(p);
+}
+
+// Looks up the final vertex for each face corner parsed since the last call,
+// appending them to p's final indices, and empties p's internal index buffer
+// so it can be reused for the next chunk. Returns 0 on error.
+static int DeduplicateStreamedIndices(ObjStreamParser *p) {
+  InternalObjectFile *o = &(p->o);
+  uint64_t i;
+  uint32_t final_index;
+  double start = CurrentSeconds();
+  if (!ReserveCapacity(NULL, (void **) &(p->final_indices),
+    &(p->final_index_capacity), p->final_index_count + o->index_count,
+    sizeof(uint32_t))) {
+    return 0;
+  }
+  for (i = 0; i < o->index_count; i++) {
+    final_index = FindOrInsertVertex(&(p->table), o->indices[i].index_triple);
+    if (final_index == EMPTY_HASH_SLOT) {
+      printf("Failed adding vertex to hash table.\n");
+      return 0;
+    }
+    p->final_indices[p->final_index_count + i] = final_index;
+  }
+  p->final_index_count += o->index_count;
+  o->index_count = 0;
+  p->timings.dedup += CurrentSeconds() - start;
+  return 1;
+}
+
+// Parses the given content, which must only contain complete lines, and
+// deduplicates its faces. Returns 0 on error.
+static int ParseStreamedLines(ObjStreamParser *p, const char *start,
+    const char *end) {
+  double parse_start = CurrentSeconds();
+  uint64_t i = p->o.sub_mesh_count;
+  if (!ParseInternalObjectFile(start, end, &(p->o))) return 0;
+  // The internal index buffer only holds this chunk's faces, so make the new
+  // sub-meshes' first indices count every earlier face, too.
+  for (; i < p->o.sub_mesh_count; i++) {
+    p->o.sub_meshes[i].first_index += p->final_index_count;
+  }
+  p->timings.parse += CurrentSeconds() - parse_start;
+  return DeduplicateStreamedIndices(p);
+}
+
+// Appends the given data to p's partial line. Returns 0 on error.
+static int AppendPartialLine(ObjStreamParser *p, const char *data,
+    size_t length) {
+  size_t new_capacity = p->partial_line_capacity;
+  char *new_buffer = NULL;
+  // The buffer may not be allocated yet, and memcpy mustn't get NULL.
+  if (length == 0) return 1;
+  if ((p->partial_line_size + length) > p->partial_line_capacity) {
+    if (new_capacity < 256) new_capacity = 256;
+    while (new_capacity < (p->partial_line_size + length)) new_capacity *= 2;
+    new_buffer = (char *) realloc(p->partial_line, new_capacity);
+    if (!new_buffer) {
+      printf("Failed allocating buffer for a partial obj line.\n");
+      return 0;
+    }
+    p->partial_line = new_buffer;
+    p->partial_line_capacity = new_capacity;
+  }
+  memcpy(p->partial_line + p->partial_line_size, data, length);
+  p->partial_line_size += length;
+  return 1;
+}
+
+int FeedObjStreamParser(ObjStreamParser *p, const char *data,
+    size_t length) {
+  const char *end = data + length;
+  const char *first_line_end = NULL, *last_line_end = NULL;
+  if (p->failed) return 0;
+  if (length == 0) return 1;
+  first_line_end = FindNewline(data, end);
+  // Finish the line left over from the last chunk, if there is one.
+  if (p->partial_line_size > 0) {
+    if (first_line_end == end) {
+      if (!AppendPartialLine(p, data, length)) goto fail;
+      return 1;
+    }
+    if (!AppendPartialLine(p, data, first_line_end + 1 - data)) goto fail;
+    if (!ParseStreamedLines(p, p->partial_line, p->partial_line +
+      p->partial_line_size)) {
+      goto fail;
+    }
+    p->partial_line_size = 0;
+    data = first_line_end + 1;
+  }
+  // Parse every complete line, and save whatever follows the last newline
+  // for the next chunk.
+  last_line_end = end;
+  while ((last_line_end > data) && (last_line_end[-1] != '\n')) {
+    last_line_end--;
+  }
+  if ((last_line_end > data) && !ParseStreamedLines(p, data,
+    last_line_end)) {
+    goto fail;
+  }
+  if (!AppendPartialLine(p, last_line_end, end - last_line_end)) goto fail;
+  return 1;
+
+fail:
+  p->failed = 1;
+  return 0;
+}
+
+ObjectFileInfo* FinishObjStreamParser(ObjStreamParser *p) {
+  ObjParseMemoryUsage memory_usage;
+  ObjectFileInfo *to_return = NULL;
+  InternalIndexMapping *slot = NULL;
+  uint32_t *vertex_locations = NULL;
+  uint64_t i;
+  double start;
+  int generate_normals;
+  int thread_count = p->options.thread_count;
+  if (thread_count < 1) thread_count = GetCPUCount();
+  if (p->failed) goto fail;
+  // The last line doesn't need to end with a newline.
+  if ((p->partial_line_size > 0) && !ParseStreamedLines(p, p->partial_line,
+    p->partial_line + p->partial_line_size)) {
+    goto fail;
+  }
+  if (!CheckAttributeCounts(&(p->o))) goto fail;
+  start = CurrentSeconds();
+  to_return = (ObjectFileInfo *) calloc(1, sizeof(ObjectFileInfo));
+  if (!to_return) {
+    printf("Failed allocating object file.\n");
+    goto fail;
+  }
+  to_return->vertices = (ObjectFileVertex *) calloc(p->table.size,
+    sizeof(ObjectFileVertex));
+  if (!to_return->vertices && (p->table.size > 0)) {
+    printf("Failed allocating list of final vertices.\n");
+    goto fail;
+  }
+  to_return->vertex_count = p->table.size;
+  CopyHashTableVertices(&(p->table), &(p->o), to_return->vertices,
+    thread_count);
+  // The parser gives up its final indices, so they aren't copied.
+  to_return->indices = p->final_indices;
+  to_return->index_count = p->final_index_count;
+  p->final_indices = NULL;
+  if (!BuildSubMeshes(&(p->o), to_return->index_count, to_return)) {
+    goto fail;
+  }
+  p->timings.remap += CurrentSeconds() - start;
+  generate_normals = p->options.generate_normals && (p->o.normal_count == 0);
+  if (generate_normals) {
+    vertex_locations = (uint32_t *) ArenaAllocateZeroed(&(p->o.arena),
+      (((size_t) to_return->vertex_count) + 1) * sizeof(uint32_t));
+    if (!vertex_locations) {
+      printf("Failed allocating vertex locations.\n");
+      goto fail;
+    }
+    for (i = 0; i < p->table.capacity; i++) {
+      slot = p->table.slots + i;
+      if (slot->final_index == EMPTY_HASH_SLOT) continue;
+      vertex_locations[slot->final_index] = GetLocationGroup(&(p->o), slot);
+    }
+  }
+  if (!WeldObjectFileInfo(to_return, &(p->options), vertex_locations,
+    &(p->timings))) {
+    goto fail;
+  }
+  if (generate_normals && !GenerateParsedNormals(to_return, &(p->o),
+    vertex_locations, thread_count, &(p->timings))) {
+    goto fail;
+  }
+  memory_usage.peak_used_bytes = p->o.arena.used_bytes;
+  memory_usage.peak_reserved_bytes = p->o.arena.reserved_bytes;
+  CleanupInternalObjectFile(&(p->o));
+  start = CurrentSeconds();
+  ComputeObjectFileBounds(to_return->vertices, to_return->vertex_count,
+    &(to_return->bounds));
+  p->timings.remap += CurrentSeconds() - start;
+  if (!OptimizeObjectFileInfo(to_return, &(p->options), &(p->timings)) ||
+    !GenerateParsedTangents(to_return, &(p->options), thread_count,
+    &(p->timings))) {
+    goto fail;
+  }
+  if (p->options.timings) *(p->options.timings) = p->timings;
+  if (p->options.memory_usage) *(p->options.memory_usage) = memory_usage;
+  DestroyObjStreamParser(p);
+  return to_return;
+
+fail:
+  if (to_return) FreeObjectFileInfo(to_return);
+  DestroyObjStreamParser(p);
+  return NULL;
+}
+
+// The number of bytes ParseObjStream reads at a time.
+#define OBJ_STREAM_READ_SIZE (1024 * 1024)
+
+ObjectFileInfo* ParseObjStream(FILE *f, const ObjParseOptions *options) {
+  ObjStreamParser *p = NULL;
+  char *buffer = NULL;
+  size_t bytes_read;
+  buffer = (char *) malloc(OBJ_STREAM_READ_SIZE);
+  if (!buffer) {
+    printf("Failed allocating obj stream read buffer.\n");
+    return NULL;
+  }
+  p = CreateObjStreamParser(options);
+  if (!p) {
+    free(buffer);
+    return NULL;
+  }
+  while (1) {
+    bytes_read = fread(buffer, 1, OBJ_STREAM_READ_SIZE, f);
+    if (!FeedObjStreamParser(p, buffer, bytes_read)) break;
+    if (bytes_read < OBJ_STREAM_READ_SIZE) break;
+  }
+  free(buffer);
+  if (ferror(f)) {
+    printf("Failed reading obj stream.\n");
+    DestroyObjStreamParser(p);
+    return NULL;
+  }
+  return FinishObjStreamParser(p);
 }
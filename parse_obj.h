@@ -1,12 +1,15 @@
 // Defines a very simple library for parsing Wavefront .obj 3D files. This only
-// supports files containing triangulated faces and a single object.
+// supports files containing triangulated faces. Files may contain multiple
+// objects or groups, which all share one list of vertices and indices.
 
 #ifndef PARSE_OBJ_H
 #define PARSE_OBJ_H
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // Holds a single vertex, keeping track of the location, normal, and UV
 // coordinates, respectively. Must contain exactly 8 floats.
@@ -19,26 +22,213 @@ typedef union {
   float data[8];
 } ObjectFileVertex;
 
+// Holds volumes containing every vertex location in a mesh. Both are all
+// zeros for a mesh without any vertices.
+typedef struct {
+  // The corners of the axis-aligned bounding box.
+  float min[3];
+  float max[3];
+  // A bounding sphere. This isn't necessarily the smallest possible one, but
+  // it's usually within a few percent.
+  float center[3];
+  float radius;
+} ObjectFileBounds;
+
+// The longest object or group name kept in an ObjectFileSubMesh, including
+// the null terminator. Longer names are truncated.
+#define OBJ_MAX_NAME_LENGTH (64)
+
+// The most indices in a single ObjectFileSubMesh: the largest multiple of 3
+// that a GLsizei can hold, so each sub-mesh can be drawn with one call.
+#define OBJ_MAX_SUB_MESH_INDICES (0x7ffffffe)
+
+// Describes one object or group in a parsed file: a contiguous range of its
+// indices. An object or group with more than OBJ_MAX_SUB_MESH_INDICES indices
+// is split into several consecutive sub-meshes with the same name.
+typedef struct {
+  uint64_t first_index;
+  uint32_t index_count;
+  // The name on the "o" or "g" line starting this part of the file. Empty for
+  // faces before the first such line.
+  char name[OBJ_MAX_NAME_LENGTH];
+} ObjectFileSubMesh;
+
 // Holds information from a parsed object file. Allocated and initialized by
 // the ParseObjFile function.
 typedef struct {
   // A list of vertices in the object file. Merges normals, UV coords, etc,
-  // into new vertices, even if vertices have the same location.
+  // into new vertices, even if vertices have the same location. Since the
+  // indices are 32 bits, there are fewer than 2^32 of these.
   ObjectFileVertex *vertices;
   uint32_t vertex_count;
   // Holds the list of indices to form the triangles.
   uint32_t *indices;
-  // The number of indices. Will always be divisible by 3.
-  uint32_t index_count;
+  // The number of indices. Will always be divisible by 3. Large scans can
+  // have more than 2^32 of these, even though each one fits in 32 bits.
+  uint64_t index_count;
+  // The bounds of the vertices' locations.
+  ObjectFileBounds bounds;
+  // Each "o" or "g" line in the file starts a new sub-mesh, covering the
+  // faces up to the next one. Sub-meshes without any faces are left out, so
+  // they cover every index in order, without any gaps. Empty if the file has
+  // no faces.
+  ObjectFileSubMesh *sub_meshes;
+  uint32_t sub_mesh_count;
+  // If tangents were requested, holds 4 floats per vertex: the tangent,
+  // followed by the bitangent's sign. See GenerateTangents in mesh_normals.h.
+  // NULL otherwise.
+  float *tangents;
 } ObjectFileInfo;
 
-// Parses an object file. Only ever returns the first object in the file.
-// The object must only have triangular faces. Requires the full file content
-// followed by a null character. Allocates and returns an ObjectFileInfo struct
-// with the data. The returned struct must be freed by the caller, using
-// FreeObjectFileInfo, when no longer needed.
+// The ways ParseObjFileWithOptions can find the unique combinations of
+// location, normal, and UV coordinate used by a file's faces.
+typedef enum {
+  // An open-addressing hash table. Vertices are in the order they're first
+  // used by the faces.
+  OBJ_DEDUP_HASH = 0,
+  // A ScapegoatTree of index triples. This is slower, but vertices are sorted
+  // by their location, UV, and normal indices in the file.
+  OBJ_DEDUP_TREE = 1,
+  // Packs each corner's indices into a 64-bit key and radix sorts them,
+  // using the same number of threads as parsing. This has no hash collisions
+  // and more predictable memory access than the hash table, which can help
+  // with very large files. Vertices are in the same order as OBJ_DEDUP_TREE.
+  OBJ_DEDUP_SORT = 2,
+} ObjDedupEngine;
+
+// Holds the time, in seconds, ParseObjFileWithOptions spent in each phase of
+// parsing a file. When multiple threads parse separate chunks, count is the
+// longest any thread spent counting, and parse covers the rest of the time
+// until the chunks were merged.
+typedef struct {
+  // The initial pass counting the elements in the file, if count_first was
+  // set.
+  double count;
+  // Reading the locations, normals, UV coordinates and index triples.
+  double parse;
+  // Finding the unique combinations of location, normal, and UV coordinate.
+  double dedup;
+  // Building the final vertex array, pointing each index at it, and
+  // computing the bounds.
+  double remap;
+  // Reordering for the vertex cache and vertex fetches, if requested.
+  double optimize;
+  // Welding vertices and removing degenerate triangles, if requested.
+  double weld;
+  // Generating normals and tangents, if requested.
+  double normals;
+} ObjParseTimings;
+
+// Reports how much memory the parser's arenas used for temporary buffers. See
+// memory_arena.h. When a file is parsed by several threads, this includes
+// every thread's arena.
+typedef struct {
+  // The most bytes handed out at once, including alignment padding.
+  size_t peak_used_bytes;
+  // The most bytes allocated from the OS at once.
+  size_t peak_reserved_bytes;
+} ObjParseMemoryUsage;
+
+// Options controlling how ParseObjFileWithOptions processes a file. A
+// zero-initialized struct selects the default behavior.
+typedef struct {
+  // If nonzero, make an initial pass over the file to count the vertices,
+  // normals, etc., and allocate exactly-sized buffers before parsing. By
+  // default, the file is parsed in a single pass, with buffers that grow as
+  // needed.
+  int count_first;
+  // The number of threads to use. Each thread parses a separate chunk of the
+  // file, and the results are merged afterwards. If this is 0, the number of
+  // threads is chosen based on the file size and number of CPUs.
+  int thread_count;
+  // The method used to find unique vertices. Defaults to OBJ_DEDUP_HASH.
+  ObjDedupEngine dedup_engine;
+  // If nonzero, merge vertices whose attributes are all within weld_epsilon
+  // of each other, then remove degenerate and duplicate triangles from each
+  // sub-mesh, along with any sub-meshes and vertices left unused. See
+  // mesh_weld.h. With an epsilon of 0, this only merges exact copies and
+  // removes zero-area triangles.
+  int weld_vertices;
+  float weld_epsilon;
+  // If nonzero, reorder the triangles to make better use of the GPU's
+  // post-transform vertex cache. See OptimizeVertexCache in mesh_optimizer.h.
+  // Triangles are only reordered within each sub-mesh.
+  int optimize_vertex_cache;
+  // If nonzero, renumber the vertices in the order the faces first use them,
+  // after any vertex cache optimization. See OptimizeVertexFetch in
+  // mesh_optimizer.h.
+  int optimize_vertex_fetch;
+  // If nonzero, and the file doesn't contain any "vn" lines, generate smooth
+  // normals. Every vertex with the same location gets the same normal. See
+  // GenerateSmoothNormals in mesh_normals.h.
+  int generate_normals;
+  // If nonzero, fill in the tangents in the ObjectFileInfo struct. These
+  // are only meaningful if the file has normals and UV coordinates, or
+  // generate_normals is set.
+  int generate_tangents;
+  // If nonzero, ask the OS to back the large temporary buffers used while
+  // parsing with transparent huge pages. Ignored where this isn't supported.
+  int use_huge_pages;
+  // If this isn't NULL, it's filled in with the time spent in each phase.
+  ObjParseTimings *timings;
+  // If this isn't NULL, it's filled in with the memory used for temporary
+  // buffers.
+  ObjParseMemoryUsage *memory_usage;
+} ObjParseOptions;
+
+// Parses an object file. Every object and group in the file is returned as a
+// sub-mesh of a single ObjectFileInfo. Faces must be triangular. Requires the
+// full file content followed by a null character. Allocates and returns an
+// ObjectFileInfo struct with the data. The returned struct must be freed by
+// the caller, using FreeObjectFileInfo, when no longer needed.
 ObjectFileInfo* ParseObjFile(const char *file_content);
 
+// The same as ParseObjFile, but takes the length of the file content, in
+// bytes, rather than requiring a null terminator. Never reads past the given
+// length, so the content may be, for example, a read-only memory-mapped file.
+ObjectFileInfo* ParseObjFileN(const char *data, size_t length);
+
+// The same as ParseObjFileN, but takes a set of options controlling how the
+// file is parsed. The options must not be NULL.
+ObjectFileInfo* ParseObjFileWithOptions(const char *data, size_t length,
+    const ObjParseOptions *options);
+
+// Parses an object file incrementally, from chunks of any size, such as the
+// ones returned by successive calls to read(). Lines may be split across
+// chunks. Faces are deduplicated as they arrive, so the file content never
+// needs to be in memory all at once, and the per-corner data is discarded
+// after each chunk. Vertices are always deduplicated with OBJ_DEDUP_HASH on a
+// single thread, so the result matches ParseObjFileWithOptions with that
+// engine; the count_first and dedup_engine options are ignored, and
+// thread_count is only used for generating normals and tangents.
+typedef struct ObjStreamParser ObjStreamParser;
+
+// Creates a new stream parser with the given options, which must not be
+// NULL. Returns NULL on error.
+ObjStreamParser* CreateObjStreamParser(const ObjParseOptions *options);
+
+// Parses the next length bytes of the file. Returns 0 on error, after which
+// the parser can only be destroyed.
+int FeedObjStreamParser(ObjStreamParser *p, const char *data, size_t length);
+
+// Parses whatever remains after the last chunk, and returns the parsed file,
+// which must be freed using FreeObjectFileInfo. Destroys the parser, even on
+// error. Returns NULL on error.
+ObjectFileInfo* FinishObjStreamParser(ObjStreamParser *p);
+
+// Frees a stream parser without finishing it. Does nothing if p is NULL.
+void DestroyObjStreamParser(ObjStreamParser *p);
+
+// Parses an object file by reading f, which may be a pipe such as stdin,
+// until the end of the file, using a stream parser. Returns NULL on error.
+ObjectFileInfo* ParseObjStream(FILE *f, const ObjParseOptions *options);
+
+// Computes the bounding box and a bounding sphere of the given vertices'
+// locations. The parser calls this itself, but it's also useful for vertices
+// loaded some other way.
+void ComputeObjectFileBounds(const ObjectFileVertex *vertices,
+    uint32_t vertex_count, ObjectFileBounds *bounds);
+
 // Frees any memory used by the given ObjectFileInfo struct along with the
 // struct itself. (The pointer will be invalid after calling this.)
 void FreeObjectFileInfo(ObjectFileInfo *o);
@@ -0,0 +1,460 @@
+// This defines tests for the number scanners in parse_obj.c. ParseNextFloat
+// must give bit-identical results to strtof, and stop at the same character,
+// for every float an obj file might contain, so it's compared against strtof
+// over a list of edge cases and a large number of random strings. The scanners
+// are static, so this includes parse_obj.c directly rather than linking it.
+//
+// It also checks that splitting a file into chunks doesn't change the result:
+// a generated file is parsed with several thread counts, with and without
+// count_first, with each dedup engine, and by the stream parser fed in chunks
+// of several sizes, and every result is compared with a single-threaded parse.
+// The minimum number of vertices or indices per thread is lowered so that the
+// final vertices and the tree engine's index lookups are also split between
+// threads, even for such a small file.
+//
+// Usage: ./parse_obj_test [random string count (default 2000000)]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Split the final vertices and indices of even the small test files between
+// threads. Must come before including parse_obj.c.
+#define MIN_REMAP_ITEMS_PER_THREAD (64)
+#include "parse_obj.c"
+
+// Floats that are likely to trip up the fast path: signed zeros, long
+// mantissas, exponents at the edges of the fast path and of the float range,
+// the boundary between normal and denormal floats, and incomplete exponents.
+static const char *float_edge_cases[] = {
+  "0", "-0", "+0", "-0.0", "0.000000", "-0e0", "0e-99999", ".5", "-.5",
+  "5.", "1", "-1", "+1.25E-2", "1.5e+3", "0.1", "-0.123456", "1e", "1e+",
+  "1e-", "2E", "16777215", "16777216", "16777217", "16777218", "16777219",
+  "167772170", "-33554431", "9007199254740993", "1e10", "1e-10", "1e11",
+  "1e-11", "16777216e10", "16777217e-10", "0.0000000001", "10000000000",
+  "100000000000", "1000000.000000", "123456789012345678901234567890",
+  "0.1234567890123456789012345", "1.00000005960464477539062500000001",
+  "1.000000059604644775390625", "0.99999997019767761230468750",
+  "3.4028234e38", "3.40282347e+38", "3.4028235e38", "3.40282357e38",
+  "3.4028236e38", "1e38", "1e39", "-1e39", "1e100000", "1e-100000",
+  "1.17549435e-38", "1.1754942e-38", "1.17549421e-38", "1.1754943e-38",
+  "1.401298464e-45", "1.4e-45", "7.006492e-46", "7.006493e-46", "7e-46",
+  "1e-45", "1e-46", "-1.401298464e-45", "4.9406564584124654e-324",
+  "00000000000000000000000000001", "0.00000000000000000000000000001",
+  "1.0000000000000000000001", "18446744073709551615",
+  "18446744073709551616", "92233720368547758080", "9999999999999999999",
+  "99999999999999999999",
+  "0.30000001192092896", "4.2949673e9", "-2.5e-3", "6.02214076e23",
+};
+
+// Holds the state of a small xorshift random number generator, so every run
+// tests the same strings.
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+// Returns the next pseudorandom number.
+static uint32_t NextRandom(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return (uint32_t) (random_state >> 32);
+}
+
+// Appends count random decimal digits to s, returning the new end of s.
+static char* AppendDigits(char *s, int count) {
+  int i;
+  for (i = 0; i < count; i++) *(s++) = '0' + (NextRandom() % 10);
+  return s;
+}
+
+// Fills s, which must have room for 64 chars, with a random float in one of
+// the forms an obj file might use. Most look like "-0.123456", but some have
+// long mantissas, exponents, or only an integer or fractional part.
+static void RandomFloatString(char *s) {
+  char *p = s, *digits = NULL;
+  float f;
+  int form = NextRandom() % 8;
+  if (form == 0) {
+    // Any float, printed with enough digits to round-trip.
+    memcpy(&f, &random_state, sizeof(f));
+    if ((f != f) || ((f - f) != 0.0f)) f = 1.0f;
+    snprintf(s, 64, "%.9g", f);
+    return;
+  }
+  if (form == 1) {
+    // A typical exporter's output, which should hit the fast path.
+    f = ((float) NextRandom()) / ((float) UINT32_MAX) * 200.0f - 100.0f;
+    snprintf(s, 64, "%f", f);
+    return;
+  }
+  if (NextRandom() % 2) *(p++) = '-';
+  digits = p;
+  p = AppendDigits(p, NextRandom() % 12);
+  if ((form != 2) || (p == digits)) {
+    *(p++) = '.';
+    p = AppendDigits(p, 1 + NextRandom() % ((form == 3) ? 30 : 10));
+  }
+  if (form >= 5) {
+    *(p++) = (NextRandom() % 2) ? 'e' : 'E';
+    if (NextRandom() % 2) *(p++) = (NextRandom() % 2) ? '-' : '+';
+    p += sprintf(p, "%d", (int) (NextRandom() % ((form == 7) ? 60 : 14)));
+  }
+  *p = 0;
+}
+
+// Returns 1 if ParseNextFloat gives the same bits as strtof for s, and stops
+// at the same character. Otherwise prints the difference and returns 0.
+static int CheckFloat(const char *s) {
+  const char *end = s + strlen(s), *parsed_end = NULL;
+  char *expected_end = NULL;
+  float parsed = 0.0f, expected;
+  uint32_t parsed_bits, expected_bits;
+  expected = strtof(s, &expected_end);
+  parsed_end = ParseNextFloat(s, end, &parsed);
+  memcpy(&parsed_bits, &parsed, sizeof(parsed_bits));
+  memcpy(&expected_bits, &expected, sizeof(expected_bits));
+  if (parsed_end && (parsed_end == expected_end) &&
+    (parsed_bits == expected_bits)) {
+    return 1;
+  }
+  printf("Mismatch for \"%s\": got 0x%08x after %d chars, strtof got 0x%08x "
+    "after %d chars.\n", s, (unsigned) parsed_bits,
+    parsed_end ? (int) (parsed_end - s) : -1, (unsigned) expected_bits,
+    (int) (expected_end - s));
+  return 0;
+}
+
+// Holds a face corner and the indices ParseNextIndices should produce for it.
+typedef struct {
+  const char *text;
+  // Set if the corner is invalid, in which case the remaining fields are
+  // ignored.
+  int invalid;
+  uint32_t indices[3];
+  uint32_t relative_mask;
+  // The number of chars that should be consumed.
+  int length;
+} IndexCase;
+
+static const IndexCase index_cases[] = {
+  {"1/2/3", 0, {0, 1, 2}, 0, 5},
+  {"4//6", 0, {3, 0, 5}, 0, 4},
+  {"7", 0, {6, 0, 0}, 0, 1},
+  {"12/34 ", 0, {11, 33, 0}, 0, 5},
+  {"-1/-2/-3", 0, {(uint32_t) -1, (uint32_t) -2, (uint32_t) -3}, 7, 8},
+  {"5/-1", 0, {4, (uint32_t) -1, 0}, 2, 4},
+  {"  4294967295/1/1", 0, {4294967294u, 0, 0}, 0, 16},
+  {"/1/2", 1, {0, 0, 0}, 0, 0},
+  {"", 1, {0, 0, 0}, 0, 0},
+  {"x", 1, {0, 0, 0}, 0, 0},
+  {"1/x", 1, {0, 0, 0}, 0, 0},
+};
+
+// Returns 1 if ParseNextIndices handles the given case correctly. Otherwise
+// prints the difference and returns 0.
+static int CheckIndices(const IndexCase *c) {
+  const char *end = c->text + strlen(c->text), *parsed_end = NULL;
+  uint32_t indices[3], relative_mask = 0;
+  memset(indices, 0, sizeof(indices));
+  parsed_end = ParseNextIndices(c->text, end, indices, &relative_mask);
+  if (c->invalid) {
+    if (!parsed_end) return 1;
+    printf("Expected \"%s\" to be rejected.\n", c->text);
+    return 0;
+  }
+  if (parsed_end && ((parsed_end - c->text) == c->length) &&
+    (memcmp(indices, c->indices, sizeof(indices)) == 0) &&
+    (relative_mask == c->relative_mask)) {
+    return 1;
+  }
+  printf("Mismatch for indices \"%s\": got %u/%u/%u, mask %u.\n", c->text,
+    (unsigned) indices[0], (unsigned) indices[1], (unsigned) indices[2],
+    (unsigned) relative_mask);
+  return 0;
+}
+
+// The number of sections in the file generated by GenerateMergeTestFile. Each
+// section adds a few locations, UV coordinates, and normals, followed by
+// faces using them along with ones from earlier sections.
+#define MERGE_TEST_SECTIONS (60)
+#define MERGE_TEST_LOCATIONS_PER_SECTION (16)
+#define MERGE_TEST_FACES_PER_SECTION (40)
+
+// An upper bound on the size of the file generated by GenerateMergeTestFile.
+#define MERGE_TEST_FILE_SIZE (MERGE_TEST_SECTIONS * 8192)
+
+// Appends one face corner referring to the given 1-based location, UV, and
+// normal indices out of the given counts so far, returning the new end of s.
+// Picks randomly between absolute and relative indices for each one, and
+// sometimes leaves out the UV coordinate.
+static char* AppendCorner(char *s, uint32_t location, uint32_t location_count,
+    uint32_t uv, uint32_t uv_count, uint32_t normal, uint32_t normal_count) {
+  int form = NextRandom() % 4;
+  if (form == 0) {
+    return s + sprintf(s, " %u/%u/%u", (unsigned) location, (unsigned) uv,
+      (unsigned) normal);
+  }
+  if (form == 1) {
+    return s + sprintf(s, " -%u/-%u/-%u",
+      (unsigned) (location_count + 1 - location),
+      (unsigned) (uv_count + 1 - uv), (unsigned) (normal_count + 1 - normal));
+  }
+  if (form == 2) {
+    return s + sprintf(s, " %u/-%u/%u", (unsigned) location,
+      (unsigned) (uv_count + 1 - uv), (unsigned) normal);
+  }
+  return s + sprintf(s, " -%u//%u", (unsigned) (location_count + 1 - location),
+    (unsigned) normal);
+}
+
+// Picks a 1-based index out of count elements so far. Usually one of the
+// latest few, so corners are often repeated, but sometimes any of them, so
+// faces refer to elements from far earlier chunks.
+static uint32_t PickIndex(uint32_t count) {
+  uint32_t recent = 2 * MERGE_TEST_LOCATIONS_PER_SECTION;
+  if ((count <= recent) || ((NextRandom() % 4) == 0)) {
+    return 1 + NextRandom() % count;
+  }
+  return count - (NextRandom() % recent);
+}
+
+// Generates a small obj file that's tricky to split into chunks: it uses both
+// relative and absolute indices, has faces before the first "o" line, several
+// "o" and "g" lines, including some without any faces, and doesn't end with a
+// newline. Returns NULL on error. The returned buffer must be freed by the
+// caller.
+static char* GenerateMergeTestFile(size_t *length) {
+  char *s = (char *) malloc(MERGE_TEST_FILE_SIZE), *p = s;
+  uint32_t locations = 0, uv_coords = 0, normals = 0, location;
+  int i, j;
+  if (!s) {
+    printf("Failed allocating the merge test file.\n");
+    return NULL;
+  }
+  p += sprintf(p, "# Generated by parse_obj_test.\n");
+  for (i = 0; i < MERGE_TEST_SECTIONS; i++) {
+    if ((i % 5) == 1) p += sprintf(p, "o object_%d\n", i / 5);
+    if ((i % 5) == 3) p += sprintf(p, "\ng group_%d\n", i);
+    if ((i % 7) == 4) p += sprintf(p, "g empty_%d\n", i);
+    for (j = 0; j < MERGE_TEST_LOCATIONS_PER_SECTION; j++) {
+      p += sprintf(p, "v %.4f %.4f %.4f\n",
+        (float) (NextRandom() % 20000) / 100.0f - 100.0f,
+        (float) (NextRandom() % 20000) / 100.0f - 100.0f,
+        (float) (NextRandom() % 20000) / 100.0f - 100.0f);
+      locations++;
+      if ((j % 2) == 0) {
+        p += sprintf(p, "vt %.4f %.4f\nvn 0.0 %.4f 1.0\n",
+          (float) (NextRandom() % 1000) / 1000.0f,
+          (float) (NextRandom() % 1000) / 1000.0f,
+          (float) (NextRandom() % 1000) / 1000.0f);
+        uv_coords++;
+        normals++;
+      }
+    }
+    for (j = 0; j < MERGE_TEST_FACES_PER_SECTION; j++) {
+      p += sprintf(p, "f");
+      for (location = 0; location < 3; location++) {
+        p = AppendCorner(p, PickIndex(locations), locations,
+          PickIndex(uv_coords), uv_coords, PickIndex(normals), normals);
+      }
+      // Leave off the last face's newline.
+      if ((i != (MERGE_TEST_SECTIONS - 1)) ||
+        (j != (MERGE_TEST_FACES_PER_SECTION - 1))) {
+        p += sprintf(p, "\n");
+      }
+    }
+  }
+  *length = p - s;
+  return s;
+}
+
+// Parses the given file content with the given settings. Returns NULL on
+// error.
+static ObjectFileInfo* ParseMergeTestFile(const char *data, size_t length,
+    ObjDedupEngine dedup_engine, int thread_count, int count_first) {
+  ObjParseOptions options;
+  memset(&options, 0, sizeof(options));
+  options.dedup_engine = dedup_engine;
+  options.thread_count = thread_count;
+  options.count_first = count_first;
+  return ParseObjFileWithOptions(data, length, &options);
+}
+
+// Parses the given file content using a stream parser, feeding it chunk_size
+// bytes at a time. Returns NULL on error.
+static ObjectFileInfo* StreamMergeTestFile(const char *data, size_t length,
+    size_t chunk_size) {
+  ObjParseOptions options;
+  ObjStreamParser *p = NULL;
+  size_t offset, size;
+  memset(&options, 0, sizeof(options));
+  options.thread_count = 1;
+  p = CreateObjStreamParser(&options);
+  if (!p) return NULL;
+  for (offset = 0; offset < length; offset += size) {
+    size = length - offset;
+    if (size > chunk_size) size = chunk_size;
+    if (!FeedObjStreamParser(p, data + offset, size)) break;
+  }
+  return FinishObjStreamParser(p);
+}
+
+// Returns 1 if a and b have the same sub-meshes.
+static int SameSubMeshes(const ObjectFileInfo *a, const ObjectFileInfo *b) {
+  uint32_t i;
+  if (a->sub_mesh_count != b->sub_mesh_count) return 0;
+  for (i = 0; i < a->sub_mesh_count; i++) {
+    if ((a->sub_meshes[i].first_index != b->sub_meshes[i].first_index) ||
+      (a->sub_meshes[i].index_count != b->sub_meshes[i].index_count) ||
+      (strcmp(a->sub_meshes[i].name, b->sub_meshes[i].name) != 0)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Returns 1 if a and b hold exactly the same vertices, indices, bounds, and
+// sub-meshes.
+static int SameObjectFile(const ObjectFileInfo *a, const ObjectFileInfo *b) {
+  if ((a->vertex_count != b->vertex_count) ||
+    (a->index_count != b->index_count) || !SameSubMeshes(a, b)) {
+    return 0;
+  }
+  if (memcmp(&(a->bounds), &(b->bounds), sizeof(a->bounds)) != 0) return 0;
+  if ((a->vertex_count > 0) && (memcmp(a->vertices, b->vertices,
+    a->vertex_count * sizeof(ObjectFileVertex)) != 0)) {
+    return 0;
+  }
+  if ((a->index_count > 0) && (memcmp(a->indices, b->indices,
+    a->index_count * sizeof(uint32_t)) != 0)) {
+    return 0;
+  }
+  return 1;
+}
+
+// Returns 1 if every face corner in a has exactly the same vertex as the one
+// in b, even if the vertices are numbered differently, as they are by the hash
+// engine.
+static int SameCorners(const ObjectFileInfo *a, const ObjectFileInfo *b) {
+  uint64_t i;
+  if ((a->vertex_count != b->vertex_count) ||
+    (a->index_count != b->index_count) || !SameSubMeshes(a, b)) {
+    return 0;
+  }
+  for (i = 0; i < a->index_count; i++) {
+    if (memcmp(a->vertices + a->indices[i], b->vertices + b->indices[i],
+      sizeof(ObjectFileVertex)) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Compares the file parsed with the given settings against the expected
+// result, which is compared exactly if exact is set, and by corner otherwise.
+// Returns 1 if they match. Otherwise prints the settings and returns 0.
+static int CheckMergedParse(const ObjectFileInfo *expected, int exact,
+    const char *data, size_t length, ObjDedupEngine dedup_engine,
+    int thread_count, int count_first) {
+  ObjectFileInfo *o = ParseMergeTestFile(data, length, dedup_engine,
+    thread_count, count_first);
+  int same = 0;
+  if (o) same = exact ? SameObjectFile(expected, o) : SameCorners(expected, o);
+  FreeObjectFileInfo(o);
+  if (same) return 1;
+  printf("Mismatch parsing the merge test file with engine %d, %d "
+    "thread(s), count_first %d.\n", (int) dedup_engine, thread_count,
+    count_first);
+  return 0;
+}
+
+// Parses a generated file in every combination of dedup engine, thread count,
+// and count_first, and with the stream parser. Each engine must give exactly
+// the same result regardless of how the file is split, or how many threads
+// build its final vertices and indices, and the same corners as the other
+// engines. Adds the number of combinations checked to *checked
+// and returns the number that failed.
+static long CheckChunkMerging(long *checked) {
+  static const ObjDedupEngine engines[] = {
+    OBJ_DEDUP_HASH, OBJ_DEDUP_TREE, OBJ_DEDUP_SORT,
+  };
+  static const int thread_counts[] = {1, 2, 7};
+  static const size_t stream_chunk_sizes[] = {1, 7, 4096};
+  ObjectFileInfo *hash_result = NULL, *engine_result = NULL, *o = NULL;
+  char *data = NULL;
+  size_t length = 0;
+  long failures = 0;
+  int e, t, count_first, i;
+  data = GenerateMergeTestFile(&length);
+  if (data) {
+    hash_result = ParseMergeTestFile(data, length, OBJ_DEDUP_HASH, 1, 0);
+  }
+  if (!hash_result) {
+    printf("Failed parsing the merge test file.\n");
+    free(data);
+    return 1;
+  }
+  // Make sure the file is big enough for every thread to get a slice of the
+  // final vertices and indices; otherwise the comparisons prove nothing.
+  if ((LimitRemapThreadCount(7, hash_result->vertex_count) != 7) ||
+    (LimitRemapThreadCount(7, hash_result->index_count) != 7)) {
+    printf("The merge test file is too small to split between threads.\n");
+    failures++;
+  }
+  for (e = 0; e < 3; e++) {
+    engine_result = ParseMergeTestFile(data, length, engines[e], 1, 0);
+    *checked += 1;
+    if (!engine_result || !SameCorners(hash_result, engine_result)) {
+      printf("Dedup engine %d gave different corners than the hash "
+        "engine.\n", (int) engines[e]);
+      FreeObjectFileInfo(engine_result);
+      failures++;
+      continue;
+    }
+    for (t = 0; t < 3; t++) {
+      for (count_first = 0; count_first < 2; count_first++) {
+        *checked += 1;
+        if (!CheckMergedParse(engine_result, 1, data, length, engines[e],
+          thread_counts[t], count_first)) {
+          failures++;
+        }
+      }
+    }
+    FreeObjectFileInfo(engine_result);
+  }
+  for (i = 0; i < 3; i++) {
+    o = StreamMergeTestFile(data, length, stream_chunk_sizes[i]);
+    *checked += 1;
+    if (!o || !SameObjectFile(hash_result, o)) {
+      printf("Mismatch streaming the merge test file in %d-byte chunks.\n",
+        (int) stream_chunk_sizes[i]);
+      failures++;
+    }
+    FreeObjectFileInfo(o);
+  }
+  FreeObjectFileInfo(hash_result);
+  free(data);
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  char s[64];
+  long i, random_count = 2000000, failures = 0, merge_count = 0;
+  long edge_count = sizeof(float_edge_cases) / sizeof(float_edge_cases[0]);
+  long index_count = sizeof(index_cases) / sizeof(index_cases[0]);
+  if (argc > 1) random_count = atol(argv[1]);
+  for (i = 0; i < edge_count; i++) {
+    if (!CheckFloat(float_edge_cases[i])) failures++;
+  }
+  for (i = 0; i < random_count; i++) {
+    RandomFloatString(s);
+    if (!CheckFloat(s)) failures++;
+  }
+  for (i = 0; i < index_count; i++) {
+    if (!CheckIndices(index_cases + i)) failures++;
+  }
+  failures += CheckChunkMerging(&merge_count);
+  printf("Checked %ld edge-case floats, %ld random floats, %ld index groups, "
+    "and %ld ways of splitting a file: %ld failure(s).\n", edge_count,
+    random_count, index_count, merge_count, failures);
+  return failures ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include "memory_arena.h"
 #include "scapegoat_tree.h"
 
 // Determines how unbalanced a node's subtrees are allowed to be, before
@@ -14,6 +15,14 @@ ScapegoatTree* CreateScapegoatTree(ScapegoatComparatorFunction comparator) {
   return to_return;
 }
 
+ScapegoatTree* CreateScapegoatTreeInArena(
+    ScapegoatComparatorFunction comparator, MemoryArena *arena) {
+  ScapegoatTree *to_return = CreateScapegoatTree(comparator);
+  if (!to_return) return NULL;
+  to_return->arena = arena;
+  return to_return;
+}
+
 // Gets a list capable of holding a number of node pointers specified by
 // required_capacity. Returns NULL on error. Used to avoid unnecessary
 // reallocations.
@@ -64,11 +73,16 @@ static ScapegoatTreeNode* FindClosestNode(ScapegoatTree *tree,
   return FindClosestNode(tree, node->right, key);
 }
 
-// Allocates a new node. Sets its key, and sets parent and child pointers to
-// NULL. Returns NULL on error.
-static ScapegoatTreeNode* AllocateNewNode(void *key) {
+// Allocates a new node, from the tree's arena if it has one. Sets its key, and
+// sets parent and child pointers to NULL. Returns NULL on error.
+static ScapegoatTreeNode* AllocateNewNode(ScapegoatTree *tree, void *key) {
   ScapegoatTreeNode *to_return = NULL;
-  to_return = (ScapegoatTreeNode *) calloc(sizeof(ScapegoatTreeNode), 1);
+  if (tree->arena) {
+    to_return = (ScapegoatTreeNode *) ArenaAllocateZeroed(tree->arena,
+      sizeof(ScapegoatTreeNode));
+  } else {
+    to_return = (ScapegoatTreeNode *) calloc(sizeof(ScapegoatTreeNode), 1);
+  }
   if (!to_return) return NULL;
   to_return->key = key;
   return to_return;
@@ -222,7 +236,7 @@ int ScapegoatInsert(ScapegoatTree *tree, void *key) {
 
   // If the tree is empty, then simply create the root.
   if (!tree->root) {
-    new_node = AllocateNewNode(key);
+    new_node = AllocateNewNode(tree, key);
     if (!new_node) return 0;
     tree->root = new_node;
     tree->tree_size = 1;
@@ -237,7 +251,7 @@ int ScapegoatInsert(ScapegoatTree *tree, void *key) {
 
   // The node wasn't in the tree yet, so insert it.
   tree->tree_size += 1;
-  new_node = AllocateNewNode(key);
+  new_node = AllocateNewNode(tree, key);
   if (!new_node) return 0;
   new_node->parent = parent;
   if (result < 0) {
@@ -290,7 +304,8 @@ static void DestroyTreeRecursive(ScapegoatTreeNode *root) {
 }
 
 void DestroyScapegoatTree(ScapegoatTree *tree) {
-  DestroyTreeRecursive(tree->root);
+  // Nodes in an arena are freed along with the arena.
+  if (!tree->arena) DestroyTreeRecursive(tree->root);
   tree->root = NULL;
   tree->tree_size = 0;
   free(tree->node_ptr_cache);
@@ -3,6 +3,7 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include "memory_arena.h"
 
 // A single node in the tree.
 typedef struct ScapegoatTreeNode_s {
@@ -32,12 +33,21 @@ typedef struct {
   // The number of pointers that can fit in node_ptr_cache. Do not modify this
   // either.
   int node_ptr_cache_size;
+  // If this isn't NULL, nodes are allocated from this arena rather than the
+  // heap, and aren't freed until the arena is destroyed.
+  MemoryArena *arena;
 } ScapegoatTree;
 
 // Creates an empty scapegoat tree. Requires the comparator function to be used
 // when inserting keys. Returns NULL on error.
 ScapegoatTree* CreateScapegoatTree(ScapegoatComparatorFunction comparator);
 
+// Like CreateScapegoatTree, but allocates the tree's nodes from the given
+// arena. This is much faster when inserting lots of keys, but the arena must
+// outlive the tree.
+ScapegoatTree* CreateScapegoatTreeInArena(
+    ScapegoatComparatorFunction comparator, MemoryArena *arena);
+
 // Inserts the given key into the tree. Returns 0 if an error occurs. The key
 // must not be NULL.
 int ScapegoatInsert(ScapegoatTree *tree, void *key);
@@ -39,6 +39,15 @@ static int GetUniformIndices(ShaderProgram *p) {
       return 0;
     }
   }
+  // Shaders that don't support compact vertices may not have these.
+  p->position_offset_uniform = glGetUniformLocation(p->shader_program,
+    "position_offset");
+  p->position_scale_uniform = glGetUniformLocation(p->shader_program,
+    "position_scale");
+  p->uv_offset_uniform = glGetUniformLocation(p->shader_program, "uv_offset");
+  p->uv_scale_uniform = glGetUniformLocation(p->shader_program, "uv_scale");
+  p->octahedral_normals_uniform = glGetUniformLocation(p->shader_program,
+    "octahedral_normals");
   block_index = glGetUniformBlockIndex(p->shader_program, "SharedUniforms");
   if (block_index == GL_INVALID_INDEX) {
     printf("Failed getting index of shared uniform block.\n");
@@ -23,6 +23,13 @@ typedef struct {
   // texture_uniform_indices for a note on what the texture uniforms must be
   // named.
   int texture_count;
+  // The locations of the uniforms used to dequantize compact vertices. These
+  // are optional, and will be -1 if the shader doesn't use them.
+  GLint position_offset_uniform;
+  GLint position_scale_uniform;
+  GLint uv_offset_uniform;
+  GLint uv_scale_uniform;
+  GLint octahedral_normals_uniform;
 } ShaderProgram;
 
 // Takes paths to the shader source files. Allocates and returns a
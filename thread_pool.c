@@ -0,0 +1,77 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "thread_pool.h"
+
+// Holds the arguments for a single thread started by RunInParallel.
+typedef struct {
+  ParallelFunction fn;
+  void *user_data;
+  int thread_index;
+  int thread_count;
+  pthread_t thread;
+  // Nonzero if the thread was started successfully and needs to be joined.
+  int started;
+} ParallelThreadInfo;
+
+static void* ParallelThreadMain(void *arg) {
+  ParallelThreadInfo *info = (ParallelThreadInfo *) arg;
+  info->fn(info->thread_index, info->thread_count, info->user_data);
+  return NULL;
+}
+
+int RunInParallel(int thread_count, ParallelFunction fn, void *user_data) {
+  ParallelThreadInfo *threads = NULL;
+  int i;
+  if (thread_count < 1) {
+    printf("Invalid thread count: %d\n", thread_count);
+    return 0;
+  }
+  if (thread_count == 1) {
+    fn(0, 1, user_data);
+    return 1;
+  }
+  threads = (ParallelThreadInfo *) calloc(thread_count,
+    sizeof(ParallelThreadInfo));
+  if (!threads) {
+    // We can still do all of the work, just not in parallel.
+    for (i = 0; i < thread_count; i++) fn(i, thread_count, user_data);
+    return 1;
+  }
+  for (i = 1; i < thread_count; i++) {
+    threads[i].fn = fn;
+    threads[i].user_data = user_data;
+    threads[i].thread_index = i;
+    threads[i].thread_count = thread_count;
+    threads[i].started = pthread_create(&(threads[i].thread), NULL,
+      ParallelThreadMain, threads + i) == 0;
+  }
+  fn(0, thread_count, user_data);
+  for (i = 1; i < thread_count; i++) {
+    if (threads[i].started) {
+      pthread_join(threads[i].thread, NULL);
+    } else {
+      fn(i, thread_count, user_data);
+    }
+  }
+  free(threads);
+  return 1;
+}
+
+int GetCPUCount(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  if (info.dwNumberOfProcessors < 1) return 1;
+  return (int) info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) return 1;
+  return (int) count;
+#endif
+}
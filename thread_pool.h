@@ -0,0 +1,28 @@
+// Defines a couple of simple helpers for splitting work across threads.
+#ifndef OPENGL_TUTORIAL_THREAD_POOL_H
+#define OPENGL_TUTORIAL_THREAD_POOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The type of function run by each thread in RunInParallel. thread_index goes
+// from 0 to thread_count - 1, and user_data is the pointer passed to
+// RunInParallel.
+typedef void (*ParallelFunction)(int thread_index, int thread_count,
+  void *user_data);
+
+// Calls fn once for each thread index from 0 to thread_count - 1, each on a
+// separate thread, and waits for all of the calls to finish. The calling
+// thread runs index 0 itself. If a thread can't be created, its index is run
+// on the calling thread instead, so every index always runs exactly once.
+// Returns 0 if thread_count is less than 1.
+int RunInParallel(int thread_count, ParallelFunction fn, void *user_data);
+
+// Returns the number of CPUs available to run threads on. Always returns at
+// least 1.
+int GetCPUCount(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_THREAD_POOL_H
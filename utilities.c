@@ -3,6 +3,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <glad/glad.h>
 #include "utilities.h"
 
@@ -49,43 +57,53 @@ int CheckGLErrors(void) {
   return 0;
 }
 
+// ftell returns a long, which is only 32 bits on Windows, so use the 64-bit
+// versions to support files over 2 GB.
+#ifdef _WIN32
+#define SeekFile(f, offset, origin) _fseeki64((f), (offset), (origin))
+#define TellFile(f) _ftelli64(f)
+#else
+#define SeekFile(f, offset, origin) fseeko((f), (offset), (origin))
+#define TellFile(f) ftello(f)
+#endif
+
 char* ReadFullFile(const char *path) {
-  long size = 0;
+  int64_t size = 0;
   char *to_return = NULL;
   FILE *f = fopen(path, "rb");
   if (!f) {
     printf("Failed opening %s: %s\n", path, strerror(errno));
     return NULL;
   }
-  if (fseek(f, 0, SEEK_END) != 0) {
+  if (SeekFile(f, 0, SEEK_END) != 0) {
     printf("Failed seeking end of %s: %s\n", path, strerror(errno));
     fclose(f);
     return NULL;
   }
-  size = ftell(f);
+  size = (int64_t) TellFile(f);
   if (size < 0) {
     printf("Failed getting size of %s: %s\n", path, strerror(errno));
     fclose(f);
     return NULL;
   }
-  if ((size + 1) < 0) {
+  if (((uint64_t) size) >= ((uint64_t) SIZE_MAX)) {
     printf("File %s too big.\n", path);
     fclose(f);
     return NULL;
   }
-  if (fseek(f, 0, SEEK_SET) != 0) {
+  if (SeekFile(f, 0, SEEK_SET) != 0) {
     printf("Failed rewinding to start of %s: %s\n", path, strerror(errno));
     fclose(f);
     return NULL;
   }
   // Use size + 1 to null-terminate the data.
-  to_return = (char *) calloc(1, size + 1);
+  to_return = (char *) calloc(1, ((size_t) size) + 1);
   if (!to_return) {
     printf("Failed allocating buffer to hold contents of %s.\n", path);
     fclose(f);
     return NULL;
   }
-  if (fread(to_return, size, 1, f) < 1) {
+  if (fread(to_return, (size_t) size, 1, f) < 1) {
     printf("Failed reading %s: %s\n", path, strerror(errno));
     fclose(f);
     free(to_return);
@@ -95,6 +113,99 @@ char* ReadFullFile(const char *path) {
   return to_return;
 }
 
+// MapFile can't map empty files, so it returns a pointer to this instead.
+static const char empty_file_content[1] = {0};
+
+#ifdef _WIN32
+const char* MapFile(const char *path, size_t *size) {
+  HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+  LARGE_INTEGER file_size;
+  const char *to_return = NULL;
+  file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    printf("Failed opening %s: error %d\n", path, (int) GetLastError());
+    return NULL;
+  }
+  if (!GetFileSizeEx(file, &file_size)) {
+    printf("Failed getting size of %s: error %d\n", path,
+      (int) GetLastError());
+    CloseHandle(file);
+    return NULL;
+  }
+  if (((uint64_t) file_size.QuadPart) > ((uint64_t) SIZE_MAX)) {
+    printf("File %s too big.\n", path);
+    CloseHandle(file);
+    return NULL;
+  }
+  *size = (size_t) file_size.QuadPart;
+  if (*size == 0) {
+    CloseHandle(file);
+    return empty_file_content;
+  }
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping) {
+    printf("Failed creating mapping of %s: error %d\n", path,
+      (int) GetLastError());
+    return NULL;
+  }
+  // The view keeps the mapping alive, so we can close the handle right away.
+  to_return = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!to_return) {
+    printf("Failed mapping %s: error %d\n", path, (int) GetLastError());
+    return NULL;
+  }
+  return to_return;
+}
+
+void UnmapFile(const char *data, size_t size) {
+  if (!data || (data == empty_file_content)) return;
+  UnmapViewOfFile(data);
+}
+#else
+const char* MapFile(const char *path, size_t *size) {
+  struct stat file_info;
+  void *to_return = NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &file_info) != 0) {
+    printf("Failed getting size of %s: %s\n", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  if (((uint64_t) file_info.st_size) > ((uint64_t) SIZE_MAX)) {
+    printf("File %s too big.\n", path);
+    close(fd);
+    return NULL;
+  }
+  *size = (size_t) file_info.st_size;
+  if (*size == 0) {
+    close(fd);
+    return empty_file_content;
+  }
+  to_return = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open, so we can close the descriptor now.
+  close(fd);
+  if (to_return == MAP_FAILED) {
+    printf("Failed mapping %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  // We expect to read the whole file from start to end, exactly once.
+  madvise(to_return, *size, MADV_SEQUENTIAL);
+  return (const char *) to_return;
+}
+
+void UnmapFile(const char *data, size_t size) {
+  if (!data || (data == empty_file_content)) return;
+  munmap((void *) data, size);
+}
+#endif
+
 char* StringReplace(const char *input, const char *match, const char *r) {
   char *input_pos = NULL;
   const char *prev_input_pos = NULL;
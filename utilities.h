@@ -3,6 +3,7 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include <stddef.h>
 
 // Returns 0 if any OpenGL errors are detected. Otherwise, prints the errors
 // and returns nonzero.
@@ -13,6 +14,15 @@ int CheckGLErrors(void);
 // returned buffer when it's no longer needed.
 char* ReadFullFile(const char *path);
 
+// Maps the entire file at the given path into memory, read-only. Sets *size
+// to the size of the file, in bytes. The mapped content is *not*
+// null-terminated. Returns NULL on error. The caller must pass the returned
+// pointer and size to UnmapFile when the content is no longer needed.
+const char* MapFile(const char *path, size_t *size);
+
+// Releases a mapping returned by MapFile. Does nothing if data is NULL.
+void UnmapFile(const char *data, size_t size);
+
 // Replaces all instances of the string match in input with r. Returns a new
 // null-terminated string, or NULL on error. The returned string must be freed
 // by the caller when no longer needed. Even if no replacements are made, this
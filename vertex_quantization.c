@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "parse_obj.h"
+#include "vertex_quantization.h"
+
+// Converts a value in [0, 1] to the nearest unorm16 value.
+static uint16_t ToUnorm16(float v) {
+  if (!(v > 0.0f)) return 0;
+  if (v >= 1.0f) return 65535;
+  return (uint16_t) (v * 65535.0f + 0.5f);
+}
+
+// Converts a value in [-1, 1] to the nearest snorm16 value.
+static int16_t ToSnorm16(float v) {
+  if (!(v > -1.0f)) return -32767;
+  if (v >= 1.0f) return 32767;
+  return (int16_t) lrintf(v * 32767.0f);
+}
+
+// Returns -1 for negative values, and 1 otherwise.
+static float SignNotZero(float v) {
+  return (v < 0.0f) ? -1.0f : 1.0f;
+}
+
+// Encodes the unit vector n as a point on the octahedron, unfolded into the
+// square [-1, 1] x [-1, 1]. See "A Survey of Efficient Representations for
+// Independent Unit Vectors" (Cigolle et al., 2014). Zero-length vectors end up
+// as (0, 0), which decodes to (0, 0, 1).
+static void OctahedralEncode(const float *n, int16_t *out) {
+  float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+  float x = 0.0f, y = 0.0f, tmp;
+  if (l1 > 0.0f) {
+    x = n[0] / l1;
+    y = n[1] / l1;
+    if (n[2] < 0.0f) {
+      // Fold the lower hemisphere over the diagonals.
+      tmp = (1.0f - fabsf(y)) * SignNotZero(x);
+      y = (1.0f - fabsf(x)) * SignNotZero(y);
+      x = tmp;
+    }
+  }
+  out[0] = ToSnorm16(x);
+  out[1] = ToSnorm16(y);
+}
+
+// The inverse of OctahedralEncode. Always produces a unit vector.
+static void OctahedralDecode(const int16_t *in, float *n) {
+  float x = in[0] / 32767.0f;
+  float y = in[1] / 32767.0f;
+  float z = 1.0f - fabsf(x) - fabsf(y);
+  float t, length;
+  if (z < 0.0f) {
+    t = -z;
+    x += (x >= 0.0f) ? -t : t;
+    y += (y >= 0.0f) ? -t : t;
+  }
+  length = sqrtf(x * x + y * y + z * z);
+  n[0] = x / length;
+  n[1] = y / length;
+  n[2] = z / length;
+}
+
+void ComputeQuantizationParams(const ObjectFileVertex *in, uint32_t count,
+    QuantizationParams *params) {
+  float min[5], max[5];
+  uint32_t i;
+  int j;
+  memset(params, 0, sizeof(*params));
+  if (count == 0) return;
+  // Find the bounding box of the positions, followed by the UV range.
+  for (j = 0; j < 3; j++) {
+    min[j] = in[0].location[j];
+    max[j] = in[0].location[j];
+  }
+  for (j = 0; j < 2; j++) {
+    min[j + 3] = in[0].uv[j];
+    max[j + 3] = in[0].uv[j];
+  }
+  for (i = 1; i < count; i++) {
+    for (j = 0; j < 3; j++) {
+      if (in[i].location[j] < min[j]) min[j] = in[i].location[j];
+      if (in[i].location[j] > max[j]) max[j] = in[i].location[j];
+    }
+    for (j = 0; j < 2; j++) {
+      if (in[i].uv[j] < min[j + 3]) min[j + 3] = in[i].uv[j];
+      if (in[i].uv[j] > max[j + 3]) max[j + 3] = in[i].uv[j];
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    params->position_offset[j] = min[j];
+    params->position_scale[j] = max[j] - min[j];
+  }
+  for (j = 0; j < 2; j++) {
+    params->uv_offset[j] = min[j + 3];
+    params->uv_scale[j] = max[j + 3] - min[j + 3];
+  }
+}
+
+void QuantizeVerticesWithParams(const ObjectFileVertex *in, uint32_t count,
+    const QuantizationParams *params, QuantizedVertex *out) {
+  float range;
+  uint32_t i;
+  int j;
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < 3; j++) {
+      range = params->position_scale[j];
+      out[i].position[j] = (range > 0.0f) ? ToUnorm16((in[i].location[j] -
+        params->position_offset[j]) / range) : 0;
+    }
+    out[i].padding = 0;
+    OctahedralEncode(in[i].normal, out[i].normal);
+    for (j = 0; j < 2; j++) {
+      range = params->uv_scale[j];
+      out[i].uv[j] = (range > 0.0f) ? ToUnorm16((in[i].uv[j] -
+        params->uv_offset[j]) / range) : 0;
+    }
+  }
+}
+
+int QuantizeVertices(const ObjectFileVertex *in, uint32_t count,
+    QuantizedVertex *out, QuantizationParams *params) {
+  if (sizeof(QuantizedVertex) != 16) {
+    printf("Internal error: expected 16 bytes per quantized vertex.\n");
+    return 0;
+  }
+  ComputeQuantizationParams(in, count, params);
+  QuantizeVerticesWithParams(in, count, params, out);
+  return 1;
+}
+
+void DequantizeVertex(const QuantizedVertex *in,
+    const QuantizationParams *params, ObjectFileVertex *out) {
+  int j;
+  for (j = 0; j < 3; j++) {
+    out->location[j] = params->position_offset[j] +
+      params->position_scale[j] * (in->position[j] / 65535.0f);
+  }
+  OctahedralDecode(in->normal, out->normal);
+  for (j = 0; j < 2; j++) {
+    out->uv[j] = params->uv_offset[j] + params->uv_scale[j] *
+      (in->uv[j] / 65535.0f);
+  }
+}
+
+void MeasureQuantizationError(const ObjectFileVertex *original,
+    const QuantizedVertex *quantized, uint32_t count,
+    const QuantizationParams *params, QuantizationError *error) {
+  ObjectFileVertex v;
+  const ObjectFileVertex *o = NULL;
+  double d, length, dot, cross[3], diagonal = 0.0, uv_range = 0.0;
+  uint32_t i;
+  int j;
+  memset(error, 0, sizeof(*error));
+  for (j = 0; j < 3; j++) {
+    diagonal += params->position_scale[j] * params->position_scale[j];
+  }
+  diagonal = sqrt(diagonal);
+  for (j = 0; j < 2; j++) {
+    if (params->uv_scale[j] > uv_range) uv_range = params->uv_scale[j];
+  }
+  for (i = 0; i < count; i++) {
+    o = original + i;
+    DequantizeVertex(quantized + i, params, &v);
+    d = 0.0;
+    for (j = 0; j < 3; j++) {
+      d += (o->location[j] - v.location[j]) * (o->location[j] -
+        v.location[j]);
+    }
+    d = sqrt(d);
+    if (d > error->max_position_error) error->max_position_error = d;
+
+    length = 0.0;
+    dot = 0.0;
+    for (j = 0; j < 3; j++) {
+      length += o->normal[j] * o->normal[j];
+      dot += o->normal[j] * v.normal[j];
+    }
+    if (length > 0.0) {
+      // acos is too imprecise for angles this small, so use the length of
+      // the cross product as well.
+      cross[0] = o->normal[1] * v.normal[2] - o->normal[2] * v.normal[1];
+      cross[1] = o->normal[2] * v.normal[0] - o->normal[0] * v.normal[2];
+      cross[2] = o->normal[0] * v.normal[1] - o->normal[1] * v.normal[0];
+      d = atan2(sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] *
+        cross[2]), dot) * (180.0 / M_PI);
+      if (d > error->max_normal_error_degrees) {
+        error->max_normal_error_degrees = d;
+      }
+    }
+
+    for (j = 0; j < 2; j++) {
+      d = fabs(o->uv[j] - v.uv[j]);
+      if (d > error->max_uv_error) error->max_uv_error = d;
+    }
+  }
+  if (diagonal > 0.0) {
+    error->max_relative_position_error = error->max_position_error /
+      diagonal;
+  }
+  if (uv_range > 0.0) {
+    error->max_relative_uv_error = error->max_uv_error / uv_range;
+  }
+}
+
+void CombineQuantizationErrors(QuantizationError *total,
+    const QuantizationError *other) {
+  if (other->max_position_error > total->max_position_error) {
+    total->max_position_error = other->max_position_error;
+  }
+  if (other->max_relative_position_error >
+    total->max_relative_position_error) {
+    total->max_relative_position_error = other->max_relative_position_error;
+  }
+  if (other->max_normal_error_degrees > total->max_normal_error_degrees) {
+    total->max_normal_error_degrees = other->max_normal_error_degrees;
+  }
+  if (other->max_uv_error > total->max_uv_error) {
+    total->max_uv_error = other->max_uv_error;
+  }
+  if (other->max_relative_uv_error > total->max_relative_uv_error) {
+    total->max_relative_uv_error = other->max_relative_uv_error;
+  }
+}
+
+int CheckQuantizationError(const QuantizationError *error) {
+  return (error->max_relative_position_error <=
+    MAX_RELATIVE_POSITION_ERROR) && (error->max_normal_error_degrees <=
+    MAX_NORMAL_ERROR_DEGREES) && (error->max_relative_uv_error <=
+    MAX_RELATIVE_UV_ERROR);
+}
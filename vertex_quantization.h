@@ -0,0 +1,98 @@
+// Defines a compact, 16-byte vertex format, along with functions for
+// converting ObjectFileVertex arrays to it and measuring the error this
+// introduces. Positions are stored as unorm16 values relative to the mesh's
+// bounding box, normals are octahedral-encoded as two snorm16 values, and UV
+// coordinates are stored as unorm16 values relative to their own range. The
+// shader gets the offsets and scales needed to undo this as uniforms.
+#ifndef OPENGL_TUTORIAL_VERTEX_QUANTIZATION_H
+#define OPENGL_TUTORIAL_VERTEX_QUANTIZATION_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "parse_obj.h"
+
+// The largest acceptable errors, as checked by CheckQuantizationError. The
+// position and UV tolerances are relative to the size of the mesh's bounding
+// box and UV range, respectively.
+#define MAX_RELATIVE_POSITION_ERROR (1.0e-4)
+#define MAX_NORMAL_ERROR_DEGREES (0.1)
+#define MAX_RELATIVE_UV_ERROR (1.0e-4)
+
+// Holds a single quantized vertex. Must be exactly 16 bytes.
+typedef struct {
+  // Divided by 65535, this is the position within the mesh's bounding box.
+  uint16_t position[3];
+  uint16_t padding;
+  // The octahedral encoding of the unit normal, divided by 32767.
+  int16_t normal[2];
+  // Divided by 65535, this is the UV coordinate within the UV range.
+  uint16_t uv[2];
+} QuantizedVertex;
+
+// Holds the values needed to convert a quantized vertex back to floats: the
+// original position is position_offset + position_scale * (position / 65535),
+// and likewise for UV coordinates.
+typedef struct {
+  float position_offset[3];
+  float position_scale[3];
+  float uv_offset[2];
+  float uv_scale[2];
+} QuantizationParams;
+
+// Holds the largest errors introduced by quantizing a set of vertices.
+typedef struct {
+  // The largest distance between an original and dequantized position, in
+  // the mesh's units, and relative to its bounding box diagonal.
+  double max_position_error;
+  double max_relative_position_error;
+  // The largest angle between an original and dequantized normal, ignoring
+  // zero-length normals.
+  double max_normal_error_degrees;
+  // The largest difference in any UV coordinate, and relative to the larger
+  // dimension of the UV range.
+  double max_uv_error;
+  double max_relative_uv_error;
+} QuantizationError;
+
+// Quantizes count vertices from in into out, which must have room for count
+// vertices, and fills in params with the values needed to dequantize them.
+// Returns 0 on error.
+int QuantizeVertices(const ObjectFileVertex *in, uint32_t count,
+    QuantizedVertex *out, QuantizationParams *params);
+
+// Fills in params for quantizing the given vertices, from the bounding box of
+// their positions and the range of their UV coordinates.
+void ComputeQuantizationParams(const ObjectFileVertex *in, uint32_t count,
+    QuantizationParams *params);
+
+// Quantizes count vertices from in into out using the given params, which
+// must have come from ComputeQuantizationParams with a set of vertices
+// including these. This allows quantizing a large mesh a piece at a time.
+void QuantizeVerticesWithParams(const ObjectFileVertex *in, uint32_t count,
+    const QuantizationParams *params, QuantizedVertex *out);
+
+// Converts a single quantized vertex back to floats, in the same way as the
+// vertex shader.
+void DequantizeVertex(const QuantizedVertex *in,
+    const QuantizationParams *params, ObjectFileVertex *out);
+
+// Compares count original vertices against their quantized versions, and
+// fills in error with the largest differences.
+void MeasureQuantizationError(const ObjectFileVertex *original,
+    const QuantizedVertex *quantized, uint32_t count,
+    const QuantizationParams *params, QuantizationError *error);
+
+// Updates total to hold the larger of its own errors and the ones in other,
+// for measuring the error of a mesh quantized a piece at a time. Both must use
+// the same params.
+void CombineQuantizationErrors(QuantizationError *total,
+    const QuantizationError *other);
+
+// Returns nonzero if every error is within the MAX_* tolerances above.
+int CheckQuantizationError(const QuantizationError *error);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENGL_TUTORIAL_VERTEX_QUANTIZATION_H